@@ -0,0 +1,112 @@
+/*
+ * Architectural state of an LC-2K machine and a functional core that steps
+ * it, with the instruction-level simulator's semantics.
+ *
+ * This is the state a timing model hands off at an instruction boundary:
+ * pc, registers and memory, nothing in flight.  The pipeline simulator
+ * fast-forwards with archStep() between detailed samples, building its
+ * pipeline from an archStateType and draining back into one.
+ *
+ * Instructions come from instrMem and lw and sw go to dataMem, as in the
+ * pipeline; pass the same memory twice for the simulator's single one.
+ * archStep() reports what the instruction did, so a caller can warm
+ * predictors and caches with it.
+ */
+#ifndef LC2K_ARCH_H
+#define LC2K_ARCH_H
+
+#include "lc2k.h"
+#include "memory.h"
+
+#define ARCH_NUMREGS 8
+
+enum ArchStatus
+{
+  ARCH_RUNNING,
+  ARCH_HALTED,
+  ARCH_BAD_REGISTER, /* add or nor with destReg above 7 */
+  ARCH_BAD_PC        /* pc outside memory */
+};
+
+typedef struct archStateStruct
+{
+  int pc;
+  int reg[ARCH_NUMREGS];
+  long long instructions; /* executed, halt included */
+} archStateType;
+
+/* what one archStep() did */
+typedef struct archStepStruct
+{
+  int pc;
+  int instr;
+  int addr;   /* lw, sw */
+  int taken;  /* beq, jalr */
+  int target; /* beq, jalr */
+} archStepType;
+
+/* execute the instruction at arch->pc; an error leaves arch as it was */
+static inline int archStep(archStateType *arch, const memoryType *instrMem,
+                           memoryType *dataMem, archStepType *step)
+{
+  int instr, regA, regB, offset;
+
+  if ((unsigned int)arch->pc >= MEM_WORDS)
+    return ARCH_BAD_PC;
+  instr = memRead(instrMem, arch->pc);
+  regA = instRegA(instr);
+  regB = instRegB(instr);
+  offset = signExtend16(instField2(instr));
+  step->pc = arch->pc;
+  step->instr = instr;
+  step->addr = 0;
+  step->taken = 0;
+  step->target = 0;
+
+  switch (instOpcode(instr))
+  {
+  case OP_ADD:
+  case OP_NOR:
+    if (instField2(instr) >= ARCH_NUMREGS)
+      return ARCH_BAD_REGISTER;
+    if (instOpcode(instr) == OP_ADD)
+      arch->reg[instField2(instr)] = arch->reg[regA] + arch->reg[regB];
+    else
+      arch->reg[instField2(instr)] = ~(arch->reg[regA] | arch->reg[regB]);
+    arch->pc++;
+    break;
+  case OP_LW:
+    step->addr = arch->reg[regA] + offset;
+    arch->reg[regB] = memRead(dataMem, step->addr);
+    arch->pc++;
+    break;
+  case OP_SW:
+    step->addr = arch->reg[regA] + offset;
+    memWrite(dataMem, step->addr, arch->reg[regB]);
+    arch->pc++;
+    break;
+  case OP_BEQ:
+    step->target = arch->pc + 1 + offset;
+    step->taken = arch->reg[regA] == arch->reg[regB];
+    arch->pc = step->taken ? step->target : arch->pc + 1;
+    break;
+  case OP_JALR:
+    /* regB is written first, so jalr regA regA lands on pc + 1 */
+    arch->reg[regB] = arch->pc + 1;
+    step->target = arch->reg[regA];
+    step->taken = 1;
+    arch->pc = step->target;
+    break;
+  case OP_HALT:
+    arch->pc++;
+    arch->instructions++;
+    return ARCH_HALTED;
+  default: /* noop */
+    arch->pc++;
+    break;
+  }
+  arch->instructions++;
+  return ARCH_RUNNING;
+}
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Batch mode shared by both simulators: a manifest of jobs, the images they
+ * run, and one result record per job.
+ *
+ * Manifest: one job per line, "#" starts a comment.
+ *
+ *     <machine-code file> [rN=value]... [mem[addr]=value]...
+ *
+ * e.g. "mult.mc r1=3 mem[20]=7".  Overrides are applied on top of the image
+ * after the machine is reset.  Each distinct file is loaded once, before any
+ * job runs, and every job starts from a copy-on-write snapshot of it.
+ *
+ * Records are JSON, one line per job, in manifest order:
+ *
+ *     {"job":0,"image":"mult.mc","status":"halted","instructions":161,
+ *      "pc":16,"reg":[0,...],"memHash":"9a0c51e2"}
+ *
+ * status is "halted" or "error"; an error record has the message in "error"
+ * and no count.  memHash is FNV-1a over the final memory words that were
+ * loaded from the image.
+ */
+#ifndef LC2K_BATCH_H
+#define LC2K_BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+#include "memory.h"
+
+#define BATCH_LINE_LENGTH 4096
+#define BATCH_NUMREGS 8
+
+typedef struct overrideStruct
+{
+  int isMem;
+  int index; /* register number or memory address */
+  int value;
+} overrideType;
+
+typedef struct batchImageStruct
+{
+  char *name;
+  memoryType mem;
+  int numWords;
+  const char *error; /* non-NULL if the file could not be loaded */
+} batchImageType;
+
+typedef struct batchJobStruct
+{
+  int image;
+  overrideType *overrides;
+  int numOverrides;
+  /* result */
+  const char *error;
+  long long count; /* instructions or cycles */
+  int pc;
+  int reg[BATCH_NUMREGS];
+  unsigned int memHash;
+} batchJobType;
+
+typedef struct batchStruct
+{
+  batchJobType *jobs;
+  int numJobs;
+  batchImageType *images;
+  int numImages;
+} batchType;
+
+static inline void *batchGrow(void *array, int count, int *capacity, size_t size)
+{
+  if (count < *capacity)
+    return array;
+  *capacity = *capacity ? 2 * *capacity : 16;
+  array = realloc(array, *capacity * size);
+  if (array == NULL)
+  {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  return array;
+}
+
+/* text .mc or binary image; NULL on success, else why not */
+static inline const char *batchReadWords(batchImageType *image, int *words,
+                                         int maxWords)
+{
+  char line[BATCH_LINE_LENGTH];
+  const char *error;
+  FILE *filePtr;
+
+  if ((image->numWords = loadImage(image->name, words, maxWords, &error)) >= 0)
+    return NULL;
+  if (error != NULL)
+    return error;
+  if ((filePtr = fopen(image->name, "r")) == NULL)
+    return "can't open file";
+  for (image->numWords = 0; image->numWords < maxWords &&
+                            fgets(line, sizeof(line), filePtr) != NULL;
+       image->numWords++)
+  {
+    if (sscanf(line, "%d", words + image->numWords) != 1)
+    {
+      fclose(filePtr);
+      return "error in reading machine code";
+    }
+  }
+  fclose(filePtr);
+  return NULL;
+}
+
+static inline const char *batchLoadImage(batchImageType *image, int maxWords)
+{
+  const char *error;
+  int *words = calloc(maxWords, sizeof(int));
+
+  if (words == NULL)
+  {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  error = batchReadWords(image, words, maxWords);
+  memLoad(&image->mem, words, error == NULL ? image->numWords : 0);
+  free(words);
+  return error;
+}
+
+static inline int batchFindImage(batchType *batch, const char *name, int *capacity)
+{
+  int i;
+
+  for (i = 0; i < batch->numImages; i++)
+  {
+    if (!strcmp(batch->images[i].name, name))
+      return i;
+  }
+  batch->images = batchGrow(batch->images, batch->numImages, capacity,
+                            sizeof(batchImageType));
+  memset(&batch->images[i], 0, sizeof(batchImageType));
+  batch->images[i].name = strdup(name);
+  batch->numImages++;
+  return i;
+}
+
+static inline int batchParseOverride(const char *token, overrideType *ov, int maxWords)
+{
+  char *end;
+  const char *value;
+  long index;
+
+  if (token[0] == 'r' && token[1] >= '0' && token[1] < '0' + BATCH_NUMREGS &&
+      token[2] == '=')
+  {
+    ov->isMem = 0;
+    ov->index = token[1] - '0';
+    value = token + 3;
+  }
+  else if (!strncmp(token, "mem[", 4))
+  {
+    index = strtol(token + 4, &end, 0);
+    if (end == token + 4 || strncmp(end, "]=", 2) || index < 0 || index >= maxWords)
+      return 0;
+    ov->isMem = 1;
+    ov->index = (int)index;
+    value = end + 2;
+  }
+  else
+  {
+    return 0;
+  }
+  ov->value = (int)strtol(value, &end, 0);
+  return end != value && *end == '\0';
+}
+
+/* read the manifest and load every image it names; exits on a bad manifest */
+static inline void readManifest(const char *fileName, batchType *batch, int maxWords)
+{
+  char line[BATCH_LINE_LENGTH];
+  FILE *filePtr;
+  int jobCapacity = 0, imageCapacity = 0, lineNum = 0, i;
+
+  memset(batch, 0, sizeof(*batch));
+  filePtr = strcmp(fileName, "-") ? fopen(fileName, "r") : stdin;
+  if (filePtr == NULL)
+  {
+    printf("error: can't open manifest %s\n", fileName);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), filePtr) != NULL)
+  {
+    char *token, *save;
+    batchJobType *job;
+    int ovCapacity = 0;
+
+    lineNum++;
+    if ((token = strchr(line, '#')) != NULL)
+      *token = '\0';
+    if ((token = strtok_r(line, " \t\r\n", &save)) == NULL)
+      continue;
+
+    batch->jobs = batchGrow(batch->jobs, batch->numJobs, &jobCapacity,
+                            sizeof(batchJobType));
+    job = &batch->jobs[batch->numJobs++];
+    memset(job, 0, sizeof(*job));
+    job->image = batchFindImage(batch, token, &imageCapacity);
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+    {
+      job->overrides = batchGrow(job->overrides, job->numOverrides, &ovCapacity,
+                                 sizeof(overrideType));
+      if (!batchParseOverride(token, &job->overrides[job->numOverrides], maxWords))
+      {
+        printf("error: manifest line %d: bad override %s\n", lineNum, token);
+        exit(1);
+      }
+      job->numOverrides++;
+    }
+  }
+  if (filePtr != stdin)
+    fclose(filePtr);
+
+  for (i = 0; i < batch->numImages; i++)
+    batch->images[i].error = batchLoadImage(&batch->images[i], maxWords);
+}
+
+static inline unsigned int batchHash(const memoryType *mem, int numWords)
+{
+  unsigned int hash = 2166136261u;
+  int i, b;
+
+  for (i = 0; i < numWords; i++)
+  {
+    for (b = 0; b < 4; b++)
+    {
+      hash ^= ((unsigned int)memRead(mem, i) >> (8 * b)) & 0xFF;
+      hash *= 16777619u;
+    }
+  }
+  return hash;
+}
+
+static inline void batchPrintString(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+  for (; *s; s++)
+  {
+    if (*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(fp, "\\u%04x", *s);
+    else
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+/* countName is "instructions" or "cycles" */
+static inline void writeBatchRecords(const batchType *batch, const char *countName)
+{
+  int i, r;
+
+  for (i = 0; i < batch->numJobs; i++)
+  {
+    const batchJobType *job = &batch->jobs[i];
+
+    printf("{\"job\":%d,\"image\":", i);
+    batchPrintString(stdout, batch->images[job->image].name);
+    if (job->error != NULL)
+    {
+      /* the count is lost when a job aborts */
+      printf(",\"status\":\"error\",\"error\":");
+      batchPrintString(stdout, job->error);
+    }
+    else
+    {
+      printf(",\"status\":\"halted\",\"%s\":%lld", countName, job->count);
+    }
+    printf(",\"pc\":%d,\"reg\":[", job->pc);
+    for (r = 0; r < BATCH_NUMREGS; r++)
+      printf(r ? ",%d" : "%d", job->reg[r]);
+    printf("],\"memHash\":\"%08x\"}\n", job->memHash);
+  }
+}
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * Timing model of a cache hierarchy for the pipeline simulator.
+ *
+ * Caches only count cycles; the data itself stays in the memoryType.  A
+ * cache is described by a spec string, sizes in words:
+ *
+ *     size:assoc:block[:lru|fifo|random][:wb|wt][:wa|nwa][:latency]
+ *
+ * e.g. "256:2:4" (256 words, 2-way, 4-word blocks, LRU, write-back,
+ * write-allocate, 1-cycle hits) or "4096:8:8:wt:nwa:6".  Each cache passes
+ * misses to the next level, the last one to a memory of memLatency cycles.
+ *
+ * cacheAccess() returns how many cycles an access takes.  A read miss costs
+ * the hit latency plus the next level's access.  Writes to the next level
+ * (write-through, no-allocate misses, dirty evictions) are counted but go
+ * through a write buffer and cost nothing.
+ */
+#ifndef LC2K_CACHE_H
+#define LC2K_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum CachePolicy
+{
+  CACHE_LRU,
+  CACHE_FIFO,
+  CACHE_RANDOM
+};
+
+typedef struct cacheConfigStruct
+{
+  int size; /* words; 0 means no cache */
+  int assoc;
+  int block; /* words */
+  int policy;
+  int writeBack;     /* else write-through */
+  int writeAllocate; /* else no-allocate */
+  int latency;       /* cycles for a hit */
+} cacheConfigType;
+
+typedef struct cacheLineStruct
+{
+  unsigned int tag; /* block number */
+  int valid;
+  int dirty;
+  long long stamp; /* last use (LRU) or fill (FIFO) */
+} cacheLineType;
+
+typedef struct cacheStruct
+{
+  const char *name;
+  cacheConfigType config;
+  int numSets;
+  cacheLineType *lines; /* numSets * assoc */
+  struct cacheStruct *next; /* NULL: memory */
+  int memLatency;
+  long long clock;
+  unsigned int seed; /* random replacement */
+  /* statistics */
+  long long reads;
+  long long writes;
+  long long hits;
+  long long misses;
+  long long evictions;
+  long long writebacks; /* dirty evictions */
+  long long writesThrough;
+} cacheType;
+
+/* fill *config from spec; NULL on success, else why not */
+static inline const char *parseCacheConfig(const char *spec, cacheConfigType *config)
+{
+  char *copy, *token, *save, *end;
+  int field = 0;
+  long value;
+
+  memset(config, 0, sizeof(*config));
+  config->policy = CACHE_LRU;
+  config->writeBack = 1;
+  config->writeAllocate = 1;
+  config->latency = 1;
+  if ((copy = strdup(spec)) == NULL)
+    return "out of memory";
+  for (token = strtok_r(copy, ":", &save); token != NULL;
+       token = strtok_r(NULL, ":", &save), field++)
+  {
+    value = strtol(token, &end, 0);
+    if (end != token && *end == '\0')
+    {
+      if (value <= 0 || value > (1 << 24))
+        break;
+      if (field == 0)
+        config->size = (int)value;
+      else if (field == 1)
+        config->assoc = (int)value;
+      else if (field == 2)
+        config->block = (int)value;
+      else
+        config->latency = (int)value;
+      continue;
+    }
+    if (field < 3)
+      break;
+    if (!strcmp(token, "lru"))
+      config->policy = CACHE_LRU;
+    else if (!strcmp(token, "fifo"))
+      config->policy = CACHE_FIFO;
+    else if (!strcmp(token, "random"))
+      config->policy = CACHE_RANDOM;
+    else if (!strcmp(token, "wb"))
+      config->writeBack = 1;
+    else if (!strcmp(token, "wt"))
+      config->writeBack = 0;
+    else if (!strcmp(token, "wa"))
+      config->writeAllocate = 1;
+    else if (!strcmp(token, "nwa"))
+      config->writeAllocate = 0;
+    else
+      break;
+  }
+  free(copy);
+  if (token != NULL || field < 3)
+    return "expected size:assoc:block[:lru|fifo|random][:wb|wt][:wa|nwa][:latency]";
+  if (config->size % (config->assoc * config->block) != 0)
+    return "size must be a multiple of assoc * block";
+  return NULL;
+}
+
+static inline void cacheInit(cacheType *cache, const char *name,
+                             const cacheConfigType *config, cacheType *next,
+                             int memLatency)
+{
+  memset(cache, 0, sizeof(*cache));
+  cache->name = name;
+  cache->config = *config;
+  cache->numSets = config->size / (config->assoc * config->block);
+  cache->lines = calloc((size_t)cache->numSets * config->assoc, sizeof(cacheLineType));
+  if (cache->lines == NULL)
+  {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  cache->next = next;
+  cache->memLatency = memLatency;
+  cache->seed = 1;
+}
+
+static inline void cacheFree(cacheType *cache)
+{
+  free(cache->lines);
+  cache->lines = NULL;
+}
+
+static inline int cacheAccess(cacheType *cache, int addr, int isWrite);
+
+/* cycles to read from the level after cache; writes cost nothing */
+static inline int cacheNextLevel(cacheType *cache, int addr, int isWrite)
+{
+  if (cache->next != NULL)
+    return cacheAccess(cache->next, addr, isWrite);
+  return isWrite ? 0 : cache->memLatency;
+}
+
+/* the way to fill in set: an invalid one, else the policy's victim */
+static inline cacheLineType *cacheVictim(cacheType *cache, cacheLineType *set)
+{
+  cacheLineType *victim = set;
+  int way;
+
+  for (way = 0; way < cache->config.assoc; way++)
+  {
+    if (!set[way].valid)
+      return &set[way];
+    if (set[way].stamp < victim->stamp)
+      victim = &set[way];
+  }
+  if (cache->config.policy == CACHE_RANDOM)
+  {
+    cache->seed = cache->seed * 1103515245u + 12345u;
+    victim = &set[(cache->seed >> 16) % cache->config.assoc];
+  }
+  return victim;
+}
+
+static inline int cacheAccess(cacheType *cache, int addr, int isWrite)
+{
+  unsigned int block = (unsigned int)addr / cache->config.block;
+  cacheLineType *set = &cache->lines[(size_t)(block % cache->numSets) * cache->config.assoc];
+  cacheLineType *line;
+  int way, cycles = cache->config.latency;
+
+  cache->clock++;
+  if (isWrite)
+    cache->writes++;
+  else
+    cache->reads++;
+  for (way = 0; way < cache->config.assoc; way++)
+  {
+    if (set[way].valid && set[way].tag == block)
+      break;
+  }
+
+  if (way < cache->config.assoc)
+  {
+    cache->hits++;
+    line = &set[way];
+  }
+  else
+  {
+    cache->misses++;
+    if (isWrite && !cache->config.writeAllocate)
+    {
+      cache->writesThrough++;
+      cacheNextLevel(cache, addr, 1);
+      return cycles;
+    }
+    line = cacheVictim(cache, set);
+    if (line->valid)
+    {
+      cache->evictions++;
+      if (line->dirty)
+      {
+        cache->writebacks++;
+        cacheNextLevel(cache, (int)(line->tag * cache->config.block), 1);
+      }
+    }
+    cycles += cacheNextLevel(cache, addr, 0);
+    line->tag = block;
+    line->valid = 1;
+    line->dirty = 0;
+    line->stamp = cache->clock;
+  }
+
+  if (cache->config.policy == CACHE_LRU)
+    line->stamp = cache->clock;
+  if (isWrite)
+  {
+    if (cache->config.writeBack)
+    {
+      line->dirty = 1;
+    }
+    else
+    {
+      cache->writesThrough++;
+      cacheNextLevel(cache, addr, 1);
+    }
+  }
+  return cycles;
+}
+
+static inline void printCacheReport(FILE *fp, const cacheType *cache)
+{
+  long long accesses = cache->reads + cache->writes;
+  const char *policies[] = {"lru", "fifo", "random"};
+
+  fprintf(fp, "%s: %d words, %d-way, %d-word blocks, %s, %s, %s, %d-cycle hits\n",
+          cache->name, cache->config.size, cache->config.assoc, cache->config.block,
+          policies[cache->config.policy], cache->config.writeBack ? "write-back" : "write-through",
+          cache->config.writeAllocate ? "write-allocate" : "no-allocate", cache->config.latency);
+  fprintf(fp, "\treads %lld writes %lld hits %lld misses %lld (%.2f%%)\n", cache->reads,
+          cache->writes, cache->hits, cache->misses,
+          accesses ? 100.0 * cache->misses / accesses : 0.0);
+  fprintf(fp, "\tevictions %lld writebacks %lld writes through %lld\n", cache->evictions,
+          cache->writebacks, cache->writesThrough);
+}
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Binary LC-2K machine-code image, an alternative to the text .mc format.
+ *
+ * All fields are little-endian:
+ *   0   char[4]  magic "LC2K"
+ *   4   uint16   version (IMAGE_VERSION)
+ *   6   uint16   flags (IMAGE_HAS_SYMBOLS)
+ *   8   uint32   number of words
+ *   12  uint32   number of symbols
+ *   16  int32    words[number of words]
+ *   then, if IMAGE_HAS_SYMBOLS, for each symbol:
+ *       uint32 address, uint16 name length, name bytes (no terminator)
+ */
+#ifndef LC2K_IMAGE_H
+#define LC2K_IMAGE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IMAGE_MAGIC "LC2K"
+#define IMAGE_VERSION 1
+#define IMAGE_HAS_SYMBOLS 0x1
+#define IMAGE_HEADER_SIZE 16
+
+static inline void putLE(FILE *outFilePtr, unsigned int value, int bytes)
+{
+  int i;
+
+  for (i = 0; i < bytes; ++i)
+    fputc((value >> (8 * i)) & 0xFF, outFilePtr);
+}
+
+static inline unsigned int getLE32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/* the caller then writes numWords words and numSymbols symbols, in order */
+static inline void writeImageHeader(FILE *outFilePtr, int numWords, int numSymbols)
+{
+  fwrite(IMAGE_MAGIC, 1, 4, outFilePtr);
+  putLE(outFilePtr, IMAGE_VERSION, 2);
+  putLE(outFilePtr, numSymbols > 0 ? IMAGE_HAS_SYMBOLS : 0, 2);
+  putLE(outFilePtr, numWords, 4);
+  putLE(outFilePtr, numSymbols, 4);
+}
+
+static inline void writeImageWord(FILE *outFilePtr, int word)
+{
+  putLE(outFilePtr, (unsigned int)word, 4);
+}
+
+static inline void writeImageSymbol(FILE *outFilePtr, const char *name, int len, int addr)
+{
+  putLE(outFilePtr, addr, 4);
+  putLE(outFilePtr, len, 2);
+  fwrite(name, 1, len, outFilePtr);
+}
+
+/*
+ * If fileName is a binary image, mmap it and copy its words into mem.
+ * Returns the number of words loaded, or -1 if the file is not a binary
+ * image, in which case the caller reads it as text. A malformed image also
+ * returns -1, with *error saying why; *error is NULL otherwise.
+ */
+static inline int loadImage(const char *fileName, int *mem, int maxWords, const char **error)
+{
+  struct stat st;
+  const unsigned char *base;
+  unsigned int numWords;
+  int fd, i;
+
+  *error = NULL;
+  if ((fd = open(fileName, O_RDONLY)) < 0)
+    return -1;
+
+  if (fstat(fd, &st) != 0 || st.st_size < IMAGE_HEADER_SIZE ||
+      (base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+  {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  if (memcmp(base, IMAGE_MAGIC, 4) != 0)
+  {
+    munmap((void *)base, st.st_size);
+    return -1;
+  }
+
+  numWords = getLE32(base + 8);
+  if ((base[4] | (base[5] << 8)) != IMAGE_VERSION)
+    *error = "unsupported image version";
+  else if (numWords > (unsigned int)maxWords ||
+           (st.st_size - IMAGE_HEADER_SIZE) / 4 < numWords)
+    *error = "bad image word count";
+  if (*error != NULL)
+  {
+    munmap((void *)base, st.st_size);
+    return -1;
+  }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(mem, base + IMAGE_HEADER_SIZE, (size_t)numWords * 4);
+  (void)i;
+#else
+  for (i = 0; i < (int)numWords; ++i)
+    mem[i] = (int)getLE32(base + IMAGE_HEADER_SIZE + 4 * i);
+#endif
+
+  munmap((void *)base, st.st_size);
+  return numWords;
+}
+
+#endif /* LC2K_IMAGE_H */
@@ -0,0 +1,120 @@
+/* LC-2K instruction set, shared by the assembler and both simulators */
+#ifndef LC2K_H
+#define LC2K_H
+
+#include <string.h>
+
+enum Format
+{
+  FMT_R, /* add, nor: regA regB destReg */
+  FMT_I, /* lw, sw, beq: regA regB offsetField */
+  FMT_J, /* jalr: regA regB */
+  FMT_O, /* halt, noop: no operands */
+  FMT_FILL, /* .fill: one value or label, not an instruction */
+};
+
+/*
+ * The instruction table. Rows must stay in opcode order, since the row index
+ * is the opcode. Columns:
+ *   X(enum name, mnemonic, 1st char, 2nd char, length, format, pcRelative)
+ * The two chars and the length feed LC2K_HASH, which lets the compiler lay
+ * out the mnemonic lookup table. pcRelative means a label operand is encoded
+ * relative to pc + 1 (beq) instead of as an absolute address.
+ */
+#define LC2K_INSTRUCTIONS(X)                  \
+  X(OP_ADD, "add", 'a', 'd', 3, FMT_R, 0)     \
+  X(OP_NOR, "nor", 'n', 'o', 3, FMT_R, 0)     \
+  X(OP_LW, "lw", 'l', 'w', 2, FMT_I, 0)       \
+  X(OP_SW, "sw", 's', 'w', 2, FMT_I, 0)       \
+  X(OP_BEQ, "beq", 'b', 'e', 3, FMT_I, 1)     \
+  X(OP_JALR, "jalr", 'j', 'a', 4, FMT_J, 0)   \
+  X(OP_HALT, "halt", 'h', 'a', 4, FMT_O, 0)   \
+  X(OP_NOOP, "noop", 'n', 'o', 4, FMT_O, 0)   \
+  X(OP_FILL, ".fill", '.', 'f', 5, FMT_FILL, 0)
+
+#define LC2K_ENUM(op, name, c0, c1, len, format, rel) op,
+enum OpCode
+{
+  LC2K_INSTRUCTIONS(LC2K_ENUM)
+  NUMOPCODES
+};
+#undef LC2K_ENUM
+
+#define NUMINSTOPCODES OP_FILL /* opcodes that fit in bits 24-22 */
+
+typedef struct
+{
+  const char *name;
+  int len;
+  enum Format format;
+  int pcRelative;
+} opInfoType;
+
+#define LC2K_INFO(op, name, c0, c1, len, format, rel) {name, len, format, rel},
+static const opInfoType opTable[NUMOPCODES] = {
+  LC2K_INSTRUCTIONS(LC2K_INFO)
+};
+#undef LC2K_INFO
+
+/*
+ * Perfect hash over the mnemonics: first char + second char + length is
+ * distinct mod 16 for every row. A new row that collides shows up as an
+ * -Woverride-init warning on opHash.
+ */
+#define LC2K_HASH(c0, c1, len) (((c0) + (c1) + (len)) & 15)
+
+#define LC2K_SLOT(op, name, c0, c1, len, format, rel) [LC2K_HASH(c0, c1, len)] = op + 1,
+static const unsigned char opHash[16] = {
+  LC2K_INSTRUCTIONS(LC2K_SLOT)
+};
+#undef LC2K_SLOT
+
+/* return the opcode for a mnemonic of len bytes, or -1 */
+static inline int lookupOpcode(const char *mnemonic, int len)
+{
+  int op;
+
+  if (len < 2)
+    return -1;
+
+  op = opHash[LC2K_HASH((unsigned char)mnemonic[0], (unsigned char)mnemonic[1], len)] - 1;
+  if (op < 0 || opTable[op].len != len || memcmp(opTable[op].name, mnemonic, len) != 0)
+    return -1;
+
+  return op;
+}
+
+/* instruction fields (bit 0 is the least-significant bit) */
+static inline int instOpcode(int instr)
+{
+  return (instr >> 22) & 0x7;
+}
+
+static inline int instRegA(int instr)
+{
+  return (instr >> 19) & 0x7;
+}
+
+static inline int instRegB(int instr)
+{
+  return (instr >> 16) & 0x7;
+}
+
+/* bits 15-0: destReg for R-type (plus the unused bits), offsetField for I-type */
+static inline int instField2(int instr)
+{
+  return instr & 0xFFFF;
+}
+
+/* convert a 16-bit offsetField into a 32-bit int */
+static inline int signExtend16(int num)
+{
+  if (num & (1 << 15))
+  {
+    num -= (1 << 16);
+  }
+
+  return (num);
+}
+
+#endif /* LC2K_H */
@@ -0,0 +1,155 @@
+/*
+ * Block compression in the LZ4 block format, for execution traces.
+ *
+ * A block is a run of sequences.  Each is a token byte (literal count in
+ * the high nibble, match length - 4 in the low one; 15 means more length
+ * bytes follow, each added until one is below 255), the literals, and a
+ * 16-bit little-endian offset back to the match.  The last sequence is
+ * literals only.  As the format requires, the last 5 bytes are always
+ * literals and no match starts within 12 bytes of the end, so `lz4`
+ * itself can decode these blocks (in a legacy frame, say).
+ *
+ * The compressor is the plain greedy one: a hash of the next 4 bytes finds
+ * the last position that started with them, within 64K.  Traces are
+ * mostly short repeating step records, so that is enough.
+ */
+#ifndef LC2K_LZ_H
+#define LC2K_LZ_H
+
+#include <string.h>
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12 /* no match starts in the last 12 bytes */
+#define LZ_MAX_OFFSET 65535
+
+/* the most lzCompress() can produce from size bytes */
+#define LZ_BOUND(size) ((size) + (size) / 255 + 16)
+
+static inline unsigned int lzRead32(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static inline int lzHash(unsigned int sequence)
+{
+  return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* a 15-or-more length's extra bytes; returns the new output position */
+static inline int lzPutLength(unsigned char *dst, int op, int length)
+{
+  for (length -= 15; length >= 255; length -= 255)
+    dst[op++] = 255;
+  dst[op++] = length;
+  return op;
+}
+
+/* literals src[anchor..end) and, if length, a match offset back */
+static inline int lzPutSequence(unsigned char *dst, int op, int capacity,
+                                const unsigned char *src, int anchor, int end,
+                                int offset, int length)
+{
+  int literals = end - anchor;
+  int token = (literals < 15 ? literals : 15) << 4;
+
+  if (length)
+    token |= length - LZ_MIN_MATCH < 15 ? length - LZ_MIN_MATCH : 15;
+  /* token, both lengths, literals and offset, at their largest */
+  if (op + 1 + literals / 255 + 1 + literals + 2 + length / 255 + 1 > capacity)
+    return -1;
+  dst[op++] = token;
+  if (literals >= 15)
+    op = lzPutLength(dst, op, literals);
+  memcpy(dst + op, src + anchor, literals);
+  op += literals;
+  if (length)
+  {
+    dst[op++] = offset & 0xFF;
+    dst[op++] = offset >> 8;
+    if (length - LZ_MIN_MATCH >= 15)
+      op = lzPutLength(dst, op, length - LZ_MIN_MATCH);
+  }
+  return op;
+}
+
+/* compress size bytes of src into dst; the compressed size, or 0 if it does not fit */
+static inline int lzCompress(const unsigned char *src, int size, unsigned char *dst,
+                             int capacity)
+{
+  int table[1 << LZ_HASH_BITS]; /* position + 1 of the last 4 bytes with each hash */
+  int ip = 0, anchor = 0, op = 0, ref, length, h;
+
+  memset(table, 0, sizeof(table));
+  while (ip < size - LZ_MATCH_LIMIT)
+  {
+    h = lzHash(lzRead32(src + ip));
+    ref = table[h] - 1;
+    table[h] = ip + 1;
+    if (ref < 0 || ip - ref > LZ_MAX_OFFSET || lzRead32(src + ref) != lzRead32(src + ip))
+    {
+      ip++;
+      continue;
+    }
+    for (length = LZ_MIN_MATCH;
+         ip + length < size - LZ_LAST_LITERALS && src[ref + length] == src[ip + length];
+         length++)
+      ;
+    op = lzPutSequence(dst, op, capacity, src, anchor, ip, ip - ref, length);
+    if (op < 0)
+      return 0;
+    ip += length;
+    anchor = ip;
+  }
+  op = lzPutSequence(dst, op, capacity, src, anchor, size, 0, 0);
+  return op < 0 ? 0 : op;
+}
+
+/* a length's extra bytes; -1 if they run past end */
+static inline int lzGetLength(const unsigned char *src, int *ip, int end, int length)
+{
+  if (length != 15)
+    return length;
+  do
+  {
+    if (*ip >= end)
+      return -1;
+    length += src[*ip];
+  } while (src[(*ip)++] == 255);
+  return length;
+}
+
+/* decompress size bytes of src into dst; the decompressed size, or -1 if src is corrupt */
+static inline int lzDecompress(const unsigned char *src, int size, unsigned char *dst,
+                               int capacity)
+{
+  int ip = 0, op = 0, token, literals, length, offset;
+
+  while (ip < size)
+  {
+    token = src[ip++];
+    literals = lzGetLength(src, &ip, size, token >> 4);
+    length = token & 15;
+    if (literals < 0 || literals > size - ip || literals > capacity - op)
+      return -1;
+    memcpy(dst + op, src + ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == size)
+      return op; /* the last sequence */
+    if (ip + 2 > size)
+      return -1;
+    offset = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+    length = lzGetLength(src, &ip, size, length);
+    if (offset == 0 || offset > op || length < 0 || length + LZ_MIN_MATCH > capacity - op)
+      return -1;
+    /* byte by byte: a match may overlap what it copies */
+    for (length += LZ_MIN_MATCH; length > 0; length--, op++)
+      dst[op] = dst[op - offset];
+  }
+  return -1;
+}
+
+#endif
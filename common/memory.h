@@ -0,0 +1,139 @@
+/*
+ * Paged, copy-on-write LC-2K memory.
+ *
+ * The 64K-word address space is split into MEM_NUMPAGES pages of
+ * MEM_PAGEWORDS words.  A memoryType is only the page table: untouched pages
+ * all point at one shared page of zeros, and a page is allocated the first
+ * time it is written.  memSnapshot() copies just the table and takes a
+ * reference on every page, so a snapshot costs a few hundred bytes; whichever
+ * side writes a shared page first gets its own copy.  Reference counts are
+ * atomic, so snapshots of one image can run on different threads.
+ *
+ * Reads outside the address space return 0 and writes there are dropped.
+ */
+#ifndef LC2K_MEMORY_H
+#define LC2K_MEMORY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define MEM_WORDS 65536
+#define MEM_PAGEBITS 10
+#define MEM_PAGEWORDS (1 << MEM_PAGEBITS)
+#define MEM_NUMPAGES (MEM_WORDS / MEM_PAGEWORDS)
+
+typedef struct pageStruct
+{
+  atomic_int refs; /* 1 means the owner may write in place */
+  int words[MEM_PAGEWORDS];
+} pageType;
+
+typedef struct memoryStruct
+{
+  pageType *pages[MEM_NUMPAGES];
+} memoryType;
+
+/* never written and never freed; its count can never drop to 1 */
+static pageType memZeroPage = {1 << 30, {0}};
+
+static inline void memInit(memoryType *mem)
+{
+  int i;
+
+  for (i = 0; i < MEM_NUMPAGES; i++)
+    mem->pages[i] = &memZeroPage;
+}
+
+static inline int memRead(const memoryType *mem, int addr)
+{
+  if ((unsigned int)addr >= MEM_WORDS)
+    return 0;
+  return mem->pages[addr >> MEM_PAGEBITS]->words[addr & (MEM_PAGEWORDS - 1)];
+}
+
+static inline void memRelease(pageType *page)
+{
+  if (page != &memZeroPage && atomic_fetch_sub(&page->refs, 1) == 1)
+    free(page);
+}
+
+/* give mem its own copy of the page holding addr */
+static inline pageType *memUnshare(memoryType *mem, int addr)
+{
+  pageType *old = mem->pages[addr >> MEM_PAGEBITS];
+  pageType *page = malloc(sizeof(pageType));
+
+  if (page == NULL)
+  {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  atomic_init(&page->refs, 1);
+  memcpy(page->words, old->words, sizeof(page->words));
+  mem->pages[addr >> MEM_PAGEBITS] = page;
+  memRelease(old);
+  return page;
+}
+
+static inline void memWrite(memoryType *mem, int addr, int value)
+{
+  pageType *page;
+
+  if ((unsigned int)addr >= MEM_WORDS)
+    return;
+  page = mem->pages[addr >> MEM_PAGEBITS];
+  if (atomic_load_explicit(&page->refs, memory_order_relaxed) != 1)
+    page = memUnshare(mem, addr);
+  page->words[addr & (MEM_PAGEWORDS - 1)] = value;
+}
+
+/* dst becomes a copy-on-write copy of src; dst must not hold pages */
+static inline void memSnapshot(memoryType *dst, const memoryType *src)
+{
+  int i;
+
+  for (i = 0; i < MEM_NUMPAGES; i++)
+  {
+    dst->pages[i] = src->pages[i];
+    if (dst->pages[i] != &memZeroPage)
+      atomic_fetch_add(&dst->pages[i]->refs, 1);
+  }
+}
+
+static inline void memFree(memoryType *mem)
+{
+  int i;
+
+  for (i = 0; i < MEM_NUMPAGES; i++)
+  {
+    memRelease(mem->pages[i]);
+    mem->pages[i] = &memZeroPage;
+  }
+}
+
+/* words[0..numWords) into an empty memory; zero pages stay shared */
+static inline void memLoad(memoryType *mem, const int *words, int numWords)
+{
+  int i;
+
+  memInit(mem);
+  for (i = 0; i < numWords && i < MEM_WORDS; i++)
+  {
+    if (words[i] != 0)
+      memWrite(mem, i, words[i]);
+  }
+}
+
+/* pages this memory holds that are not the shared zero page */
+static inline int memPages(const memoryType *mem)
+{
+  int i, n = 0;
+
+  for (i = 0; i < MEM_NUMPAGES; i++)
+    n += mem->pages[i] != &memZeroPage;
+  return n;
+}
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * Work-stealing thread pool for independent jobs numbered 0..numJobs-1.
+ *
+ * Every worker owns a deque holding a contiguous range of job numbers,
+ * initially an equal slice.  It takes jobs from the front of its own range;
+ * once that is empty it steals the back half of the busiest other worker's
+ * range.  Jobs of very different lengths (a halting test next to one that
+ * runs into a step limit) therefore still keep every thread busy.
+ *
+ * Build with -pthread.
+ */
+#ifndef LC2K_POOL_H
+#define LC2K_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+/*
+ * head and tail change only under lock.  They are atomic because thieves
+ * also read them without it, to pick a victim; relaxed is enough there,
+ * since the range is read again under the lock before it is used.
+ */
+typedef struct poolDequeStruct
+{
+  pthread_mutex_t lock;
+  atomic_int head; /* next job the owner takes */
+  atomic_int tail; /* one past the last job */
+} poolDequeType;
+
+typedef struct poolStruct
+{
+  poolDequeType *deques;
+  int numWorkers;
+  void (*run)(void *arg, int worker, int job);
+  void *arg;
+} poolType;
+
+typedef struct poolWorkerStruct
+{
+  poolType *pool;
+  int self;
+} poolWorkerType;
+
+/* default thread count, like the assembler's -j */
+static inline int poolDefaultWorkers(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+/* jobs left in deque's range */
+static inline int poolLeft(poolDequeType *deque)
+{
+  return atomic_load_explicit(&deque->tail, memory_order_relaxed)
+         - atomic_load_explicit(&deque->head, memory_order_relaxed);
+}
+
+/* set deque's range; the caller holds its lock */
+static inline void poolSetRange(poolDequeType *deque, int head, int tail)
+{
+  atomic_store_explicit(&deque->head, head, memory_order_relaxed);
+  atomic_store_explicit(&deque->tail, tail, memory_order_relaxed);
+}
+
+static inline int poolTake(poolDequeType *deque)
+{
+  int job = -1;
+
+  pthread_mutex_lock(&deque->lock);
+  if (poolLeft(deque) > 0)
+  {
+    job = atomic_load_explicit(&deque->head, memory_order_relaxed);
+    atomic_store_explicit(&deque->head, job + 1, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return job;
+}
+
+/* move the back half of the busiest victim's range to self; 0 if all empty */
+static inline int poolSteal(poolType *pool, int self)
+{
+  poolDequeType *mine = &pool->deques[self];
+  int victim, best, most, half, i;
+
+  for (;;)
+  {
+    best = -1;
+    most = 0;
+    for (i = 0; i < pool->numWorkers; i++)
+    {
+      /* unlocked peek; the range is re-checked under the lock below */
+      int left = poolLeft(&pool->deques[i]);
+      if (i != self && left > most)
+      {
+        best = i;
+        most = left;
+      }
+    }
+    if (best < 0)
+      return 0;
+
+    victim = best;
+    pthread_mutex_lock(&pool->deques[victim].lock);
+    most = poolLeft(&pool->deques[victim]);
+    if (most <= 0)
+    {
+      pthread_mutex_unlock(&pool->deques[victim].lock);
+      continue;
+    }
+    half = (most + 1) / 2;
+    i = atomic_load_explicit(&pool->deques[victim].tail, memory_order_relaxed) - half;
+    atomic_store_explicit(&pool->deques[victim].tail, i, memory_order_relaxed);
+    pthread_mutex_unlock(&pool->deques[victim].lock);
+
+    /* never hold two locks, so thieves cannot deadlock on each other */
+    pthread_mutex_lock(&mine->lock);
+    poolSetRange(mine, i, i + half);
+    pthread_mutex_unlock(&mine->lock);
+    return 1;
+  }
+}
+
+static inline void *poolWorker(void *argPtr)
+{
+  poolWorkerType *worker = argPtr;
+  poolType *pool = worker->pool;
+  int job;
+
+  for (;;)
+  {
+    while ((job = poolTake(&pool->deques[worker->self])) >= 0)
+      pool->run(pool->arg, worker->self, job);
+    if (!poolSteal(pool, worker->self))
+      return NULL;
+  }
+}
+
+/* run(arg, worker, job) for every job; worker is 0..numWorkers-1 */
+static inline void runPool(int numJobs, int numWorkers,
+                           void (*run)(void *arg, int worker, int job), void *arg)
+{
+  poolType pool;
+  poolWorkerType *workers;
+  pthread_t *threads;
+  int i;
+
+  if (numWorkers > numJobs)
+    numWorkers = numJobs > 0 ? numJobs : 1;
+  pool.numWorkers = numWorkers;
+  pool.run = run;
+  pool.arg = arg;
+  pool.deques = malloc(numWorkers * sizeof(poolDequeType));
+  workers = malloc(numWorkers * sizeof(poolWorkerType));
+  threads = malloc(numWorkers * sizeof(pthread_t));
+  if (pool.deques == NULL || workers == NULL || threads == NULL)
+  {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  for (i = 0; i < numWorkers; i++)
+  {
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+    atomic_init(&pool.deques[i].head, (int)((long long)numJobs * i / numWorkers));
+    atomic_init(&pool.deques[i].tail, (int)((long long)numJobs * (i + 1) / numWorkers));
+    workers[i].pool = &pool;
+    workers[i].self = i;
+  }
+
+  /* the calling thread is worker 0 */
+  for (i = 1; i < numWorkers; i++)
+  {
+    if (pthread_create(&threads[i], NULL, poolWorker, &workers[i]) != 0)
+    {
+      printf("error: can't create thread\n");
+      exit(1);
+    }
+  }
+  poolWorker(&workers[0]);
+  for (i = 1; i < numWorkers; i++)
+    pthread_join(threads[i], NULL);
+
+  for (i = 0; i < numWorkers; i++)
+    pthread_mutex_destroy(&pool.deques[i].lock);
+  free(pool.deques);
+  free(workers);
+  free(threads);
+}
+
+#endif
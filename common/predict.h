@@ -0,0 +1,284 @@
+/*
+ * Branch prediction for the pipeline simulator.
+ *
+ * A predictorType pairs a direction predictor, chosen by name from
+ * predictorTable, with a direct-mapped branch target buffer.  At fetch the
+ * pipeline asks predictNext() which pc follows pc and keeps the global
+ * history it predicted with; when a beq resolves it hands that history back
+ * to predictUpdate(), so gshare trains the entry it read.  Fetch can only be
+ * redirected on a BTB hit, so a branch is predicted not taken until it has
+ * resolved once.  All state is updated at resolution, never speculatively.
+ *
+ * A jalr is always taken; predictJump() gives its target from the BTB or,
+ * with useRas, from a return-address stack.  A jalr whose regA is the link
+ * register of the newest call on the stack is a return and pops it; any
+ * other jalr that links a register is a call and pushes pc + 1.  The stack
+ * is the one piece of speculative state: the pipeline saves rasTop with
+ * every fetch and puts it back when it squashes the fetches after it.
+ */
+#ifndef LC2K_PREDICT_H
+#define LC2K_PREDICT_H
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PREDICT_BITS 12 /* pattern table and global history size */
+#define PREDICT_ENTRIES (1 << PREDICT_BITS)
+#define BTB_BITS 9
+#define BTB_ENTRIES (1 << BTB_BITS)
+#define RAS_ENTRIES 16
+#define PREDICT_NOT_TAKEN INT_MIN /* predictNext(): fetch pc + 1 */
+
+typedef struct btbEntryStruct
+{
+  int pc; /* -1 if empty */
+  int target;
+} btbEntryType;
+
+struct predictorKindStruct;
+
+typedef struct predictorStruct
+{
+  const struct predictorKindStruct *kind;
+  unsigned int history;                   /* global, newest outcome in bit 0 */
+  unsigned char local[PREDICT_ENTRIES];   /* by pc: 1-bit, 2-bit, tournament */
+  unsigned char global[PREDICT_ENTRIES];  /* by pc ^ history: gshare, tournament */
+  unsigned char chooser[PREDICT_ENTRIES]; /* tournament: 2 or 3 picks global */
+  btbEntryType btb[BTB_ENTRIES];
+  int useRas;
+  int ras[RAS_ENTRIES]; /* return addresses, circular */
+  int rasLink[RAS_ENTRIES]; /* the register each call linked */
+  int rasTop; /* pushes minus pops, never below 0 */
+  /* statistics */
+  long long branches;
+  long long taken;
+  long long btbHits;
+  long long jumps;
+  long long rasPops;
+  long long mispredicts; /* flushes, counted by the pipeline */
+} predictorType;
+
+typedef struct predictorKindStruct
+{
+  const char *name;
+  /* direction for the branch at pc, whose BTB target is target; NULL for
+     never taken */
+  int (*predict)(const predictorType *p, int pc, unsigned int history,
+                 int target);
+  void (*update)(predictorType *p, int pc, unsigned int history, int taken);
+} predictorKindType;
+
+static inline int predictIndex(int pc)
+{
+  return pc & (PREDICT_ENTRIES - 1);
+}
+
+static inline int predictGlobalIndex(int pc, unsigned int history)
+{
+  return (pc ^ history) & (PREDICT_ENTRIES - 1);
+}
+
+/* 2-bit saturating counter: 0-1 not taken, 2-3 taken */
+static inline void predictCount(unsigned char *counter, int taken)
+{
+  if (taken && *counter < 3)
+    (*counter)++;
+  else if (!taken && *counter > 0)
+    (*counter)--;
+}
+
+static inline int predictTaken(const predictorType *p, int pc,
+                               unsigned int history, int target)
+{
+  return 1;
+}
+
+/* backward taken, forward not taken */
+static inline int predictBtfn(const predictorType *p, int pc,
+                              unsigned int history, int target)
+{
+  return target <= pc;
+}
+
+static inline int predictOneBit(const predictorType *p, int pc,
+                                unsigned int history, int target)
+{
+  return p->local[predictIndex(pc)];
+}
+
+static inline void updateOneBit(predictorType *p, int pc, unsigned int history,
+                                int taken)
+{
+  p->local[predictIndex(pc)] = taken;
+}
+
+static inline int predictTwoBit(const predictorType *p, int pc,
+                                unsigned int history, int target)
+{
+  return p->local[predictIndex(pc)] >= 2;
+}
+
+static inline void updateTwoBit(predictorType *p, int pc, unsigned int history,
+                                int taken)
+{
+  predictCount(&p->local[predictIndex(pc)], taken);
+}
+
+static inline int predictGshare(const predictorType *p, int pc,
+                                unsigned int history, int target)
+{
+  return p->global[predictGlobalIndex(pc, history)] >= 2;
+}
+
+static inline void updateGshare(predictorType *p, int pc, unsigned int history,
+                                int taken)
+{
+  predictCount(&p->global[predictGlobalIndex(pc, history)], taken);
+}
+
+/* 2-bit local and gshare components; a per-pc chooser picks between them */
+static inline int predictTournament(const predictorType *p, int pc,
+                                    unsigned int history, int target)
+{
+  if (p->chooser[predictIndex(pc)] >= 2)
+    return predictGshare(p, pc, history, target);
+  return predictTwoBit(p, pc, history, target);
+}
+
+static inline void updateTournament(predictorType *p, int pc,
+                                    unsigned int history, int taken)
+{
+  int localRight = predictTwoBit(p, pc, history, 0) == taken;
+  int globalRight = predictGshare(p, pc, history, 0) == taken;
+
+  if (localRight != globalRight)
+    predictCount(&p->chooser[predictIndex(pc)], globalRight);
+  updateTwoBit(p, pc, history, taken);
+  updateGshare(p, pc, history, taken);
+}
+
+static const predictorKindType predictorTable[] = {
+    {"not-taken", NULL, NULL}, /* never looks at the BTB */
+    {"taken", predictTaken, NULL},
+    {"btfn", predictBtfn, NULL},
+    {"1bit", predictOneBit, updateOneBit},
+    {"2bit", predictTwoBit, updateTwoBit},
+    {"gshare", predictGshare, updateGshare},
+    {"tournament", predictTournament, updateTournament},
+};
+
+#define NUMPREDICTORS ((int)(sizeof(predictorTable) / sizeof(predictorTable[0])))
+
+/* the predictor called name, or NULL */
+static inline const predictorKindType *findPredictor(const char *name)
+{
+  int i;
+
+  for (i = 0; i < NUMPREDICTORS; i++)
+  {
+    if (!strcmp(predictorTable[i].name, name))
+      return &predictorTable[i];
+  }
+  return NULL;
+}
+
+static inline void predictInit(predictorType *p, const predictorKindType *kind)
+{
+  int i;
+
+  memset(p, 0, sizeof(*p));
+  p->kind = kind;
+  /* counters start weakly not taken, the chooser weakly local */
+  memset(p->local, 1, sizeof(p->local));
+  memset(p->global, 1, sizeof(p->global));
+  memset(p->chooser, 1, sizeof(p->chooser));
+  for (i = 0; i < BTB_ENTRIES; i++)
+    p->btb[i].pc = -1;
+}
+
+/* the pc to fetch after pc: a BTB target, or PREDICT_NOT_TAKEN */
+static inline int predictNext(predictorType *p, int pc)
+{
+  const btbEntryType *entry = &p->btb[pc & (BTB_ENTRIES - 1)];
+
+  if (p->kind->predict == NULL || entry->pc != pc)
+    return PREDICT_NOT_TAKEN;
+  p->btbHits++;
+  if (!p->kind->predict(p, pc, p->history, entry->target))
+    return PREDICT_NOT_TAKEN;
+  return entry->target;
+}
+
+/* the pc to fetch after the jalr regA regB at pc, or PREDICT_NOT_TAKEN */
+static inline int predictJump(predictorType *p, int pc, int regA, int regB)
+{
+  const btbEntryType *entry = &p->btb[pc & (BTB_ENTRIES - 1)];
+  int top = (p->rasTop - 1) & (RAS_ENTRIES - 1);
+
+  /* regA == regB jumps to pc + 1; regB 0 is a plain jump */
+  if (p->useRas && regA != regB)
+  {
+    if (p->rasTop > 0 && p->rasLink[top] == regA)
+    {
+      p->rasTop--;
+      p->rasPops++;
+      return p->ras[top];
+    }
+    if (regB != 0)
+    {
+      top = p->rasTop++ & (RAS_ENTRIES - 1);
+      p->ras[top] = pc + 1;
+      p->rasLink[top] = regB;
+    }
+  }
+  if (p->kind->predict == NULL || entry->pc != pc)
+    return PREDICT_NOT_TAKEN;
+  p->btbHits++;
+  return entry->target;
+}
+
+/* the jalr at pc resolved */
+static inline void predictJumpUpdate(predictorType *p, int pc, int target)
+{
+  btbEntryType *entry = &p->btb[pc & (BTB_ENTRIES - 1)];
+
+  p->jumps++;
+  entry->pc = pc;
+  entry->target = target;
+}
+
+/* the beq at pc resolved; history is p->history when it was fetched */
+static inline void predictUpdate(predictorType *p, int pc, unsigned int history,
+                                 int taken, int target)
+{
+  btbEntryType *entry = &p->btb[pc & (BTB_ENTRIES - 1)];
+
+  p->branches++;
+  p->taken += taken;
+  if (p->kind->update != NULL)
+    p->kind->update(p, pc, history, taken);
+  p->history = (p->history << 1 | taken) & (PREDICT_ENTRIES - 1);
+  entry->pc = pc;
+  entry->target = target;
+}
+
+/*
+ * Predict-not-taken flushes on every taken branch and every jump; each flush
+ * squashes the penalty instructions fetched after it.
+ */
+static inline void printPredictReport(FILE *fp, const predictorType *p, int penalty)
+{
+  long long saved = p->taken + p->jumps - p->mispredicts;
+
+  fprintf(fp, "branch report (%s%s):\n", p->kind->name, p->useRas ? ", ras" : "");
+  fprintf(fp, "\tbranches %lld taken %lld btb hits %lld\n", p->branches, p->taken,
+          p->btbHits);
+  if (p->jumps)
+    fprintf(fp, "\tjumps %lld return-address stack pops %lld\n", p->jumps, p->rasPops);
+  fprintf(fp, "\tmispredicts %lld (%.2f%%)\n", p->mispredicts,
+          p->branches + p->jumps ? 100.0 * p->mispredicts / (p->branches + p->jumps) : 0.0);
+  fprintf(fp, "\tflushes saved vs not-taken %lld (%lld cycles)\n", saved, penalty * saved);
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Lock-free ring of fixed-size records between one producer thread and one
+ * consumer thread.
+ *
+ * head counts the records pushed and tail the records popped.  Only the
+ * producer writes head and only the consumer writes tail.  A record is
+ * copied in before the release store of head that publishes it, and copied
+ * out before the release store of tail that frees its slot.  Each side also
+ * keeps a private copy of the other side's index, and rereads the shared
+ * one only when that copy says the ring is full (or empty).  The line
+ * holding an index therefore moves between cores about once per lap
+ * instead of once per record.
+ *
+ * ringPush() and ringPop() never block.  ringPushWait() and ringPopWait()
+ * spin for a while and then yield the processor, which matters when both
+ * threads share one.  The producer calls ringClose() after its last record.
+ *
+ * Build with -pthread.
+ */
+#ifndef LC2K_RING_H
+#define LC2K_RING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#define RING_LINE 64   /* each side's index on its own cache line */
+#define RING_SPINS 256 /* failed tries before a wait starts yielding */
+
+typedef struct ringStruct
+{
+  _Alignas(RING_LINE) atomic_size_t head; /* records pushed */
+  size_t tailSeen; /* the producer's last look at tail */
+  _Alignas(RING_LINE) atomic_size_t tail; /* records popped */
+  size_t headSeen; /* the consumer's last look at head */
+  atomic_int closed; /* no more pushes */
+  _Alignas(RING_LINE) size_t mask; /* capacity - 1 */
+  size_t recordSize;
+  unsigned char *records;
+} ringType;
+
+/* capacity is rounded up to a power of two */
+static inline void ringInit(ringType *ring, size_t capacity, size_t recordSize)
+{
+  size_t size = 1;
+
+  while (size < capacity)
+    size <<= 1;
+  ring->records = malloc(size * recordSize);
+  if (ring->records == NULL)
+  {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->closed, 0);
+  ring->tailSeen = 0;
+  ring->headSeen = 0;
+  ring->mask = size - 1;
+  ring->recordSize = recordSize;
+}
+
+static inline void ringFree(ringType *ring)
+{
+  free(ring->records);
+  ring->records = NULL;
+}
+
+/* producer: copy record in; 0 if the ring is full */
+static inline int ringPush(ringType *ring, const void *record)
+{
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+  if (head - ring->tailSeen > ring->mask)
+  {
+    ring->tailSeen = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - ring->tailSeen > ring->mask)
+      return 0;
+  }
+  memcpy(ring->records + (head & ring->mask) * ring->recordSize, record, ring->recordSize);
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return 1;
+}
+
+/* consumer: copy the oldest record out; 0 if the ring is empty */
+static inline int ringPop(ringType *ring, void *record)
+{
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+  if (tail == ring->headSeen)
+  {
+    ring->headSeen = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail == ring->headSeen)
+      return 0;
+  }
+  memcpy(record, ring->records + (tail & ring->mask) * ring->recordSize, ring->recordSize);
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+static inline void ringBackOff(int *spins)
+{
+  if (++*spins >= RING_SPINS)
+  {
+    *spins = 0;
+    sched_yield();
+  }
+}
+
+static inline void ringPushWait(ringType *ring, const void *record)
+{
+  int spins = 0;
+
+  while (!ringPush(ring, record))
+    ringBackOff(&spins);
+}
+
+/* 0 once the ring is closed and empty */
+static inline int ringPopWait(ringType *ring, void *record)
+{
+  int spins = 0;
+
+  while (!ringPop(ring, record))
+  {
+    /* a push before the close is visible once the close is */
+    if (atomic_load_explicit(&ring->closed, memory_order_acquire))
+      return ringPop(ring, record);
+    ringBackOff(&spins);
+  }
+  return 1;
+}
+
+static inline void ringClose(ringType *ring)
+{
+  atomic_store_explicit(&ring->closed, 1, memory_order_release);
+}
+
+#endif
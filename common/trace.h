@@ -0,0 +1,660 @@
+/*
+ * Binary execution traces: what every step of a run did, in a few bytes.
+ *
+ * All fields are little-endian:
+ *   0   char[8]  magic "LC2KTRC1"
+ *   8   uint32   flags (TRACE_COMPRESSED)
+ *   12  uint32   steps per block, which is also the index period
+ *   16  uint32   number of words in the image
+ *   20  int32    pc before the first step
+ *   24  int32    reg[8] before the first step
+ *   56  int32    words[number of words]
+ *   then the blocks, each
+ *       uint32 raw size, uint32 stored size, stored bytes
+ *   a stored size below the raw size is an LZ4 block (see common/lz.h);
+ *   then the index, one entry per block:
+ *       uint64 file offset of the block, int32 pc, int32 reg[8] before its
+ *       first step, uint32 number of words the block wrote, and for each
+ *       uint32 address, int32 value at the end of the block
+ *   and a 32-byte trailer:
+ *       uint64 index offset, uint64 steps, uint32 blocks,
+ *       uint32 status (TRACE_HALTED or TRACE_STOPPED), char[8] "LC2KIDX1"
+ *
+ * A step is a flags byte and then, for each flag set, LEB128 varints,
+ * signed ones zigzag-coded:
+ *   TRACE_JUMP   signed: the pc after the step minus (pc + 1)
+ *   TRACE_INSTR  unsigned: the word at pc, when it is not the one last
+ *                seen there (a table of TRACE_SEEN words, by pc)
+ *   TRACE_REG    signed: the register's new value minus its old one; the
+ *                register is in bits 3-5 of the flags
+ *   TRACE_MEM    signed: the address minus the last address written, then
+ *                the word's new value minus its old one
+ * The seen table and the last address start over with every block, so a
+ * block decodes on its own from the registers and pc in its index entry
+ * and the memory the entries before it leave.  That is how traceSeek()
+ * gets to any step without replaying the blocks in front of it.
+ */
+#ifndef LC2K_TRACE_H
+#define LC2K_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+#include "lz.h"
+
+#define TRACE_MAGIC "LC2KTRC1"
+#define TRACE_INDEX_MAGIC "LC2KIDX1"
+#define TRACE_HEADER_SIZE 56
+#define TRACE_TRAILER_SIZE 32
+#define TRACE_COMPRESSED 0x1
+#define TRACE_NUMREGS 8
+#define TRACE_BLOCK_STEPS 16384 /* default */
+#define TRACE_SEEN 1024
+
+/* step flags */
+#define TRACE_JUMP 0x01
+#define TRACE_INSTR 0x02
+#define TRACE_REG 0x04
+#define TRACE_MEM 0x40
+#define TRACE_MAX_STEP 26 /* flags and five varints of at most 5 bytes */
+
+enum TraceStatus
+{
+  TRACE_STOPPED, /* an error or a step limit ended the run */
+  TRACE_HALTED
+};
+
+/* one step: what traceRecord() takes and traceNext() gives back */
+typedef struct traceStepStruct
+{
+  int pc;
+  int instr;
+  int next;     /* pc after the step */
+  int reg;      /* register written, -1 if none */
+  int regValue;
+  int addr;     /* word written, -1 if none */
+  int memValue;
+} traceStepType;
+
+typedef struct traceSeenStruct
+{
+  int pc; /* -1 if empty */
+  int instr;
+} traceSeenType;
+
+/* the part of the state a block's steps are coded against */
+typedef struct traceContextStruct
+{
+  int pc;
+  int reg[TRACE_NUMREGS];
+  int *mem; /* MEM_WORDS words */
+  int lastAddr;
+  traceSeenType seen[TRACE_SEEN];
+} traceContextType;
+
+typedef struct traceWriterStruct
+{
+  FILE *fp;
+  int flags;
+  int blockSteps;
+  long long steps;
+  long long offset; /* bytes written so far */
+  traceContextType context;
+  int blockPc; /* pc and registers before the block's first step */
+  int blockReg[TRACE_NUMREGS];
+  int *written; /* 1 + the last block that wrote each word */
+  int *dirty; /* words the block wrote, each once */
+  int numDirty;
+  unsigned char *block;
+  int blockUsed;
+  unsigned char *stored;
+  int numBlocks;
+  unsigned char *index;
+  size_t indexUsed;
+  size_t indexCapacity;
+} traceWriterType;
+
+typedef struct traceIndexStruct
+{
+  long long offset;
+  int pc;
+  int reg[TRACE_NUMREGS];
+  int firstDirty; /* in traceReaderType.dirty */
+  int numDirty;
+} traceIndexType;
+
+typedef struct traceReaderStruct
+{
+  FILE *fp;
+  const char *error; /* why the last call failed */
+  int flags;
+  int blockSteps;
+  int numMemory;
+  int *image;
+  long long steps;
+  int numBlocks;
+  int status;
+  long long fileSize;
+  traceIndexType *index;
+  int *dirty; /* address, value pairs */
+  /* the replay: the state after step steps */
+  long long step;
+  traceContextType context;
+  int blockNum; /* decoded into block, -1 for none */
+  unsigned char *block;
+  int blockSize;
+  int blockPos;
+  unsigned char *stored;
+  traceStepType last; /* what the step just replayed did */
+} traceReaderType;
+
+static inline void tracePut(unsigned char *p, unsigned long long value, int bytes)
+{
+  int i;
+
+  for (i = 0; i < bytes; i++)
+    p[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static inline unsigned long long traceGet(const unsigned char *p, int bytes)
+{
+  unsigned long long value = 0;
+  int i;
+
+  for (i = bytes - 1; i >= 0; i--)
+    value = value << 8 | p[i];
+  return value;
+}
+
+static inline int tracePutVarint(unsigned char *p, int pos, unsigned int value)
+{
+  while (value >= 0x80)
+  {
+    p[pos++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  p[pos++] = value;
+  return pos;
+}
+
+/* a - b, zigzag-coded, so small differences either way take one byte */
+static inline int tracePutDelta(unsigned char *p, int pos, int a, int b)
+{
+  unsigned int delta = (unsigned int)a - (unsigned int)b;
+
+  return tracePutVarint(p, pos, delta << 1 ^ -(delta >> 31));
+}
+
+/* -1 if the varint runs past end */
+static inline int traceGetVarint(const unsigned char *p, int pos, int end, unsigned int *value)
+{
+  int shift;
+
+  *value = 0;
+  for (shift = 0; shift < 35; shift += 7)
+  {
+    if (pos >= end)
+      return -1;
+    *value |= (unsigned int)(p[pos] & 0x7F) << shift;
+    if (!(p[pos++] & 0x80))
+      return pos;
+  }
+  return -1;
+}
+
+/* *value = base + the delta at pos */
+static inline int traceGetDelta(const unsigned char *p, int pos, int end, int base, int *value)
+{
+  unsigned int zigzag;
+
+  pos = traceGetVarint(p, pos, end, &zigzag);
+  *value = (int)((unsigned int)base + (zigzag >> 1 ^ -(zigzag & 1)));
+  return pos;
+}
+
+static inline void *traceAlloc(size_t size)
+{
+  void *p = calloc(1, size);
+
+  if (p == NULL)
+  {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  return p;
+}
+
+/* forget what the last block's steps were coded against */
+static inline void traceStartBlock(traceContextType *context)
+{
+  int i;
+
+  context->lastAddr = 0;
+  for (i = 0; i < TRACE_SEEN; i++)
+    context->seen[i].pc = -1;
+}
+
+/* ---------------------------- recording ---------------------------- */
+
+static inline void traceWrite(traceWriterType *tw, const void *bytes, size_t size)
+{
+  fwrite(bytes, 1, size, tw->fp);
+  tw->offset += size;
+}
+
+/* start a trace of a run from pc and reg over the image's numMemory words */
+static inline void traceCreate(traceWriterType *tw, FILE *fp, int flags, int blockSteps,
+                               const int *image, int numMemory, int pc, const int *reg)
+{
+  unsigned char header[TRACE_HEADER_SIZE], word[4];
+  int i;
+
+  memset(tw, 0, sizeof(*tw));
+  tw->fp = fp;
+  tw->flags = flags;
+  tw->blockSteps = blockSteps;
+  tw->context.mem = traceAlloc(MEM_WORDS * sizeof(int));
+  tw->written = traceAlloc(MEM_WORDS * sizeof(int));
+  tw->dirty = traceAlloc(MEM_WORDS * sizeof(int));
+  tw->block = traceAlloc((size_t)blockSteps * TRACE_MAX_STEP);
+  tw->stored = traceAlloc(LZ_BOUND((size_t)blockSteps * TRACE_MAX_STEP));
+  memcpy(tw->context.mem, image, numMemory * sizeof(int));
+  tw->context.pc = pc;
+  memcpy(tw->context.reg, reg, sizeof(tw->context.reg));
+
+  memcpy(header, TRACE_MAGIC, 8);
+  tracePut(header + 8, flags, 4);
+  tracePut(header + 12, blockSteps, 4);
+  tracePut(header + 16, numMemory, 4);
+  tracePut(header + 20, (unsigned int)pc, 4);
+  for (i = 0; i < TRACE_NUMREGS; i++)
+    tracePut(header + 24 + 4 * i, (unsigned int)reg[i], 4);
+  traceWrite(tw, header, sizeof(header));
+  for (i = 0; i < numMemory; i++)
+  {
+    tracePut(word, (unsigned int)image[i], 4);
+    traceWrite(tw, word, 4);
+  }
+}
+
+static inline unsigned char *traceIndexRoom(traceWriterType *tw, size_t size)
+{
+  unsigned char *room;
+
+  if (tw->indexUsed + size > tw->indexCapacity)
+  {
+    tw->indexCapacity = (tw->indexUsed + size) * 2;
+    tw->index = realloc(tw->index, tw->indexCapacity);
+    if (tw->index == NULL)
+    {
+      printf("error: out of memory\n");
+      exit(1);
+    }
+  }
+  room = tw->index + tw->indexUsed;
+  tw->indexUsed += size;
+  return room;
+}
+
+/* write out the block and its index entry */
+static inline void traceEndBlock(traceWriterType *tw)
+{
+  unsigned char sizes[8], *entry;
+  int storedSize = 0, i;
+
+  entry = traceIndexRoom(tw, 48 + 8 * (size_t)tw->numDirty);
+  tracePut(entry, tw->offset, 8);
+  tracePut(entry + 8, (unsigned int)tw->blockPc, 4);
+  for (i = 0; i < TRACE_NUMREGS; i++)
+    tracePut(entry + 12 + 4 * i, (unsigned int)tw->blockReg[i], 4);
+  tracePut(entry + 44, tw->numDirty, 4);
+  for (i = 0; i < tw->numDirty; i++)
+  {
+    tracePut(entry + 48 + 8 * i, tw->dirty[i], 4);
+    tracePut(entry + 52 + 8 * i, (unsigned int)tw->context.mem[tw->dirty[i]], 4);
+  }
+
+  if (tw->flags & TRACE_COMPRESSED)
+    storedSize = lzCompress(tw->block, tw->blockUsed, tw->stored,
+                            LZ_BOUND(tw->blockSteps * TRACE_MAX_STEP));
+  if (storedSize == 0 || storedSize >= tw->blockUsed)
+  {
+    /* stored as is */
+    storedSize = tw->blockUsed;
+    memcpy(tw->stored, tw->block, tw->blockUsed);
+  }
+  tracePut(sizes, tw->blockUsed, 4);
+  tracePut(sizes + 4, storedSize, 4);
+  traceWrite(tw, sizes, 8);
+  traceWrite(tw, tw->stored, storedSize);
+  tw->numBlocks++;
+  tw->blockUsed = 0;
+  tw->numDirty = 0;
+}
+
+static inline void traceRecord(traceWriterType *tw, const traceStepType *step)
+{
+  traceContextType *context = &tw->context;
+  traceSeenType *seen = &context->seen[step->pc & (TRACE_SEEN - 1)];
+  unsigned char *p = tw->block;
+  int pos = tw->blockUsed + 1, flags = 0;
+
+  if (tw->steps % tw->blockSteps == 0)
+  {
+    tw->blockPc = context->pc;
+    memcpy(tw->blockReg, context->reg, sizeof(tw->blockReg));
+    traceStartBlock(context);
+  }
+  if (step->next != step->pc + 1)
+  {
+    flags |= TRACE_JUMP;
+    pos = tracePutDelta(p, pos, step->next, step->pc + 1);
+  }
+  if (seen->pc != step->pc || seen->instr != step->instr)
+  {
+    flags |= TRACE_INSTR;
+    pos = tracePutVarint(p, pos, (unsigned int)step->instr);
+    seen->pc = step->pc;
+    seen->instr = step->instr;
+  }
+  if (step->reg >= 0)
+  {
+    flags |= TRACE_REG | step->reg << 3;
+    pos = tracePutDelta(p, pos, step->regValue, context->reg[step->reg]);
+    context->reg[step->reg] = step->regValue;
+  }
+  /* a write outside memory is dropped, so it changes nothing */
+  if (step->addr >= 0 && step->addr < MEM_WORDS)
+  {
+    flags |= TRACE_MEM;
+    pos = tracePutDelta(p, pos, step->addr, context->lastAddr);
+    pos = tracePutDelta(p, pos, step->memValue, context->mem[step->addr]);
+    context->mem[step->addr] = step->memValue;
+    context->lastAddr = step->addr;
+    if (tw->written[step->addr] != tw->numBlocks + 1)
+    {
+      tw->written[step->addr] = tw->numBlocks + 1;
+      tw->dirty[tw->numDirty++] = step->addr;
+    }
+  }
+  p[tw->blockUsed] = flags;
+  tw->blockUsed = pos;
+  context->pc = step->next;
+  if (++tw->steps % tw->blockSteps == 0)
+    traceEndBlock(tw);
+}
+
+/* write the last block, the index and the trailer; -1 on a write error */
+static inline int traceFinish(traceWriterType *tw, int status)
+{
+  unsigned char trailer[TRACE_TRAILER_SIZE];
+  long long indexOffset;
+  int error;
+
+  if (tw->blockUsed > 0)
+    traceEndBlock(tw);
+  indexOffset = tw->offset;
+  traceWrite(tw, tw->index, tw->indexUsed);
+  tracePut(trailer, indexOffset, 8);
+  tracePut(trailer + 8, tw->steps, 8);
+  tracePut(trailer + 16, tw->numBlocks, 4);
+  tracePut(trailer + 20, status, 4);
+  memcpy(trailer + 24, TRACE_INDEX_MAGIC, 8);
+  traceWrite(tw, trailer, sizeof(trailer));
+  error = fflush(tw->fp) != 0 || ferror(tw->fp);
+  free(tw->context.mem);
+  free(tw->written);
+  free(tw->dirty);
+  free(tw->block);
+  free(tw->stored);
+  free(tw->index);
+  return error ? -1 : 0;
+}
+
+/* ----------------------------- replay ----------------------------- */
+
+static inline int traceFail(traceReaderType *tr, const char *error)
+{
+  tr->error = error;
+  return -1;
+}
+
+static inline int traceRead(traceReaderType *tr, long long offset, void *bytes, size_t size)
+{
+  if (fseek(tr->fp, offset, SEEK_SET) != 0 || fread(bytes, 1, size, tr->fp) != size)
+    return traceFail(tr, "truncated");
+  return 0;
+}
+
+/* read block b and decode from its first step */
+static inline int traceLoadBlock(traceReaderType *tr, int b)
+{
+  const traceIndexType *entry = &tr->index[b];
+  unsigned char sizes[8];
+  int rawSize, storedSize, capacity = tr->blockSteps * TRACE_MAX_STEP;
+
+  if (traceRead(tr, entry->offset, sizes, 8) < 0)
+    return -1;
+  rawSize = traceGet(sizes, 4);
+  storedSize = traceGet(sizes + 4, 4);
+  if (rawSize > capacity || storedSize > rawSize || storedSize < 0)
+    return traceFail(tr, "bad block size");
+  if (storedSize == rawSize)
+  {
+    if (traceRead(tr, entry->offset + 8, tr->block, rawSize) < 0)
+      return -1;
+  }
+  else if (traceRead(tr, entry->offset + 8, tr->stored, storedSize) < 0
+           || lzDecompress(tr->stored, storedSize, tr->block, capacity) != rawSize)
+  {
+    return traceFail(tr, "corrupt compressed block");
+  }
+  tr->blockNum = b;
+  tr->blockSize = rawSize;
+  tr->blockPos = 0;
+  tr->step = (long long)b * tr->blockSteps;
+  tr->context.pc = entry->pc;
+  memcpy(tr->context.reg, entry->reg, sizeof(tr->context.reg));
+  traceStartBlock(&tr->context);
+  return 0;
+}
+
+/* replay one step into tr->last; 0 at the end of the trace */
+static inline int traceNext(traceReaderType *tr)
+{
+  traceContextType *context = &tr->context;
+  traceStepType *step = &tr->last;
+  traceSeenType *seen;
+  unsigned int instr;
+  const unsigned char *p = tr->block;
+  int pos, end, flags;
+
+  if (tr->step >= tr->steps)
+    return 0;
+  if (tr->step == (long long)(tr->blockNum + 1) * tr->blockSteps
+      && traceLoadBlock(tr, tr->blockNum + 1) < 0)
+    return -1;
+  pos = tr->blockPos;
+  end = tr->blockSize;
+  if (pos >= end)
+    return traceFail(tr, "block ends early");
+  flags = p[pos++];
+  step->pc = context->pc;
+  step->next = context->pc + 1;
+  step->reg = -1;
+  step->addr = -1;
+  if ((flags & TRACE_JUMP) && (pos = traceGetDelta(p, pos, end, step->pc + 1, &step->next)) < 0)
+    return traceFail(tr, "bad step");
+  seen = &context->seen[step->pc & (TRACE_SEEN - 1)];
+  if (flags & TRACE_INSTR)
+  {
+    if ((pos = traceGetVarint(p, pos, end, &instr)) < 0)
+      return traceFail(tr, "bad step");
+    seen->pc = step->pc;
+    seen->instr = instr;
+  }
+  else if (seen->pc != step->pc)
+  {
+    return traceFail(tr, "bad step");
+  }
+  step->instr = seen->instr;
+  if (flags & TRACE_REG)
+  {
+    step->reg = flags >> 3 & 7;
+    if ((pos = traceGetDelta(p, pos, end, context->reg[step->reg], &step->regValue)) < 0)
+      return traceFail(tr, "bad step");
+    context->reg[step->reg] = step->regValue;
+  }
+  if (flags & TRACE_MEM)
+  {
+    if ((pos = traceGetDelta(p, pos, end, context->lastAddr, &step->addr)) < 0
+        || (unsigned int)step->addr >= MEM_WORDS
+        || (pos = traceGetDelta(p, pos, end, context->mem[step->addr], &step->memValue)) < 0)
+      return traceFail(tr, "bad step");
+    context->mem[step->addr] = step->memValue;
+    context->lastAddr = step->addr;
+  }
+  if (flags & 0x80)
+    return traceFail(tr, "bad step");
+  tr->blockPos = pos;
+  context->pc = step->next;
+  tr->step++;
+  return 1;
+}
+
+/*
+ * Put the replay at the state after step steps.  Forward within the
+ * current block it just replays; anything else starts from the index
+ * entry of step's block.
+ */
+static inline int traceSeek(traceReaderType *tr, long long step)
+{
+  const traceIndexType *entry;
+  int b, i;
+
+  if (step < 0 || step > tr->steps)
+    return traceFail(tr, "step out of range");
+  b = step / tr->blockSteps;
+  if (b == tr->numBlocks && b > 0)
+    b--; /* the end of the last block */
+  if (tr->blockNum < 0 || b != tr->blockNum || step < tr->step)
+  {
+    memset(tr->context.mem, 0, MEM_WORDS * sizeof(int));
+    memcpy(tr->context.mem, tr->image, tr->numMemory * sizeof(int));
+    for (entry = tr->index; entry < tr->index + b; entry++)
+    {
+      for (i = entry->firstDirty; i < entry->firstDirty + entry->numDirty; i++)
+        tr->context.mem[tr->dirty[2 * i]] = tr->dirty[2 * i + 1];
+    }
+    if (tr->numBlocks == 0)
+    {
+      /* nothing ran: index[0] holds the state in the header */
+      tr->context.pc = tr->index[0].pc;
+      memcpy(tr->context.reg, tr->index[0].reg, sizeof(tr->context.reg));
+      tr->step = 0;
+      return 0;
+    }
+    if (traceLoadBlock(tr, b) < 0)
+      return -1;
+  }
+  while (tr->step < step)
+  {
+    if (traceNext(tr) <= 0)
+      return -1;
+  }
+  return 0;
+}
+
+/* read the header, the image and the index; the replay starts at step 0 */
+static inline int traceOpen(traceReaderType *tr, FILE *fp)
+{
+  unsigned char header[TRACE_HEADER_SIZE], trailer[TRACE_TRAILER_SIZE], *index;
+  long long indexOffset, pos;
+  size_t indexSize;
+  int i, b, numDirty = 0;
+
+  memset(tr, 0, sizeof(*tr));
+  tr->fp = fp;
+  if (fseek(fp, 0, SEEK_END) != 0 || (tr->fileSize = ftell(fp)) < 0)
+    return traceFail(tr, "not a seekable file");
+  if (tr->fileSize < TRACE_HEADER_SIZE + TRACE_TRAILER_SIZE
+      || traceRead(tr, 0, header, sizeof(header)) < 0 || memcmp(header, TRACE_MAGIC, 8) != 0)
+    return traceFail(tr, "not a trace");
+  if (traceRead(tr, tr->fileSize - TRACE_TRAILER_SIZE, trailer, sizeof(trailer)) < 0
+      || memcmp(trailer + 24, TRACE_INDEX_MAGIC, 8) != 0)
+    return traceFail(tr, "no index; the recording did not finish");
+  tr->flags = traceGet(header + 8, 4);
+  tr->blockSteps = traceGet(header + 12, 4);
+  tr->numMemory = traceGet(header + 16, 4);
+  indexOffset = traceGet(trailer, 8);
+  tr->steps = traceGet(trailer + 8, 8);
+  tr->numBlocks = traceGet(trailer + 16, 4);
+  tr->status = traceGet(trailer + 20, 4);
+  if (tr->blockSteps < 1 || tr->numMemory > MEM_WORDS || tr->steps < 0
+      || tr->numBlocks != (tr->steps + tr->blockSteps - 1) / tr->blockSteps
+      || indexOffset < TRACE_HEADER_SIZE + 4LL * tr->numMemory
+      || indexOffset > tr->fileSize - TRACE_TRAILER_SIZE)
+    return traceFail(tr, "bad header or trailer");
+
+  tr->image = traceAlloc((tr->numMemory + 1) * sizeof(int));
+  index = traceAlloc(tr->numMemory * 4 + 1);
+  if (traceRead(tr, TRACE_HEADER_SIZE, index, tr->numMemory * 4) < 0)
+    return -1;
+  for (i = 0; i < tr->numMemory; i++)
+    tr->image[i] = traceGet(index + 4 * i, 4);
+  free(index);
+
+  indexSize = tr->fileSize - TRACE_TRAILER_SIZE - indexOffset;
+  index = traceAlloc(indexSize + 1);
+  tr->index = traceAlloc((tr->numBlocks + 1) * sizeof(traceIndexType));
+  tr->index[0].pc = traceGet(header + 20, 4);
+  for (i = 0; i < TRACE_NUMREGS; i++)
+    tr->index[0].reg[i] = traceGet(header + 24 + 4 * i, 4);
+  tr->dirty = traceAlloc(indexSize / 8 * 2 * sizeof(int) + 1);
+  if (traceRead(tr, indexOffset, index, indexSize) < 0)
+    return -1;
+  for (b = 0, pos = 0; b < tr->numBlocks; b++)
+  {
+    traceIndexType *entry = &tr->index[b];
+
+    if (pos + 48 > (long long)indexSize)
+      return traceFail(tr, "truncated index");
+    entry->offset = traceGet(index + pos, 8);
+    entry->pc = traceGet(index + pos + 8, 4);
+    for (i = 0; i < TRACE_NUMREGS; i++)
+      entry->reg[i] = traceGet(index + pos + 12 + 4 * i, 4);
+    entry->numDirty = traceGet(index + pos + 44, 4);
+    entry->firstDirty = numDirty;
+    pos += 48;
+    if (entry->numDirty > ((long long)indexSize - pos) / 8)
+      return traceFail(tr, "truncated index");
+    for (i = 0; i < entry->numDirty; i++, numDirty++)
+    {
+      tr->dirty[2 * numDirty] = traceGet(index + pos, 4);
+      tr->dirty[2 * numDirty + 1] = traceGet(index + pos + 4, 4);
+      if ((unsigned int)tr->dirty[2 * numDirty] >= MEM_WORDS)
+        return traceFail(tr, "bad address in index");
+      pos += 8;
+    }
+  }
+  free(index);
+
+  tr->context.mem = traceAlloc(MEM_WORDS * sizeof(int));
+  tr->block = traceAlloc((size_t)tr->blockSteps * TRACE_MAX_STEP);
+  tr->stored = traceAlloc(LZ_BOUND((size_t)tr->blockSteps * TRACE_MAX_STEP));
+  tr->blockNum = -1;
+  return traceSeek(tr, 0);
+}
+
+static inline void traceClose(traceReaderType *tr)
+{
+  free(tr->image);
+  free(tr->index);
+  free(tr->dirty);
+  free(tr->context.mem);
+  free(tr->block);
+  free(tr->stored);
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Buffered text output for the simulators' state dumps.
+ *
+ * A state dump is a few thousand short lines; formatting them with one
+ * printf per field made long traces entirely I/O- and format-bound.
+ * Dumps are built into a writerType buffer with writeStr/writeInt and
+ * handed to stdio in large chunks.  Callers flush the writer before going
+ * back to plain printf so the two never interleave out of order.
+ */
+#ifndef LC2K_WRITER_H
+#define LC2K_WRITER_H
+
+#include <stdio.h>
+#include <string.h>
+
+#define WRITER_BUFFER_SIZE (1 << 16)
+#define STDOUT_BUFFER_SIZE (1 << 20)
+#define WRITER_SLACK 64 /* room kept for one writeInt or short string */
+
+typedef struct writerStruct
+{
+  FILE *fp;
+  char *cur;
+  char buf[WRITER_BUFFER_SIZE];
+} writerType;
+
+/* make stdout fully buffered with a large buffer; call before any output */
+static inline void outputInit(void)
+{
+  static char stdoutBuf[STDOUT_BUFFER_SIZE];
+
+  setvbuf(stdout, stdoutBuf, _IOFBF, sizeof(stdoutBuf));
+}
+
+static inline void writerInit(writerType *w, FILE *fp)
+{
+  w->fp = fp;
+  w->cur = w->buf;
+}
+
+static inline void writerFlush(writerType *w)
+{
+  fwrite(w->buf, 1, w->cur - w->buf, w->fp);
+  w->cur = w->buf;
+}
+
+static inline void writerReserve(writerType *w, size_t len)
+{
+  if ((size_t)(w->buf + WRITER_BUFFER_SIZE - w->cur) < len)
+    writerFlush(w);
+}
+
+static inline void writeStr(writerType *w, const char *s)
+{
+  size_t len = strlen(s);
+
+  if (len > WRITER_BUFFER_SIZE - WRITER_SLACK)
+  {
+    writerFlush(w);
+    fwrite(s, 1, len, w->fp);
+    return;
+  }
+  writerReserve(w, len);
+  memcpy(w->cur, s, len);
+  w->cur += len;
+}
+
+/* same digits as printf("%d") */
+static inline void writeInt(writerType *w, int value)
+{
+  char tmp[12];
+  char *p = tmp + sizeof(tmp);
+  unsigned int u = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+  do
+  {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (value < 0)
+    *--p = '-';
+  writerReserve(w, tmp + sizeof(tmp) - p);
+  memcpy(w->cur, p, tmp + sizeof(tmp) - p);
+  w->cur += tmp + sizeof(tmp) - p;
+}
+
+/* same digits as printf("%lld") */
+static inline void writeLongLong(writerType *w, long long value)
+{
+  char tmp[21];
+  char *p = tmp + sizeof(tmp);
+  unsigned long long u = value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value;
+
+  do
+  {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (value < 0)
+    *--p = '-';
+  writerReserve(w, tmp + sizeof(tmp) - p);
+  memcpy(w->cur, p, tmp + sizeof(tmp) - p);
+  w->cur += tmp + sizeof(tmp) - p;
+}
+
+#endif
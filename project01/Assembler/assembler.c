@@ -3,19 +3,44 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
-#define MAX_INSTRUCTION 1024
-#define MAXLINELENGTH 1000
-typedef char stringType[MAXLINELENGTH];
-
-int readAndParse(FILE *, char *, char *, char *, char *, char *);
-int isNumber(const char *);
+#include "../../common/lc2k.h"
+#include "../../common/image.h"
 
+#define MAXLINELENGTH 1000
+#define LABEL_TABLE_INIT 1024 /* initial number of hash slots (power of two) */
+#define LABEL_POOL_CHUNK 65536 /* bytes per string pool chunk */
+#define PROGRAM_INIT 1024 /* initial IR line / fixup capacity */
+#define MAX_ERRORS 100 /* default diagnostic limit with -k */
 
-void formatWrite(FILE *, FILE *);
-/* use this when return error */
+/* a token is a view into the source buffer; nothing is copied */
+typedef struct
+{
+  const char *ptr;
+  int len;
+  int isNumber; /* token starts with an integer (what sscanf "%d" accepts) */
+  int val; /* that integer, parsed once by the lexer */
+} tokenType;
+
+/* the whole assembly-language file, mmap'd or read into memory */
+typedef struct
+{
+  const char *buf;
+  const char *cur; /* start of the next line */
+  const char *end;
+  size_t mapped; /* length of the mapping, 0 if buf is malloc'd */
+} sourceType;
 
-int findLabelAddr(const char *label);
+void openSource(sourceType *, const char *);
+void closeSource(sourceType *);
+void skipLine(sourceType *);
+int readAndParse(sourceType *, tokenType *, tokenType *, tokenType *, tokenType *, tokenType *);
 
 enum Error
 {
@@ -25,8 +50,26 @@ enum Error
   ERR_OVERFLOW,
   ERR_UNRECOGNIZED_OPCODE,
   ERR_ARGUMENT,
+  ERR_LINE_TOO_LONG,
+  ERR_DUPLICATE_LABEL,
 };
 
+/* message and JSON code for each enum Error, used by -k / --json */
+const char *const errorNames[][2] = {
+  [ERR_UNDEFINED_LABEL] = {"undefined label", "undefined_label"},
+  [ERR_LACK_ARGUMENTS] = {"lack arguments", "lack_arguments"},
+  [ERR_OVERFLOW] = {"argument overflow", "overflow"},
+  [ERR_UNRECOGNIZED_OPCODE] = {"unrecognized opcode", "unrecognized_opcode"},
+  [ERR_ARGUMENT] = {"register argument is not a number", "bad_argument"},
+  [ERR_LINE_TOO_LONG] = {"line too long", "line_too_long"},
+  [ERR_DUPLICATE_LABEL] = {"duplicate label", "duplicate_label"},
+};
+
+/* -k: keep going after errors and report them all at the end */
+int keepGoing = 0;
+int maxErrors = MAX_ERRORS;
+int jsonOutput = 0;
+
 /* use this when return error */
 typedef union
 {
@@ -69,163 +112,586 @@ typedef union
 
 } instType;
 
-struct
+/* label table: open addressing (linear probing) over interned names */
+typedef struct
 {
-  struct
-  {
-    stringType label;
-    int addr;
-  } labels[MAX_INSTRUCTION];
+  const char *label; /* interned in a string pool, NULL if slot empty */
+  unsigned int hash;
+  int len;
+  int addr;
+} labelType;
+
+typedef struct poolChunkStruct
+{
+  struct poolChunkStruct *next;
+  int used;
+  char data[LABEL_POOL_CHUNK];
+} poolChunkType;
 
+typedef struct
+{
+  labelType *labels;
+  unsigned int capacity; /* always a power of two */
   int numAddrs;
-} labelTable;
-
-enum OpCode
-{
-  OP_ADD = 0b000,
-  OP_NOR = 0b001,
-  OP_LW = 0b010,
-  OP_SW = 0b011,
-  OP_BEQ = 0b100,
-  OP_JALR = 0b101,
-  OP_HALT = 0b110,
-  OP_NOOP = 0b111
+  poolChunkType *pool;
+} labelTableType;
+
+/* how a label address is folded into a line's code */
+enum FixupKind
+{
+  FIX_NONE,
+  FIX_FILL, /* .fill label: whole word is the address */
+  FIX_OFFSET, /* lw/sw/beq label: offsetField is the address, or address - (pc + 1) */
 };
 
+/* one assembled source line */
+typedef struct
+{
+  unsigned int code; /* machine word, or .fill value */
+  int isFill;
+  enum FixupKind reloc; /* code holds an absolute address that moves with the unit */
+  int err; /* enum Error, reported when the line is written */
+  const char *errToken; /* token printed with err, if any */
+} lineType;
+
+/* a label operand that was used before its definition, or in another file */
+typedef struct
+{
+  int line;
+  int col;
+  const char *label;
+  int relative; /* beq: encode address - (pc + 1) */
+  enum FixupKind kind;
+} fixupType;
+
+/* one error found with -k; line and col are 1-based */
+typedef struct
+{
+  int line;
+  int col;
+  enum Error err;
+  const char *token;
+} diagType;
+
+/*
+ * One source file assembled on its own. Addresses inside a unit start at 0;
+ * linkUnits moves the unit to base and resolves labels across units.
+ */
+typedef struct
+{
+  const char *fileName;
+  sourceType source;
+  labelTableType labelTable;
+
+  lineType *lines;
+  int numLines;
+  int capacity;
+
+  fixupType *fixups;
+  int numFixups;
+  int fixupCapacity;
+
+  int base; /* address of the first line in the linked image */
+  const char *fatal; /* error that stops the whole run, NULL if none */
+
+  const char *lineStart; /* the line being assembled, for columns */
+  int truncated; /* stopped reading at the error limit */
+  diagType *diags;
+  int numDiags;
+  int diagCapacity;
+} unitType;
+
+void addDiag(unitType *, int line, int col, enum Error err, const char *token, int len);
+void reportDiagnostics(unitType *, int);
+
+void assembleUnit(unitType *);
+lineType *newLine(unitType *);
+void assembleLine(unitType *, int curAddr, const tokenType *opcode, const tokenType *arg0, const tokenType *arg1, const tokenType *arg2);
+void resolveFixups(unitType *);
+labelTableType *linkUnits(unitType *, int);
+void formatWrite(unitType *, int, labelTableType *, FILE *, int);
+void writeImage(unitType *, int, labelTableType *, FILE *);
+
+const char *internLabel(labelTableType *, const char *label, int len);
+unsigned int hashLabel(const char *label, int len);
+labelType *insertLabel(labelTableType *, const char *label, int len, unsigned int hash, int addr);
+int findLabelAddr(labelTableType *, const char *label, int len);
+int addLabel(labelTableType *, const char *label, int len, int addr);
+
+int labelOrImmediate(unitType *, int curAddr, int relative, const tokenType *arg, enum FixupKind kind);
+
 /* formatting functions */
-int IType(enum OpCode opcode, int curAddr, const char *arg0, const char *arg1, const char *arg2, instType *inst, int *errArg);
-int RType(enum OpCode opcode, int curAddr, const char *arg0, const char *arg1, const char *arg2, instType *inst, int *errArg);
-int JType(enum OpCode opcode, int curAddr, const char *arg0, const char *arg1, const char *arg2, instType *inst, int *errArg);
-int OType(enum OpCode opcode, int curAddr, const char *arg0, const char *arg1, const char *arg2, instType *inst, int *errArg);
+int IType(unitType *unit, enum OpCode opcode, int curAddr, const tokenType *arg0, const tokenType *arg1, const tokenType *arg2, instType *inst, int *errArg);
+int RType(unitType *unit, enum OpCode opcode, int curAddr, const tokenType *arg0, const tokenType *arg1, const tokenType *arg2, instType *inst, int *errArg);
+int JType(unitType *unit, enum OpCode opcode, int curAddr, const tokenType *arg0, const tokenType *arg1, const tokenType *arg2, instType *inst, int *errArg);
+int OType(unitType *unit, enum OpCode opcode, int curAddr, const tokenType *arg0, const tokenType *arg1, const tokenType *arg2, instType *inst, int *errArg);
+
+/* encoder for each instruction format in opTable */
+int (*const encoders[])(unitType *, enum OpCode, int, const tokenType *, const tokenType *, const tokenType *, instType *, int *) = {
+  [FMT_R] = RType,
+  [FMT_I] = IType,
+  [FMT_J] = JType,
+  [FMT_O] = OType,
+};
+
+/* work queue shared by the assembler threads */
+struct
+{
+  pthread_mutex_t lock;
+  unitType *units;
+  int numUnits;
+  int next;
+} unitQueue = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void *assembleWorker(void *);
 
 int main(int argc, char *argv[])
 {
-  char *inFileString, *outFileString;
-  FILE *inFilePtr, *outFilePtr;
+  char *outFileString;
+  FILE *outFilePtr;
+  unitType *units;
+  labelTableType *symbols;
+  pthread_t *workers;
+  int binary = 0, numThreads = 0, numUnits, i;
+
+  for (; argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0'; ++argv, --argc)
+  {
+    if (strcmp(argv[1], "-b") == 0)
+    {
+      binary = 1;
+    }
+    else if (strcmp(argv[1], "-k") == 0)
+    {
+      keepGoing = 1;
+    }
+    else if (strcmp(argv[1], "--json") == 0)
+    {
+      keepGoing = jsonOutput = 1;
+    }
+    else if (strcmp(argv[1], "-e") == 0 && argc > 2 && atoi(argv[2]) > 0)
+    {
+      keepGoing = 1;
+      maxErrors = atoi(argv[2]);
+      ++argv, --argc;
+    }
+    else if (strcmp(argv[1], "-j") == 0 && argc > 2 && atoi(argv[2]) > 0)
+    {
+      numThreads = atoi(argv[2]);
+      ++argv, --argc;
+    }
+    else
+    {
+      argc = 0;
+      break;
+    }
+  }
 
-  char label[MAXLINELENGTH], opcode[MAXLINELENGTH], arg0[MAXLINELENGTH],
-  arg1[MAXLINELENGTH], arg2[MAXLINELENGTH]; if (argc != 3) 
+  if (argc < 3)
   {
-    printf("error: usage: %s <assembly-code-file> <machine-code-file>\n", argv[0]);
-    exit(1); 
+    printf("error: usage: %s [-b] [-j threads] [-k] [-e max-errors] [--json] <assembly-code-file>... <machine-code-file>\n", argv[0]);
+    printf("       -b writes a binary image instead of text, - is stdin / stdout\n");
+    printf("       several files are assembled in parallel and linked in order\n");
+    printf("       -k reports every error (up to -e, default %d) on stderr, --json as JSON\n", MAX_ERRORS);
+    exit(1);
   }
-  
-  inFileString = argv[1]; outFileString = argv[2];
-  inFilePtr = fopen(inFileString, "r"); 
-  if (inFilePtr == NULL) {
-    printf("error in opening %s\n", inFileString);
-    exit(1); 
+
+  numUnits = argc - 2;
+  outFileString = argv[argc - 1];
+  outFilePtr = strcmp(outFileString, "-") == 0 ? stdout : fopen(outFileString, binary ? "wb" : "w");
+  if (outFilePtr == NULL) {
+    printf("error in opening %s\n", outFileString);
+    exit(1);
   }
-  outFilePtr = fopen(outFileString, "w"); if (outFilePtr == NULL) {
-  printf("error in opening %s\n", outFileString);
-  exit(1); }
-  /* here is an example for how to use readAndParse to read a line from inFilePtr */
 
-  stringType temp;
-  int curAddr;
+  units = calloc(numUnits, sizeof(unitType));
+  if (units == NULL)
+  {
+    printf("!err! out of memory\n");
+    exit(1);
+  }
+  for (i = 0; i < numUnits; ++i)
+    units[i].fileName = argv[i + 1];
 
-  labelTable.numAddrs = 0;
+  /* assemble every file independently, on a pool of worker threads */
+  if (numThreads == 0)
+    numThreads = numUnits > 1 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+  if (numThreads > numUnits)
+    numThreads = numUnits;
 
+  unitQueue.units = units;
+  unitQueue.numUnits = numUnits;
 
-  /*Read and parse a line of the assembly-language file. Fields are returned in label, opcode, arg0, arg1, arg2 (these strings must have memory already allocated to them). */
+  if (numThreads <= 1)
+  {
+    assembleWorker(NULL);
+  }
+  else
+  {
+    workers = malloc(numThreads * sizeof(pthread_t));
+    for (i = 0; workers != NULL && i < numThreads; ++i)
+    {
+      if (pthread_create(&workers[i], NULL, assembleWorker, NULL) != 0)
+        break;
+    }
+    if (workers == NULL || i == 0)
+      assembleWorker(NULL);
+    while (i-- > 0)
+      pthread_join(workers[i], NULL);
+    free(workers);
+  }
 
-  for (curAddr = 0; readAndParse(inFilePtr, label, temp, temp, temp, temp); ++curAddr)
+  /* line too long / duplicate label stop the run before anything is written */
+  for (i = 0; i < numUnits; ++i)
   {
-      if (strlen(label) > 0)
-      {
-          if (findLabelAddr(label) != -1)
-          {
-              printf("!err! duplicate label\n");
-              fclose(inFilePtr);
-              fclose(outFilePtr);
-              exit(1);
-          }
-          strncpy(labelTable.labels[labelTable.numAddrs].label, label, MAXLINELENGTH);
-          labelTable.labels[labelTable.numAddrs].addr = curAddr;
-          ++labelTable.numAddrs;
-      }
+    if (units[i].fatal != NULL)
+    {
+      printf("%s\n", units[i].fatal);
+      fclose(outFilePtr);
+      exit(1);
+    }
   }
 
-  /* this is how to rewind the file ptr so that you start reading from the
-  beginning of the file */
-  rewind(inFilePtr);
+  /* a unit that stopped at the limit would only add bogus undefined labels */
+  for (i = 0; keepGoing && i < numUnits; ++i)
+  {
+    if (units[i].truncated)
+      reportDiagnostics(units, numUnits);
+  }
 
-  /* do whatever you need to do for opcode "somthing" */
-  formatWrite(inFilePtr, outFilePtr);
-  fclose(inFilePtr);
+  symbols = linkUnits(units, numUnits);
+
+  if (keepGoing)
+    reportDiagnostics(units, numUnits);
+
+  formatWrite(units, numUnits, symbols, outFilePtr, binary);
+  for (i = 0; i < numUnits; ++i)
+    closeSource(&units[i].source);
   fclose(outFilePtr);
   return (0);
 }
 
+void *assembleWorker(void *arg)
+{
+  int i;
+
+  while (1)
+  {
+    pthread_mutex_lock(&unitQueue.lock);
+    i = unitQueue.next++;
+    pthread_mutex_unlock(&unitQueue.lock);
+
+    if (i >= unitQueue.numUnits)
+      break;
+
+    assembleUnit(&unitQueue.units[i]);
+  }
+
+  return arg;
+}
 
-void formatWrite(FILE *inFilePtr, FILE *outFilePtr)
+/*
+ * Single pass over one file: every line is encoded as soon as it is read.
+ * Operands that name a label which is not defined yet are left as zero and
+ * recorded in the fixup list, which is patched once the whole file has been
+ * seen. Nothing is written until then, so the input may be a pipe.
+ */
+void assembleUnit(unitType *unit)
 {
-    instType inst;
-    stringType label, opcode, arg0, arg1, arg2;
-    int curAddr, temp, errArg; /* which arg err*/
+  tokenType label, opcode, arg0, arg1, arg2;
+  int curAddr, status;
+
+  openSource(&unit->source, unit->fileName);
+
+  for (curAddr = 0; ; ++curAddr)
+  {
+    unit->lineStart = unit->source.cur;
+
+    if ((status = readAndParse(&unit->source, &label, &opcode, &arg0, &arg1, &arg2)) == 0)
+      break;
+
+    if (status < 0)
+    {
+      if (!keepGoing)
+      {
+        unit->fatal = "!err! line too long";
+        return;
+      }
 
-    for (curAddr = 0; readAndParse(inFilePtr, label, opcode, arg0, arg1, arg2); ++curAddr)
+      /* recover at the next line; the long line still takes an address */
+      addDiag(unit, curAddr, MAXLINELENGTH, ERR_LINE_TOO_LONG, "", 0);
+      skipLine(&unit->source);
+      newLine(unit)->err = ERR_LINE_TOO_LONG;
+    }
+    else
     {
-        if (curAddr)
+      if (label.len > 0 && !addLabel(&unit->labelTable, label.ptr, label.len, curAddr))
+      {
+        if (!keepGoing)
         {
-            fputc('\n', outFilePtr);
+          unit->fatal = "!err! duplicate label";
+          return;
         }
 
-        memset(&inst, 0, sizeof inst);
-        temp = ERR;
-        errArg = -1;
-        /* after doing a readAndParse, you may want to do the following to test the opcode */
-        
-        if (strcmp(opcode, ".fill") == 0)
+        addDiag(unit, curAddr, 1, ERR_DUPLICATE_LABEL, label.ptr, label.len);
+      }
+
+      assembleLine(unit, curAddr, &opcode, &arg0, &arg1, &arg2);
+    }
+
+    /* past the limit the rest of the file is not worth reading */
+    if (keepGoing && unit->numDiags >= maxErrors)
+    {
+      unit->truncated = 1;
+      return;
+    }
+  }
+
+  resolveFixups(unit);
+}
+
+/* append an empty line to the IR and return it */
+lineType *newLine(unitType *unit)
+{
+  if (unit->numLines == unit->capacity)
+  {
+    unit->capacity = unit->capacity ? unit->capacity * 2 : PROGRAM_INIT;
+    unit->lines = realloc(unit->lines, unit->capacity * sizeof(lineType));
+    if (unit->lines == NULL)
+    {
+      printf("!err! out of memory\n");
+      exit(1);
+    }
+  }
+
+  memset(&unit->lines[unit->numLines], 0, sizeof(lineType));
+  return &unit->lines[unit->numLines++];
+}
+
+/* encode one source line into the IR; errors are kept for formatWrite */
+void assembleLine(unitType *unit, int curAddr, const tokenType *opcode, const tokenType *arg0, const tokenType *arg1, const tokenType *arg2)
+{
+  lineType *line = newLine(unit);
+  instType inst;
+  int temp, errArg = -1;
+  int op = lookupOpcode(opcode->ptr, opcode->len);
+
+  memset(&inst, 0, sizeof inst);
+  temp = ERR;
+
+  if (op == OP_FILL)
+  {
+    line->isFill = 1;
+
+    if (arg0->len == 0)
+      temp = ERR_LACK_ARGUMENTS;
+    else
+      line->code = labelOrImmediate(unit, curAddr, 0, arg0, FIX_FILL);
+  }
+  else
+  {
+    if (op < 0)
+    {
+      temp = ERR_UNRECOGNIZED_OPCODE;
+      line->errToken = internLabel(&unit->labelTable, opcode->ptr, opcode->len);
+    }
+    else
+    {
+      temp = encoders[opTable[op].format](unit, op, curAddr, arg0, arg1, arg2, &inst, &errArg);
+    }
+
+    line->code = inst.code;
+  }
+
+  line->err = temp;
+
+  /* the offending operand, or the mnemonic itself */
+  if (temp != ERR && keepGoing)
+  {
+    const tokenType *tok = errArg == 0 ? arg0 : errArg == 1 ? arg1 : errArg == 2 ? arg2 : opcode;
+
+    /* a missing register is reported as such, not as a bad number */
+    addDiag(unit, curAddr, tok->ptr - unit->lineStart + 1,
+            temp == ERR_ARGUMENT && tok->len == 0 ? ERR_LACK_ARGUMENTS : temp, tok->ptr, tok->len);
+  }
+}
+
+/* fold a label address into a line's code */
+void patchLine(lineType *line, enum FixupKind kind, int value)
+{
+  instType inst;
+
+  if (kind == FIX_FILL)
+  {
+    line->code = value;
+  }
+  else
+  {
+    inst.code = line->code;
+    inst.i.offset = value;
+    line->code = inst.code;
+  }
+}
+
+/* patch the forward references to labels of this unit; keep the others */
+void resolveFixups(unitType *unit)
+{
+  fixupType *fixup;
+  int i, addr, numExternal = 0;
+
+  for (i = 0; i < unit->numFixups; ++i)
+  {
+    fixup = &unit->fixups[i];
+
+    if ((addr = findLabelAddr(&unit->labelTable, fixup->label, strlen(fixup->label))) == -1)
+    {
+      unit->fixups[numExternal++] = *fixup;
+      continue;
+    }
+
+    if (fixup->relative)
+    {
+      patchLine(&unit->lines[fixup->line], fixup->kind, addr - (fixup->line + 1));
+    }
+    else
+    {
+      patchLine(&unit->lines[fixup->line], fixup->kind, addr);
+      unit->lines[fixup->line].reloc = fixup->kind;
+    }
+  }
+
+  unit->numFixups = numExternal;
+}
+
+/*
+ * Lay the units out one after another, relocate absolute label addresses by
+ * each unit's base and resolve the labels left over in every unit against
+ * all of them. Labels are global, so the result is the same as assembling
+ * the concatenated files. Returns the table of all labels.
+ */
+labelTableType *linkUnits(unitType *units, int numUnits)
+{
+  static labelTableType globalTable;
+  labelTableType *symbols = &units[0].labelTable;
+  lineType *line;
+  fixupType *fixup;
+  labelType *label;
+  instType inst;
+  unsigned int i;
+  int u, f, addr, base = 0;
+
+  for (u = 0; u < numUnits; ++u)
+  {
+    units[u].base = base;
+    base += units[u].numLines;
+  }
+
+  if (numUnits > 1)
+  {
+    symbols = &globalTable;
+
+    for (u = 0; u < numUnits; ++u)
+    {
+      for (i = 0; i < units[u].labelTable.capacity; ++i)
+      {
+        label = &units[u].labelTable.labels[i];
+
+        if (label->label == NULL)
+          continue;
+
+        if (insertLabel(symbols, label->label, label->len, label->hash, units[u].base + label->addr) == NULL)
         {
-            if (strlen(arg0) == 0)
-            {
-                temp = ERR_LACK_ARGUMENTS;
+          if (!keepGoing)
+          {
+            printf("!err! duplicate label\n");
+            exit(1);
+          }
 
-                goto err;
-            }
+          addDiag(&units[u], label->addr, 1, ERR_DUPLICATE_LABEL, label->label, label->len);
+        }
+      }
 
-            if (isNumber(arg0))
-            {
-                fprintf(outFilePtr, "%d", atoi(arg0));
-            }
-            else
+      for (f = 0; units[u].base != 0 && f < units[u].numLines; ++f)
+      {
+        line = &units[u].lines[f];
+
+        inst.code = line->code;
+        if (line->reloc == FIX_FILL)
+          patchLine(line, FIX_FILL, line->code + units[u].base);
+        else if (line->reloc == FIX_OFFSET)
+          patchLine(line, FIX_OFFSET, inst.i.offset + units[u].base);
+      }
+    }
+  }
+
+  for (u = 0; u < numUnits; ++u)
+  {
+    for (f = 0; f < units[u].numFixups; ++f)
+    {
+      fixup = &units[u].fixups[f];
+      line = &units[u].lines[fixup->line];
+
+      if (numUnits == 1 || (addr = findLabelAddr(symbols, fixup->label, strlen(fixup->label))) == -1)
+      {
+        line->err = ERR_UNDEFINED_LABEL;
+        line->errToken = fixup->label;
+        if (keepGoing)
+          addDiag(&units[u], fixup->line, fixup->col, ERR_UNDEFINED_LABEL, fixup->label, strlen(fixup->label));
+      }
+      else if (fixup->relative)
+      {
+        patchLine(line, fixup->kind, addr - (units[u].base + fixup->line + 1));
+      }
+      else
+      {
+        patchLine(line, fixup->kind, addr);
+      }
+    }
+  }
+
+  return symbols;
+}
+
+void formatWrite(unitType *units, int numUnits, labelTableType *symbols, FILE *outFilePtr, int binary)
+{
+    lineType *line = NULL;
+    int u, curAddr;
+
+    /* a binary image is all or nothing: check every line before writing */
+    if (binary)
+    {
+        for (u = 0; u < numUnits; ++u)
+        {
+            for (curAddr = 0; curAddr < units[u].numLines; ++curAddr)
             {
-                if ((temp = findLabelAddr(arg0)) == -1)
-                {
-                    temp = ERR_UNDEFINED_LABEL;
-                    errArg = 0;
+                line = &units[u].lines[curAddr];
 
+                if (line->err != ERR)
                     goto err;
-                }
+            }
+        }
 
-                fprintf(outFilePtr, "%d", temp);
+        writeImage(units, numUnits, symbols, outFilePtr);
+        return;
+    }
+
+    for (u = 0; u < numUnits; ++u)
+    {
+        for (curAddr = 0; curAddr < units[u].numLines; ++curAddr)
+        {
+            if (units[u].base + curAddr)
+            {
+                fputc('\n', outFilePtr);
             }
-        } else {
-            if (strcmp(opcode, "add") == 0)
-                temp = RType(OP_ADD, curAddr, arg0, arg1, arg2, &inst, &errArg);
-            else if (strcmp(opcode, "nor") == 0)
-                temp = RType(OP_NOR, curAddr, arg0, arg1, arg2, &inst, &errArg);
-            else if (strcmp(opcode, "lw") == 0)
-                temp = IType(OP_LW, curAddr, arg0, arg1, arg2, &inst, &errArg);
-            else if (strcmp(opcode, "sw") == 0)
-                temp = IType(OP_SW, curAddr, arg0, arg1, arg2, &inst, &errArg);
-            else if (strcmp(opcode, "beq") == 0)
-                temp = IType(OP_BEQ, curAddr, arg0, arg1, arg2, &inst, &errArg);
-            else if (strcmp(opcode, "jalr") == 0)
-                temp = JType(OP_JALR,curAddr,  arg0, arg1, arg2, &inst, &errArg);
-            else if (strcmp(opcode, "halt") == 0)
-                temp = OType(OP_HALT,curAddr,  arg0, arg1, arg2, &inst, &errArg);
-            else if (strcmp(opcode, "noop") == 0)
-                temp = OType(OP_NOOP,curAddr,  arg0, arg1, arg2, &inst, &errArg);
-            else
-                temp = ERR_UNRECOGNIZED_OPCODE;
 
-                
-            if (temp != ERR)
+            line = &units[u].lines[curAddr];
+
+            if (line->err != ERR)
                 goto err;
 
-            fprintf(outFilePtr, "%u", inst.code);
+            if (line->isFill)
+                fprintf(outFilePtr, "%d", (int)line->code);
+            else
+                fprintf(outFilePtr, "%u", line->code);
         }
     }
 
@@ -233,227 +699,565 @@ void formatWrite(FILE *inFilePtr, FILE *outFilePtr)
 
 err:
     /*Error Checking*/
-    if (temp == ERR_LACK_ARGUMENTS)
+    if (line->err == ERR_LACK_ARGUMENTS)
     {
         printf("!err! lack arguments\n");
     }
-    else if (temp == ERR_UNDEFINED_LABEL)
+    else if (line->err == ERR_UNDEFINED_LABEL)
     {
-        printf("!err! undefined label\n");
-        switch (errArg)
-        {
-        case 0:
-            printf("%s", arg0);
-            break;
-        case 1:
-            printf("%s", arg1);
-            break;
-        case 2:
-            printf("%s", arg2);
-            break;
-        }
-        printf("\n");
+        printf("!err! undefined label\n%s\n", line->errToken);
     }
-    else if (temp == ERR_LACK_ARGUMENTS)
+    else if (line->err == ERR_UNRECOGNIZED_OPCODE)
     {
-        printf("!err! lack argument\n");
-        switch (errArg)
-        {
-        case 0:
-            printf("%s", arg0);
-            break;
-        case 1:
-            printf("%s", arg1);
-            break;
-        case 2:
-            printf("%s", arg2);
-            break;
-        }
-        printf("\n");
-    }
-    else if (temp == ERR_UNRECOGNIZED_OPCODE)
-    {
-        printf("!err! unrecognized opcode\n%s\n", opcode);
+        printf("!err! unrecognized opcode\n%s\n", line->errToken);
     }
-    else if (temp == ERR_OVERFLOW)
+    else if (line->err == ERR_OVERFLOW)
     {
         printf("!err! argument overflow\n");
     }
 
-    fclose(inFilePtr);
     fclose(outFilePtr);
     exit(1);
 }
 
+void addDiag(unitType *unit, int line, int col, enum Error err, const char *token, int len)
+{
+  diagType *diag;
+
+  if (unit->numDiags == unit->diagCapacity)
+  {
+    unit->diagCapacity = unit->diagCapacity ? unit->diagCapacity * 2 : 16;
+    unit->diags = realloc(unit->diags, unit->diagCapacity * sizeof(diagType));
+    if (unit->diags == NULL)
+    {
+      printf("!err! out of memory\n");
+      exit(1);
+    }
+  }
+
+  diag = &unit->diags[unit->numDiags++];
+  diag->line = line + 1;
+  diag->col = col;
+  diag->err = err;
+  diag->token = internLabel(&unit->labelTable, token, len);
+}
+
+int compareDiags(const void *a, const void *b)
+{
+  const diagType *x = a, *y = b;
+
+  if (x->line != y->line)
+    return x->line - y->line;
+  return x->col - y->col;
+}
+
+void printJsonString(FILE *filePtr, const char *string)
+{
+  fputc('"', filePtr);
+  for (; *string != '\0'; ++string)
+  {
+    if (*string == '"' || *string == '\\')
+      fprintf(filePtr, "\\%c", *string);
+    else if ((unsigned char)*string < 0x20)
+      fprintf(filePtr, "\\u%04x", (unsigned char)*string);
+    else
+      fputc(*string, filePtr);
+  }
+  fputc('"', filePtr);
+}
+
+/* print every diagnostic in file and line order, then exit(1) if there were any */
+void reportDiagnostics(unitType *units, int numUnits)
+{
+  const char *fileName;
+  diagType *diag;
+  int u, i, total = 0, shown = 0, truncated = 0;
+
+  for (u = 0; u < numUnits; ++u)
+  {
+    total += units[u].numDiags;
+    truncated |= units[u].truncated;
+  }
+  truncated |= total > maxErrors;
+
+  if (total == 0)
+    return;
+
+  if (jsonOutput)
+    fprintf(stderr, "{\"errors\": %d, \"truncated\": %s, \"diagnostics\": [", total, truncated ? "true" : "false");
+
+  for (u = 0; u < numUnits && shown < maxErrors; ++u)
+  {
+    fileName = strcmp(units[u].fileName, "-") == 0 ? "<stdin>" : units[u].fileName;
+    qsort(units[u].diags, units[u].numDiags, sizeof(diagType), compareDiags);
+
+    for (i = 0; i < units[u].numDiags && shown < maxErrors; ++i, ++shown)
+    {
+      diag = &units[u].diags[i];
+
+      if (jsonOutput)
+      {
+        fprintf(stderr, "%s\n  {\"file\": ", shown ? "," : "");
+        printJsonString(stderr, fileName);
+        fprintf(stderr, ", \"line\": %d, \"column\": %d, \"code\": \"%s\", \"message\": \"%s\", \"token\": ",
+                diag->line, diag->col, errorNames[diag->err][1], errorNames[diag->err][0]);
+        printJsonString(stderr, diag->token);
+        fputc('}', stderr);
+      }
+      else
+      {
+        fprintf(stderr, "%s:%d:%d: error: %s", fileName, diag->line, diag->col, errorNames[diag->err][0]);
+        fprintf(stderr, diag->token[0] != '\0' ? " '%s'\n" : "\n", diag->token);
+      }
+    }
+  }
+
+  if (jsonOutput)
+    fprintf(stderr, "\n]}\n");
+  else
+    fprintf(stderr, "%d error%s%s\n", total, total == 1 ? "" : "s", truncated ? " (stopped at the error limit)" : "");
+
+  exit(1);
+}
+
+/* map the input file; stdin and other unmappable inputs are read whole */
+void openSource(sourceType *source, const char *fileName)
+{
+  struct stat st;
+  size_t size = 0, capacity = 0;
+  char *buf = NULL;
+  int fd;
+  ssize_t n;
+
+  fd = strcmp(fileName, "-") == 0 ? STDIN_FILENO : open(fileName, O_RDONLY);
+  if (fd < 0)
+  {
+    printf("error in opening %s\n", fileName);
+    exit(1);
+  }
+
+  source->mapped = 0;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf != MAP_FAILED)
+    {
+      source->mapped = size = st.st_size;
+    }
+    else
+    {
+      buf = NULL;
+    }
+  }
+
+  while (!source->mapped)
+  {
+    if (size == capacity)
+    {
+      capacity = capacity ? capacity * 2 : LABEL_POOL_CHUNK;
+      if ((buf = realloc(buf, capacity)) == NULL)
+      {
+        printf("!err! out of memory\n");
+        exit(1);
+      }
+    }
+    if ((n = read(fd, buf + size, capacity - size)) <= 0)
+      break;
+    size += n;
+  }
+
+  if (fd != STDIN_FILENO)
+    close(fd);
+
+  source->buf = source->cur = buf;
+  source->end = buf + size;
+}
+
+void closeSource(sourceType *source)
+{
+  if (source->mapped)
+    munmap((void *)source->buf, source->mapped);
+  else
+    free((void *)source->buf);
+}
+
+#define isSpace(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+/* scan the whitespace-delimited token at *pp and parse it as %d would */
+void nextToken(const char **pp, const char *end, tokenType *tok)
+{
+  const char *p = *pp;
+  const char *digits;
+  long long val = 0;
+  int negative = 0, overflow = 0;
+
+  while (p < end && isSpace(*p))
+    ++p;
+
+  tok->ptr = p;
+  while (p < end && !isSpace(*p))
+    ++p;
+  tok->len = p - tok->ptr;
+  *pp = p;
+
+  /* optional sign then at least one digit; trailing junk is ignored */
+  digits = tok->ptr;
+  if (digits < p && (*digits == '-' || *digits == '+'))
+    negative = *digits++ == '-';
+
+  tok->isNumber = digits < p && *digits >= '0' && *digits <= '9';
+  for (; digits < p && *digits >= '0' && *digits <= '9'; ++digits)
+  {
+    if (val > (LLONG_MAX - (*digits - '0')) / 10)
+      overflow = 1;
+    else
+      val = val * 10 + (*digits - '0');
+  }
+
+  /* saturate like strtol, then truncate to int as sscanf does */
+  if (overflow)
+    tok->val = (int)(negative ? LLONG_MIN : LLONG_MAX);
+  else
+    tok->val = (int)(negative ? -val : val);
+}
+
+/* write the assembled program and its labels as a binary image */
+void writeImage(unitType *units, int numUnits, labelTableType *symbols, FILE *outFilePtr)
+{
+  unsigned int i;
+  int u, curAddr;
+
+  writeImageHeader(outFilePtr, units[numUnits - 1].base + units[numUnits - 1].numLines, symbols->numAddrs);
+
+  for (u = 0; u < numUnits; ++u)
+  {
+    for (curAddr = 0; curAddr < units[u].numLines; ++curAddr)
+      writeImageWord(outFilePtr, (int)units[u].lines[curAddr].code);
+  }
+
+  for (i = 0; i < symbols->capacity; ++i)
+  {
+    if (symbols->labels[i].label != NULL)
+      writeImageSymbol(outFilePtr, symbols->labels[i].label, symbols->labels[i].len, symbols->labels[i].addr);
+  }
+}
+
 /** * * * * * * * * */
-int readAndParse(FILE *inFilePtr, char *label, char *opcode, char *arg0, char *arg1, char *arg2)
+int readAndParse(sourceType *source, tokenType *label, tokenType *opcode, tokenType *arg0, tokenType *arg1, tokenType *arg2)
 {
-  char line[MAXLINELENGTH];
-  char *ptr = line;
-  /* delete prior values */
-  label[0] = opcode[0] = arg0[0] = arg1[0] = arg2[0] = '\0'; /* read the line from the assembly-language file */
-  if (fgets(line, MAXLINELENGTH, inFilePtr) == NULL)
+  const char *ptr = source->cur, *newline;
+  size_t avail = source->end - ptr;
+
+  if (avail == 0)
   { /* reached end of file */
     return (0);
   }
-  /* check for line too long (by looking for a \n) */
-  if (strchr(line, '\n') == NULL)
+  /* check for line too long (by looking for a \n, as fgets with MAXLINELENGTH would) */
+  newline = memchr(ptr, '\n', avail < MAXLINELENGTH - 1 ? avail : MAXLINELENGTH - 1);
+  if (newline == NULL)
   {
-    printf("!err! line too long\n");
-    exit(1);
+    /* line too long */
+    return (-1);
+  }
+  source->cur = newline + 1;
+
+  /* is there a label? it must start in the first column */
+  if (isSpace(*ptr))
+  {
+    label->ptr = ptr;
+    label->len = 0;
+    label->isNumber = 0;
   }
-  /* is there a label? */
-  ptr = line;
-  if (sscanf(ptr, "%[^\t\n\r ]", label))
+  else
   {
-    /* successfully read label; advance pointer over the label */
-    ptr += strlen(label);
+    nextToken(&ptr, newline, label);
   }
-  /*
-   * Parse the rest of the line. Would be nice to have real regular
-   * expressions, but scanf will suffice. */
-  sscanf(ptr, "%*[\t\n\r ]%[^\t\n\r ]%*[\t\n\r ]%[^\t\n\r ]%*[\t\n\r ]%[^\t\n\r ]%*[\t\n\r ]%[^\t\n\r ]",
-         opcode, arg0, arg1, arg2);
+
+  /* the rest of the line; anything after arg2 is a comment */
+  nextToken(&ptr, newline, opcode);
+  nextToken(&ptr, newline, arg0);
+  nextToken(&ptr, newline, arg1);
+  nextToken(&ptr, newline, arg2);
   return (1);
 }
 
-// return 1 if string is a number.
-int isNumber(const char *string)
+/* step over a line readAndParse rejected as too long */
+void skipLine(sourceType *source)
 {
-  int i;
-  return ((sscanf(string, "%d", &i)) == 1);
+  const char *newline = memchr(source->cur, '\n', source->end - source->cur);
+
+  source->cur = newline != NULL ? newline + 1 : source->end;
 }
 
-int checkVal(const char *string)
+int checkVal(const tokenType *tok)
 {
-  int val = atoi(string);
+  int val = tok->val;
 
   return (val < -32768) || (val > 32767) ;
 }
 
-int labelOrImmediate(int labelOffset, const char *arg, enum Error *err)
+/* resolve arg now if possible, otherwise queue a fixup and return 0 */
+int labelOrImmediate(unitType *unit, int curAddr, int relative, const tokenType *arg, enum FixupKind kind)
 {
+  fixupType *fixup;
   int addr;
 
-  if (isNumber(arg))
+  if (arg->isNumber)
   {
-    return atoi(arg);
+    return arg->val;
   }
 
-  if ((addr = findLabelAddr(arg)) == -1)
+  if ((addr = findLabelAddr(&unit->labelTable, arg->ptr, arg->len)) != -1)
   {
-    *err = ERR_UNDEFINED_LABEL;
-    return -1;
+    if (relative)
+      return addr - (curAddr + 1);
+
+    /* absolute addresses move when the unit is linked at a nonzero base */
+    unit->lines[curAddr].reloc = kind;
+    return addr;
+  }
+
+  if (unit->numFixups == unit->fixupCapacity)
+  {
+    unit->fixupCapacity = unit->fixupCapacity ? unit->fixupCapacity * 2 : PROGRAM_INIT;
+    unit->fixups = realloc(unit->fixups, unit->fixupCapacity * sizeof(fixupType));
+    if (unit->fixups == NULL)
+    {
+      printf("!err! out of memory\n");
+      exit(1);
+    }
   }
 
-  return addr - labelOffset;
+  fixup = &unit->fixups[unit->numFixups++];
+  fixup->line = curAddr;
+  fixup->col = arg->ptr - unit->lineStart + 1;
+  fixup->label = internLabel(&unit->labelTable, arg->ptr, arg->len);
+  fixup->relative = relative;
+  fixup->kind = kind;
+
+  return 0;
 }
 
-int findLabelAddr(const char *label)
+/* FNV-1a over the label bytes */
+unsigned int hashLabel(const char *label, int len)
 {
+  unsigned int hash = 2166136261u;
   int i;
-  for (i = 0; i < labelTable.numAddrs; ++i)
+
+  for (i = 0; i < len; ++i)
+  {
+    hash ^= (unsigned char)label[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/* copy a label into the string pool; pooled strings live until exit */
+const char *internLabel(labelTableType *table, const char *label, int len)
+{
+  poolChunkType *chunk = table->pool;
+  char *str;
+
+  if (chunk == NULL || chunk->used + len + 1 > LABEL_POOL_CHUNK)
+  {
+    /* labels are shorter than MAXLINELENGTH, so one chunk always fits one */
+    chunk = malloc(sizeof(poolChunkType));
+    if (chunk == NULL)
+    {
+      printf("!err! out of memory\n");
+      exit(1);
+    }
+    chunk->next = table->pool;
+    chunk->used = 0;
+    table->pool = chunk;
+  }
+
+  str = chunk->data + chunk->used;
+  memcpy(str, label, len);
+  str[len] = '\0';
+  chunk->used += len + 1;
+
+  return str;
+}
+
+/* return the slot holding label, or the empty slot where it belongs */
+labelType *probeLabel(labelTableType *table, const char *label, int len, unsigned int hash)
+{
+  unsigned int mask = table->capacity - 1;
+  unsigned int i = hash & mask;
+
+  while (table->labels[i].label != NULL)
+  {
+    if (table->labels[i].hash == hash && table->labels[i].len == len &&
+        memcmp(table->labels[i].label, label, len) == 0)
+      return &table->labels[i];
+
+    i = (i + 1) & mask;
+  }
+
+  return &table->labels[i];
+}
+
+/* double the slot array; stored hashes mean no label is rehashed */
+void growLabelTable(labelTableType *table)
+{
+  labelType *old = table->labels;
+  unsigned int oldCapacity = table->capacity, i;
+
+  table->capacity = oldCapacity ? oldCapacity * 2 : LABEL_TABLE_INIT;
+  table->labels = calloc(table->capacity, sizeof(labelType));
+  if (table->labels == NULL)
   {
-    if (strcmp(label, labelTable.labels[i].label) == 0)
-      return labelTable.labels[i].addr;
+    printf("!err! out of memory\n");
+    exit(1);
   }
 
-  return -1;
+  for (i = 0; i < oldCapacity; ++i)
+  {
+    if (old[i].label != NULL)
+      *probeLabel(table, old[i].label, old[i].len, old[i].hash) = old[i];
+  }
+
+  free(old);
+}
+
+/*
+ * Add an already interned label with a precomputed hash. Returns the new
+ * slot, or NULL if the label is already defined.
+ */
+labelType *insertLabel(labelTableType *table, const char *label, int len, unsigned int hash, int addr)
+{
+  labelType *slot;
+
+  /* keep the load factor under 1/2 */
+  if (2 * (table->numAddrs + 1) > (int)table->capacity)
+    growLabelTable(table);
+
+  slot = probeLabel(table, label, len, hash);
+  if (slot->label != NULL)
+    return NULL;
+
+  slot->label = label;
+  slot->hash = hash;
+  slot->len = len;
+  slot->addr = addr;
+  ++table->numAddrs;
+
+  return slot;
+}
+
+// return 0 if label is already defined.
+int addLabel(labelTableType *table, const char *label, int len, int addr)
+{
+  labelType *slot = insertLabel(table, label, len, hashLabel(label, len), addr);
+
+  if (slot == NULL)
+    return 0;
+
+  /* the slot points at the source buffer until the name is interned */
+  slot->label = internLabel(table, label, len);
+  return 1;
 }
 
+int findLabelAddr(labelTableType *table, const char *label, int len)
+{
+  labelType *slot;
+
+  if (table->numAddrs == 0)
+    return -1;
+
+  slot = probeLabel(table, label, len, hashLabel(label, len));
+
+  return slot->label != NULL ? slot->addr : -1;
+}
 
-int RType(enum OpCode opcode, int curAddr, const char *arg0, const char *arg1, const char *arg2, instType *inst, int *errArg)
+
+int RType(unitType *unit, enum OpCode opcode, int curAddr, const tokenType *arg0, const tokenType *arg1, const tokenType *arg2, instType *inst, int *errArg)
 {
-  if (!isNumber(arg0))
+  if (!arg0->isNumber)
   {
     *errArg = 0;
     return ERR_ARGUMENT;
   }
 
-  if (!isNumber(arg1))
+  if (!arg1->isNumber)
   {
     *errArg = 1;
     return ERR_ARGUMENT;
   }
 
-  if (!isNumber(arg2))
+  if (!arg2->isNumber)
   {
     *errArg = 2;
     return ERR_ARGUMENT;
   }
 
-  if (strlen(arg0) == 0 || strlen(arg1) == 0 || strlen(arg2) == 0)
+  if (arg0->len == 0 || arg1->len == 0 || arg2->len == 0)
     return ERR_LACK_ARGUMENTS;
 
   inst->r.opcode = opcode;
-  inst->r.regA = atoi(arg0);
-  inst->r.regB = atoi(arg1);
-  inst->r.destReg = atoi(arg2);
+  inst->r.regA = arg0->val;
+  inst->r.regB = arg1->val;
+  inst->r.destReg = arg2->val;
 
   return ERR;
 }
 
-int IType(enum OpCode opcode, int curAddr, const char *arg0, const char *arg1, const char *arg2, instType *inst, int *errArg)
+int IType(unitType *unit, enum OpCode opcode, int curAddr, const tokenType *arg0, const tokenType *arg1, const tokenType *arg2, instType *inst, int *errArg)
 {
 
-  int mc = 0, address = 0;
-
   enum Error err = ERR;
 
-
-  if (!isNumber(arg0))
+  if (!arg0->isNumber)
   {
     *errArg = 0;
     return ERR_ARGUMENT;
   }
 
-  if (!isNumber(arg1))
+  if (!arg1->isNumber)
   {
     *errArg = 1;
     return ERR_ARGUMENT;
   }
 
-  if (isNumber(arg2) && checkVal(arg2))
+  if (arg2->isNumber && checkVal(arg2))
   {
     *errArg = 2;
     return ERR_OVERFLOW;
   }
-  if (strlen(arg0) == 0 || strlen(arg1) == 0 || strlen(arg2) == 0)
+  if (arg0->len == 0 || arg1->len == 0 || arg2->len == 0)
     return ERR_LACK_ARGUMENTS;
 
   inst->i.opcode = opcode;
-  inst->i.regA = atoi(arg0);
-  inst->i.regB = atoi(arg1);
-  inst->i.offset = labelOrImmediate((opcode == OP_BEQ ? curAddr + 1 : 0), arg2, &err);
-
-  // maybe error is in arg2
-  if (err != ERR)
-    *errArg = 2;
+  inst->i.regA = arg0->val;
+  inst->i.regB = arg1->val;
+  inst->i.offset = labelOrImmediate(unit, curAddr, opTable[opcode].pcRelative, arg2, FIX_OFFSET);
 
   return err;
 }
 
-int JType(enum OpCode opcode, int curAddr, const char *arg0, const char *arg1, const char *arg2, instType *inst, int *errArg)
+int JType(unitType *unit, enum OpCode opcode, int curAddr, const tokenType *arg0, const tokenType *arg1, const tokenType *arg2, instType *inst, int *errArg)
 {
 
-  if (!isNumber(arg0))
+  if (!arg0->isNumber)
   {
     *errArg = 0;
     return ERR_ARGUMENT;
   }
 
-  if (!isNumber(arg1))
+  if (!arg1->isNumber)
   {
     *errArg = 1;
     return ERR_ARGUMENT;
   }
 
-  if (strlen(arg0) == 0 || strlen(arg1) == 0)
+  if (arg0->len == 0 || arg1->len == 0)
     return ERR_LACK_ARGUMENTS;
 
   inst->j.opcode = opcode;
-  inst->j.regA = atoi(arg0);
-  inst->j.regB = atoi(arg1);
+  inst->j.regA = arg0->val;
+  inst->j.regB = arg1->val;
 
   return ERR;
 }
@@ -462,7 +1266,7 @@ int JType(enum OpCode opcode, int curAddr, const char *arg0, const char *arg1, c
 
 
 
-int OType(enum OpCode opcode, int curAddr, const char *arg0, const char *arg1, const char *arg2, instType *inst, int *errArg)
+int OType(unitType *unit, enum OpCode opcode, int curAddr, const tokenType *arg0, const tokenType *arg1, const tokenType *arg2, instType *inst, int *errArg)
 {
   inst->o.opcode = opcode;
   return ERR;
@@ -0,0 +1,6 @@
+	lw	0	1	count	count is in test6b.as
+	lw	0	2	neg1
+loop	add	1	2	1
+	beq	0	1	done	done is in test6b.as
+	beq	0	0	loop
+neg1	.fill	-1
@@ -0,0 +1,4 @@
+done	lw	0	3	neg1	neg1 is in test6a.as
+	halt
+count	.fill	3
+stAddr	.fill	loop	loop is in test6a.as
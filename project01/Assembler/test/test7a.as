@@ -0,0 +1,4 @@
+	lw	0	1	five
+start	add	1	1	1
+	halt
+five	.fill	5
@@ -0,0 +1,2 @@
+start	noop			start is also in test7a.as
+	beq	0	0	start
@@ -0,0 +1,8 @@
+	lw	0	1	five
+	lw	1	2	nowhere	undefined label
+	add	1	2
+start	add	1	2	1
+	mul	1	2	3	unrecognized opcode
+	beq	0	0	40000	offset overflow
+start	halt				duplicate label
+five	.fill	5
@@ -2,153 +2,841 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+
+#include "../../common/lc2k.h"
+#include "../../common/image.h"
+#include "../../common/writer.h"
+#include "../../common/memory.h"
+#include "../../common/pool.h"
+#include "../../common/batch.h"
+#include "../../common/trace.h"
+
 #define NUMMEMORY 65536 /* maximum number of words in memory */
 #define NUMREGS 8       /* number of machine registers */
 #define MAXLINELENGTH 1000
 
+/* computed goto is a GNU C extension */
+#if defined(__GNUC__)
+#define HAVE_THREADED_CORE 1
+#endif
+
+/* the translator emits x86-64 machine code */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_JIT_CORE 1
+#endif
+
+enum Core
+{
+  CORE_SWITCH,
+  CORE_THREADED,
+  CORE_JIT
+};
+
+/*
+ * Superinstructions: short sequences the threaded core runs with a single
+ * dispatch.  Each member keeps its own decoded entry; the fused head just
+ * executes them back to back.
+ */
+enum FuseKind
+{
+  FUSE_NONE,
+  FUSE_LW_ADD,   /* lw then add */
+  FUSE_ADD_BEQ,  /* add then beq, the usual loop counter */
+  FUSE_NOR3,     /* nor nor nor, how LC-2K builds and */
+  NUMFUSEKINDS
+};
+
+#define FUSE_THRESHOLD 16 /* taken branches to a pc before its block is fused */
+
+struct decodedStruct;
+
 typedef struct stateStruct
 {
   int pc;
-  int mem[NUMMEMORY];
+  memoryType mem; /* paged, copy-on-write; see common/memory.h */
   int reg[NUMREGS];
   int numMemory;
+  struct decodedStruct *decoded; /* decoded-instruction cache, by pc */
+  int stepLimit;                 /* 0, or stop with an error after this many */
+  int fuseSites[NUMFUSEKINDS];
+  long long fuseFired[NUMFUSEKINDS];
 } stateType;
 
-enum OpCode
+/*
+ * One pre-decoded instruction.  Fields are extracted, sign-extended and
+ * validated once, the first time the word at that pc is executed; after
+ * that the main loop only calls the handler.  An entry stays valid until
+ * a sw stores to its address.
+ */
+typedef struct decodedStruct
 {
-  OP_ADD = 0,
-  OP_NOR = 1,
-  OP_LW = 2,
-  OP_SW = 3,
-  OP_BEQ = 4,
-  OP_JALR = 5,
-  OP_HALT = 6,
-  OP_NOOP = 7
-};
+  int valid;
+  int opcode;
+  int regA;
+  int regB;
+  int dest;   /* destReg for add/nor */
+  int offset; /* sign-extended offsetField for lw/sw/beq */
+  void (*handler)(stateType *, const struct decodedStruct *);
+  void *target; /* label in the threaded core */
+  int fused;    /* FuseKind when this entry heads a superinstruction */
+  int hits;     /* taken branches to this pc, for fusion */
+} decodedType;
 
 void printState(stateType *);
 
-void RTypeInst(stateType *statePtr, int opcode, int arg0, int arg1, int destReg);
-void ITypeInst(stateType *statePtr, int opcode, int arg0, int arg1, int offset);
-void JTypeInst(stateType *statePtr, int opcode, int arg0, int arg1);
+/*
+ * Output level: print the state every printEvery instructions, or only the
+ * final state when printEvery is 0.  1 is the full trace.
+ */
+int printEvery = 1;
+writerType out;
+
+/* superinstructions are only formed when no state is printed mid-run */
+int fuseEnabled = 1;
+int fuseReport = 0;
+const char *fuseNames[NUMFUSEKINDS] = {"", "lw+add", "add+beq", "nor+nor+nor"};
+const int fuseLength[NUMFUSEKINDS] = {1, 2, 2, 3};
+
+/*
+ * A batch job that hits a simulation error (bad register, pc out of memory,
+ * step limit) longjmps here instead of ending the process.
+ */
+__thread jmp_buf *jobAbort;
+__thread const char *jobError;
+
+/* --trace: the reference core records every step here; NULL if not tracing */
+traceWriterType *trace;
+FILE *traceFilePtr;
+
+long long runSwitch(stateType *statePtr);
+#ifdef HAVE_THREADED_CORE
+long long runThreaded(stateType *statePtr);
+#endif
+#ifdef HAVE_JIT_CORE
+long long runJit(stateType *statePtr);
+#endif
+
 void parseInst(stateType *statePtr, int *opcode, int *arg0, int *arg1, int *arg2);
+void decodeInst(stateType *statePtr, decodedType *inst);
+int matchFusion(const decodedType *inst, int pc);
+void fuseRegion(stateType *statePtr, int pc, void *const *fusedLabels);
+void printFusionReport(stateType *statePtr);
+#if defined(__GNUC__)
+__attribute__((noreturn))
+#endif
+void simError(const char *message);
+long long firstCheckpoint(stateType *statePtr);
+long long checkpoint(stateType *statePtr, long long executionCount);
+int runBatch(const char *manifest, int numThreads, int stepLimit, int core);
+void startTrace(stateType *statePtr, const char *fileName, int flags, int blockSteps);
+void recordStep(stateType *statePtr, const decodedType *inst, int pc, int instr);
+void finishTrace(int status);
+
+void addInst(stateType *statePtr, const decodedType *inst);
+void norInst(stateType *statePtr, const decodedType *inst);
+void lwInst(stateType *statePtr, const decodedType *inst);
+void swInst(stateType *statePtr, const decodedType *inst);
+void beqInst(stateType *statePtr, const decodedType *inst);
+void jalrInst(stateType *statePtr, const decodedType *inst);
+void noopInst(stateType *statePtr, const decodedType *inst);
+void badRegInst(stateType *statePtr, const decodedType *inst);
+void badOpcodeInst(stateType *statePtr, const decodedType *inst);
 
 int main(int argc, char *argv[])
 {
   char line[MAXLINELENGTH];
-  stateType state;
+  static stateType state;
+  static decodedType decoded[NUMMEMORY];
   FILE *filePtr;
-  int executionCount = 0;
-  if (argc != 2)
+  char *fileName;
+  int *words;
+  long long executionCount;
+  int word, batch = 0, numThreads = 0, stepLimit = 0, i;
+  const char *traceFile = NULL, *imageError;
+  int traceFlags = 0, traceBlock = TRACE_BLOCK_STEPS;
+#ifdef HAVE_THREADED_CORE
+  int core = CORE_THREADED;
+#else
+  int core = CORE_SWITCH;
+#endif
+
+  for (i = 1; i < argc - 1; i++)
+  {
+    if (!strcmp(argv[i], "-q"))
+    {
+      printEvery = 0;
+    }
+    else if (!strcmp(argv[i], "-n") && i + 2 < argc)
+    {
+      printEvery = atoi(argv[++i]);
+      if (printEvery < 1)
+      {
+        printf("error: -n needs a positive step count\n");
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--batch"))
+    {
+      batch = 1;
+    }
+    else if (!strcmp(argv[i], "-j") && i + 2 < argc && atoi(argv[i + 1]) > 0)
+    {
+      numThreads = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--max-steps") && i + 2 < argc && atoi(argv[i + 1]) > 0)
+    {
+      stepLimit = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--no-fuse"))
+    {
+      fuseEnabled = 0;
+    }
+    else if (!strcmp(argv[i], "--fuse-report"))
+    {
+      fuseReport = 1;
+    }
+    else if (!strcmp(argv[i], "--core=switch"))
+    {
+      core = CORE_SWITCH;
+    }
+    else if (!strcmp(argv[i], "--core=threaded"))
+    {
+#ifdef HAVE_THREADED_CORE
+      core = CORE_THREADED;
+#else
+      printf("error: threaded core needs a compiler with computed goto\n");
+      exit(1);
+#endif
+    }
+    else if (!strcmp(argv[i], "--core=jit"))
+    {
+#ifdef HAVE_JIT_CORE
+      core = CORE_JIT;
+#else
+      printf("error: jit core is only available on x86-64\n");
+      exit(1);
+#endif
+    }
+    else if (!strncmp(argv[i], "--trace=", 8))
+    {
+      traceFile = argv[i] + 8;
+    }
+    else if (!strcmp(argv[i], "--trace-compress"))
+    {
+      traceFlags |= TRACE_COMPRESSED;
+    }
+    else if (!strncmp(argv[i], "--trace-block=", 14) && atoi(argv[i] + 14) > 0)
+    {
+      traceBlock = atoi(argv[i] + 14);
+    }
+    else
+    {
+      break;
+    }
+  }
+  if (i != argc - 1)
   {
-    printf("error: usage: %s <machine-code file>\n", argv[0]);
+    printf("error: usage: %s [-q | -n steps] [--core=switch|threaded|jit] "
+           "[--no-fuse] [--fuse-report]\n", argv[0]);
+    printf("           [--trace=path [--trace-compress] [--trace-block=steps]] "
+           "<machine-code file>\n");
+    printf("       %s [-j threads] [--max-steps steps] [--core=switch|threaded] "
+           "[--no-fuse] --batch <manifest>\n", argv[0]);
     exit(1);
   }
-  filePtr = fopen(argv[1], "r");
+  fileName = argv[i];
+
+  if (batch && traceFile != NULL)
+  {
+    printf("error: --trace records a single run\n");
+    exit(1);
+  }
+  if (batch)
+  {
+    /* batch jobs print one record each, never states */
+    printEvery = 0;
+    if (core == CORE_SWITCH)
+    {
+      fuseEnabled = 0;
+    }
+    exit(runBatch(fileName, numThreads, stepLimit, core));
+  }
+
+  outputInit();
+  writerInit(&out, stdout);
+
+  filePtr = fopen(fileName, "r");
   if (filePtr == NULL)
   {
-    printf("error: can't open file %s", argv[1]);
+    printf("error: can't open file %s", fileName);
     perror("fopen");
     exit(1);
   }
   /* read in the entire machine-code file into memory */
-  for (state.numMemory = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL;
-       state.numMemory++)
+  memInit(&state.mem);
+  words = malloc(NUMMEMORY * sizeof(int));
+  if (words == NULL)
+  {
+    printf("error: out of memory\n");
+    exit(1);
+  }
+  if ((state.numMemory = loadImage(fileName, words, NUMMEMORY, &imageError)) >= 0)
   {
-    if (sscanf(line, "%d", state.mem + state.numMemory) != 1)
+    /* binary image */
+    memLoad(&state.mem, words, state.numMemory);
+    for (i = 0; printEvery && i < state.numMemory; i++)
     {
-      printf("error in reading address %d\n", state.numMemory);
-      exit(1);
+      printf("memory[%d]=%d\n", i, words[i]);
+    }
+  }
+  else if (imageError != NULL)
+  {
+    printf("error: %s: %s\n", fileName, imageError);
+    exit(1);
+  }
+  else
+  {
+    for (state.numMemory = 0; fgets(line, MAXLINELENGTH, filePtr) != NULL;
+         state.numMemory++)
+    {
+      if (sscanf(line, "%d", &word) != 1)
+      {
+        printf("error in reading address %d\n", state.numMemory);
+        exit(1);
+      }
+      memWrite(&state.mem, state.numMemory, word);
+      if (printEvery)
+      {
+        printf("memory[%d]=%d\n", state.numMemory, word);
+      }
     }
-    printf("memory[%d]=%d\n", state.numMemory, state.mem[state.numMemory]);
+  }
+  free(words);
+
+  state.decoded = decoded;
+  if (printEvery)
+  {
+    fuseEnabled = 0;
   }
 
   // Print initial state
+  if (printEvery)
+  {
+    printState(&state);
+  }
+  if (traceFile != NULL)
+  {
+    /* only the reference core records */
+    core = CORE_SWITCH;
+    startTrace(&state, traceFile, traceFlags, traceBlock);
+  }
+#ifdef HAVE_JIT_CORE
+  /* translated code cannot stop to print intermediate states */
+  if (core == CORE_JIT && !printEvery)
+  {
+    executionCount = runJit(&state);
+  }
+  else
+#endif
+#ifdef HAVE_THREADED_CORE
+  if (core != CORE_SWITCH)
+  {
+    executionCount = runThreaded(&state);
+  }
+  else
+#endif
+  {
+    executionCount = runSwitch(&state);
+  }
+
+  if (trace != NULL)
+  {
+    finishTrace(TRACE_HALTED);
+  }
+  printf("machine halted\n");
+  printf("total of %lld instructions executed\n", executionCount);
+  printf("final state of machine:\n");
+
   printState(&state);
+
+  if (fuseReport)
+  {
+    printFusionReport(&state);
+  }
+
+  fclose(filePtr);
+  exit(0);
+}
+
+/* Reference core: one indirect handler call per instruction. */
+long long runSwitch(stateType *statePtr)
+{
+  long long executionCount = 0, nextPrint = firstCheckpoint(statePtr);
+  int tracePc = 0, traceInstr = 0;
+
   while (1)
   {
-    int opcode, arg0, arg1, arg2;
-    parseInst(&state, &opcode, &arg0, &arg1, &arg2);
-    int isHalt = 0;
+    decodedType *inst;
 
-    state.pc++;
+    if (statePtr->pc >= NUMMEMORY || statePtr->pc < 0)
+    {
+      simError("!err! Out of memory");
+    }
+    inst = &statePtr->decoded[statePtr->pc];
+    if (!inst->valid)
+    {
+      decodeInst(statePtr, inst);
+    }
+    if (trace != NULL)
+    {
+      /* before a sw can overwrite it */
+      tracePc = statePtr->pc;
+      traceInstr = memRead(&statePtr->mem, tracePc);
+    }
+
+    statePtr->pc++;
     executionCount++;
 
-    if (state.pc >= NUMMEMORY || state.pc < 0 )
+    if (statePtr->pc >= NUMMEMORY || statePtr->pc < 0 )
     {
-      printf("!err! Out of memory");
-      exit(1);
+      simError("!err! Out of memory");
     }
 
-    switch (opcode)
+    if (inst->opcode == OP_HALT)
     {
-    case OP_ADD:
-    case OP_NOR:
-      RTypeInst(&state, opcode, arg0, arg1, arg2);
-      break;
-    case OP_LW:
-    case OP_SW:
-    case OP_BEQ:
-      ITypeInst(&state, opcode, arg0, arg1, arg2);
-      break;
-    case OP_JALR:
-      JTypeInst(&state, opcode, arg0, arg1);
-      break;
-    case OP_HALT:
-      isHalt = 1;
-      break;
-    case OP_NOOP:
-      break;
-    default:
-      printf("Do not support its opcode.");
-      exit(1);
-      break;
+      if (trace != NULL)
+      {
+        recordStep(statePtr, inst, tracePc, traceInstr);
+      }
+      return executionCount;
     }
-    if (isHalt)
+    inst->handler(statePtr, inst);
+    if (trace != NULL)
     {
-      break;
+      recordStep(statePtr, inst, tracePc, traceInstr);
+    }
+    if (nextPrint && executionCount >= nextPrint)
+    {
+      nextPrint = checkpoint(statePtr, executionCount);
     }
-    printState(&state);
   }
+}
 
-  printf("machine halted\n");
-  printf("total of %d instructions executed\n", executionCount);
-  printf("final state of machine:\n");
+/*
+ * The cores call checkpoint() once executionCount reaches the value it (or
+ * firstCheckpoint) returned: the next state to print, or the step limit.
+ * 0 means neither, so the run goes on until it halts, as under the JIT.
+ */
+long long firstCheckpoint(stateType *statePtr)
+{
+  if (printEvery)
+  {
+    return printEvery;
+  }
+  return statePtr->stepLimit;
+}
 
-  printState(&state);
+long long checkpoint(stateType *statePtr, long long executionCount)
+{
+  if (!printEvery)
+  {
+    simError("!err! step limit reached");
+  }
+  printState(statePtr);
+  return executionCount + printEvery;
+}
 
-  fclose(filePtr);
-  exit(0);
+void simError(const char *message)
+{
+  if (jobAbort != NULL)
+  {
+    jobError = message;
+    longjmp(*jobAbort, 1);
+  }
+  if (trace != NULL)
+  {
+    /* keep the steps up to the error */
+    finishTrace(TRACE_STOPPED);
+  }
+  printf("%s", message);
+  exit(1);
 }
 
-void printState(stateType *statePtr)
+/* open fileName and record the run from *statePtr into it (see common/trace.h) */
+void startTrace(stateType *statePtr, const char *fileName, int flags, int blockSteps)
 {
-  int i;
-  printf("\n@@@\nstate:\n");
-  printf("\tpc %d\n", statePtr->pc);
-  printf("\tmemory:\n");
+  static traceWriterType writer;
+  int *image, i;
+
+  traceFilePtr = fopen(fileName, "wb");
+  if (traceFilePtr == NULL)
+  {
+    printf("error: can't open trace file %s\n", fileName);
+    exit(1);
+  }
+  image = malloc((statePtr->numMemory + 1) * sizeof(int));
+  if (image == NULL)
+  {
+    printf("error: out of memory\n");
+    exit(1);
+  }
   for (i = 0; i < statePtr->numMemory; i++)
   {
-    printf("\t\tmem[ %d ] %d\n", i, statePtr->mem[i]);
+    image[i] = memRead(&statePtr->mem, i);
   }
-  printf("\tregisters:\n");
-  for (i = 0; i < NUMREGS; i++)
+  traceCreate(&writer, traceFilePtr, flags, blockSteps, image, statePtr->numMemory,
+              statePtr->pc, statePtr->reg);
+  free(image);
+  trace = &writer;
+}
+
+/* the step that ran the word instr at pc, with its effects now in *statePtr */
+void recordStep(stateType *statePtr, const decodedType *inst, int pc, int instr)
+{
+  traceStepType step = {pc, instr, statePtr->pc, -1, 0, -1, 0};
+
+  switch (inst->opcode)
   {
-    printf("\t\treg[ %d ] %d\n", i, statePtr->reg[i]);
+  case OP_ADD:
+  case OP_NOR:
+    step.reg = inst->dest;
+    break;
+  case OP_LW:
+  case OP_JALR:
+    step.reg = inst->regB;
+    break;
+  case OP_SW:
+    step.addr = statePtr->reg[inst->regA] + inst->offset;
+    step.memValue = statePtr->reg[inst->regB];
+    break;
   }
-  printf("end state\n");
+  if (step.reg >= 0)
+  {
+    step.regValue = statePtr->reg[step.reg];
+  }
+  traceRecord(trace, &step);
 }
 
-int convertSize(int num)
+void finishTrace(int status)
 {
-  if (num & (1 << 15))
+  traceWriterType *writer = trace;
+
+  trace = NULL;
+  if (traceFinish(writer, status) < 0 || fclose(traceFilePtr) != 0)
   {
-    num -= (1 << 16);
+    printf("error: can't write the trace\n");
+    exit(1);
   }
+}
+
+#ifdef HAVE_THREADED_CORE
+/*
+ * Direct-threaded core.  Each cache entry also holds the address of the label
+ * that executes it, and every label ends by jumping straight to the label of
+ * the next pc, so there is no central dispatch branch.  Entries that have not
+ * been decoded yet, or were overwritten by sw, point at do_decode.  Must stay
+ * step-for-step identical to runSwitch.
+ */
+long long runThreaded(stateType *statePtr)
+{
+  static void *const labels[] = {
+      [OP_ADD] = &&do_add,
+      [OP_NOR] = &&do_nor,
+      [OP_LW] = &&do_lw,
+      [OP_SW] = &&do_sw,
+      [OP_BEQ] = &&do_beq,
+      [OP_JALR] = &&do_jalr,
+      [OP_HALT] = &&do_halt,
+      [OP_NOOP] = &&do_noop,
+  };
+  static void *const fusedLabels[] = {
+      [FUSE_LW_ADD] = &&do_lw_add,
+      [FUSE_ADD_BEQ] = &&do_add_beq,
+      [FUSE_NOR3] = &&do_nor3,
+  };
+  decodedType *decoded = statePtr->decoded;
+  decodedType *inst;
+  int *reg = statePtr->reg;
+  long long executionCount = 0, nextPrint = firstCheckpoint(statePtr);
+  int addr, i;
+
+  for (i = 0; i < NUMMEMORY; i++)
+  {
+    decoded[i].target = decoded[i].valid ? labels[decoded[i].opcode] : &&do_decode;
+  }
+
+#define DISPATCH()                                          \
+  do                                                        \
+  {                                                         \
+    if (statePtr->pc >= NUMMEMORY || statePtr->pc < 0)      \
+      goto out_of_memory;                                   \
+    inst = &decoded[statePtr->pc];                          \
+    goto *inst->target;                                     \
+  } while (0)
+#define STEP()                                              \
+  do                                                        \
+  {                                                         \
+    statePtr->pc++;                                         \
+    executionCount++;                                       \
+    if (statePtr->pc >= NUMMEMORY)                          \
+      goto out_of_memory;                                   \
+  } while (0)
+/* count a taken branch and fuse its target's block once it is hot */
+#define TAKEN()                                             \
+  do                                                        \
+  {                                                         \
+    if (fuseEnabled && statePtr->pc >= 0 &&                 \
+        statePtr->pc < NUMMEMORY &&                         \
+        ++decoded[statePtr->pc].hits == FUSE_THRESHOLD)     \
+      fuseRegion(statePtr, statePtr->pc, fusedLabels);      \
+  } while (0)
+#define NEXT()                                              \
+  do                                                        \
+  {                                                         \
+    if (nextPrint && executionCount >= nextPrint)           \
+      nextPrint = checkpoint(statePtr, executionCount);     \
+    DISPATCH();                                             \
+  } while (0)
+
+  DISPATCH();
+
+do_decode:
+  decodeInst(statePtr, inst);
+  inst->target = inst->handler == badRegInst ? &&do_badreg : labels[inst->opcode];
+  goto *inst->target;
+
+do_add:
+  STEP();
+  reg[inst->dest] = reg[inst->regA] + reg[inst->regB];
+  NEXT();
 
-  return (num);
+do_nor:
+  STEP();
+  reg[inst->dest] = ~(reg[inst->regA] | reg[inst->regB]);
+  NEXT();
+
+do_lw:
+  STEP();
+  reg[inst->regB] = memRead(&statePtr->mem, reg[inst->regA] + inst->offset);
+  NEXT();
+
+do_sw:
+  STEP();
+  addr = reg[inst->regA] + inst->offset;
+  memWrite(&statePtr->mem, addr, reg[inst->regB]);
+  if (addr >= 0 && addr < NUMMEMORY)
+  {
+    decoded[addr].valid = 0;
+    decoded[addr].target = &&do_decode;
+    /* a superinstruction that covers addr must be decoded again too */
+    for (i = 1; i < 3 && addr - i >= 0; i++)
+    {
+      if (decoded[addr - i].fused)
+      {
+        decoded[addr - i].valid = 0;
+        decoded[addr - i].target = &&do_decode;
+      }
+    }
+  }
+  NEXT();
+
+do_beq:
+  STEP();
+  if (reg[inst->regA] == reg[inst->regB])
+  {
+    statePtr->pc += inst->offset;
+    TAKEN();
+  }
+  NEXT();
+
+do_jalr:
+  STEP();
+  reg[inst->regB] = statePtr->pc;
+  statePtr->pc = reg[inst->regA];
+  NEXT();
+
+do_noop:
+  STEP();
+  NEXT();
+
+do_halt:
+  STEP();
+  return executionCount;
+
+  /*
+   * Superinstructions.  fuseRegion only forms them away from the last memory
+   * word and without a bad destReg, so the members' STEP checks cannot fire
+   * and are folded into one update.  A checkpoint (the step limit) that falls
+   * inside the group must still stop the run on its exact instruction, so
+   * then the head runs on its own handler instead.
+   */
+#define FUSED(n)                                            \
+  do                                                        \
+  {                                                         \
+    if (nextPrint && executionCount + (n) > nextPrint)      \
+      goto *labels[inst->opcode];                           \
+  } while (0)
+
+do_lw_add:
+  FUSED(2);
+  statePtr->pc += 2;
+  executionCount += 2;
+  statePtr->fuseFired[FUSE_LW_ADD]++;
+  reg[inst->regB] = memRead(&statePtr->mem, reg[inst->regA] + inst->offset);
+  reg[inst[1].dest] = reg[inst[1].regA] + reg[inst[1].regB];
+  NEXT();
+
+do_add_beq:
+  FUSED(2);
+  statePtr->pc += 2;
+  executionCount += 2;
+  statePtr->fuseFired[FUSE_ADD_BEQ]++;
+  reg[inst->dest] = reg[inst->regA] + reg[inst->regB];
+  if (reg[inst[1].regA] == reg[inst[1].regB])
+  {
+    statePtr->pc += inst[1].offset;
+    TAKEN();
+  }
+  NEXT();
+
+do_nor3:
+  FUSED(3);
+  statePtr->pc += 3;
+  executionCount += 3;
+  statePtr->fuseFired[FUSE_NOR3]++;
+  reg[inst->dest] = ~(reg[inst->regA] | reg[inst->regB]);
+  reg[inst[1].dest] = ~(reg[inst[1].regA] | reg[inst[1].regB]);
+  reg[inst[2].dest] = ~(reg[inst[2].regA] | reg[inst[2].regB]);
+  NEXT();
+
+do_badreg:
+  STEP();
+  simError("Register is not valid.");
+
+out_of_memory:
+  simError("!err! Out of memory");
+
+#undef DISPATCH
+#undef STEP
+#undef TAKEN
+#undef NEXT
+#undef FUSED
 }
 
+/*
+ * FuseKind of the superinstruction that could start at inst (the decoded
+ * entry for pc), or FUSE_NONE.  Every member must already be decoded, be a
+ * plain instruction and sit before the last memory word.
+ */
+int matchFusion(const decodedType *inst, int pc)
+{
+  int kind, i;
+
+  for (kind = FUSE_LW_ADD; kind < NUMFUSEKINDS; kind++)
+  {
+    static const int pattern[NUMFUSEKINDS][3] = {
+        [FUSE_LW_ADD] = {OP_LW, OP_ADD},
+        [FUSE_ADD_BEQ] = {OP_ADD, OP_BEQ},
+        [FUSE_NOR3] = {OP_NOR, OP_NOR, OP_NOR},
+    };
+    if (pc + fuseLength[kind] >= NUMMEMORY)
+    {
+      continue;
+    }
+    for (i = 0; i < fuseLength[kind]; i++)
+    {
+      if (!inst[i].valid || inst[i].opcode != pattern[kind][i] ||
+          inst[i].handler == badRegInst)
+      {
+        break;
+      }
+    }
+    if (i == fuseLength[kind])
+    {
+      return kind;
+    }
+  }
+  return FUSE_NONE;
+}
+
+/*
+ * Rewrite pass over the straight-line code starting at a hot branch target:
+ * every sequence matchFusion recognises gets its head pointed at the fused
+ * label.  fusedLabels is the threaded core's label table, by FuseKind.
+ */
+void fuseRegion(stateType *statePtr, int pc, void *const *fusedLabels)
+{
+  decodedType *inst;
+  int kind;
+
+  while (pc < NUMMEMORY)
+  {
+    inst = &statePtr->decoded[pc];
+    if (!inst->valid)
+    {
+      break;
+    }
+    kind = inst->fused ? inst->fused : matchFusion(inst, pc);
+    if (kind != FUSE_NONE && !inst->fused)
+    {
+      inst->fused = kind;
+      inst->target = fusedLabels[kind];
+      statePtr->fuseSites[kind]++;
+    }
+    pc += fuseLength[kind];
+    if (inst[fuseLength[kind] - 1].opcode == OP_BEQ ||
+        inst[fuseLength[kind] - 1].opcode == OP_JALR ||
+        inst[fuseLength[kind] - 1].opcode == OP_HALT)
+    {
+      break;
+    }
+  }
+}
+
+void printFusionReport(stateType *statePtr)
+{
+  int kind;
+
+  fprintf(stderr, "fusion report:\n");
+  for (kind = FUSE_LW_ADD; kind < NUMFUSEKINDS; kind++)
+  {
+    fprintf(stderr, "\t%-12s sites %d fired %lld instructions %lld\n",
+            fuseNames[kind], statePtr->fuseSites[kind], statePtr->fuseFired[kind],
+            statePtr->fuseFired[kind] * fuseLength[kind]);
+  }
+}
+#endif
+
+void printState(stateType *statePtr)
+{
+  int i;
+  writeStr(&out, "\n@@@\nstate:\n");
+  writeStr(&out, "\tpc ");
+  writeInt(&out, statePtr->pc);
+  writeStr(&out, "\n\tmemory:\n");
+  for (i = 0; i < statePtr->numMemory; i++)
+  {
+    writeStr(&out, "\t\tmem[ ");
+    writeInt(&out, i);
+    writeStr(&out, " ] ");
+    writeInt(&out, memRead(&statePtr->mem, i));
+    writeStr(&out, "\n");
+  }
+  writeStr(&out, "\tregisters:\n");
+  for (i = 0; i < NUMREGS; i++)
+  {
+    writeStr(&out, "\t\treg[ ");
+    writeInt(&out, i);
+    writeStr(&out, " ] ");
+    writeInt(&out, statePtr->reg[i]);
+    writeStr(&out, "\n");
+  }
+  writeStr(&out, "end state\n");
+  writerFlush(&out);
+}
 
 /*Chec Register Validk*/
 int isValidReg(int reg)
@@ -159,99 +847,766 @@ int isValidReg(int reg)
 
 void parseInst(stateType *statePtr, int *opcode, int *arg0, int *arg1, int *arg2)
 {
-  int memValue = statePtr->mem[statePtr->pc];
+  int memValue = memRead(&statePtr->mem, statePtr->pc);
 
-  // 25 ~ 22 bit => opcode
-  *opcode = (memValue >> 22) & 0b111;
+  // 24 ~ 22 bit => opcode
+  *opcode = instOpcode(memValue);
   //21-19 bit  => binary to arg0
-  *arg0 = (memValue >> 19) & 0b111;
+  *arg0 = instRegA(memValue);
   //18-16 bit  => binary to arg1
-  *arg1 = (memValue >> 16) & 0b111;
+  *arg1 = instRegB(memValue);
   //15-0 bit a => binary to arg2
-  *arg2 = (memValue & 0xFFFF);
+  *arg2 = instField2(memValue);
 }
 
-/**
-  OP_ADD, OP_NOR
+/*
+ * Fill in the cache entry for the word at statePtr->pc.  Register fields are
+ * 3 bits wide and always valid; only the 16-bit destReg of add/nor can name
+ * a register that does not exist, and that is reported when it executes.
  */
-void RTypeInst(stateType *statePtr, int opcode, int arg0, int arg1, int destReg)
+void decodeInst(stateType *statePtr, decodedType *inst)
 {
+  int opcode, arg0, arg1, arg2;
+  parseInst(statePtr, &opcode, &arg0, &arg1, &arg2);
 
-  if (!isValidReg(arg0) || !isValidReg(arg1) || !isValidReg(destReg))
-  {
-    printf("Register is not valid.");
-    exit(1);
-  }
+  inst->valid = 1;
+  inst->fused = FUSE_NONE;
+  inst->hits = 0;
+  inst->opcode = opcode;
+  inst->regA = arg0;
+  inst->regB = arg1;
+  inst->dest = arg2;
+  inst->offset = signExtend16(arg2);
 
   switch (opcode)
   {
-  case 0: // add
-    statePtr->reg[destReg] = statePtr->reg[arg0] + statePtr->reg[arg1];
+  case OP_ADD:
+    inst->handler = isValidReg(arg2) ? addInst : badRegInst;
+    break;
+  case OP_NOR:
+    inst->handler = isValidReg(arg2) ? norInst : badRegInst;
     break;
-  case 1: // nor
-    statePtr->reg[destReg] = ~(statePtr->reg[arg0] | statePtr->reg[arg1]);
+  case OP_LW:
+    inst->handler = lwInst;
+    break;
+  case OP_SW:
+    inst->handler = swInst;
+    break;
+  case OP_BEQ:
+    inst->handler = beqInst;
+    break;
+  case OP_JALR:
+    inst->handler = jalrInst;
+    break;
+  case OP_HALT:
+  case OP_NOOP:
+    inst->handler = noopInst;
     break;
   default:
-    printf("Do not support its opcode");
-    exit(1);
+    inst->handler = badOpcodeInst;
     break;
   }
 }
 
-/* OP_LW, OP_SW, OP_BEQ */
-void ITypeInst(stateType *statePtr, int opcode, int arg0, int arg1, int offset)
+void addInst(stateType *statePtr, const decodedType *inst)
 {
-  offset = convertSize(offset);
+  statePtr->reg[inst->dest] = statePtr->reg[inst->regA] + statePtr->reg[inst->regB];
+}
 
-  if (offset > 32767 || offset < -32768)
+void norInst(stateType *statePtr, const decodedType *inst)
+{
+  statePtr->reg[inst->dest] = ~(statePtr->reg[inst->regA] | statePtr->reg[inst->regB]);
+}
+
+void lwInst(stateType *statePtr, const decodedType *inst)
+{
+  statePtr->reg[inst->regB] = memRead(&statePtr->mem, statePtr->reg[inst->regA] + inst->offset);
+}
+
+/* the only instruction that can overwrite code, so it drops stale entries */
+void swInst(stateType *statePtr, const decodedType *inst)
+{
+  int addr = statePtr->reg[inst->regA] + inst->offset;
+  memWrite(&statePtr->mem, addr, statePtr->reg[inst->regB]);
+  if (addr >= 0 && addr < NUMMEMORY)
   {
-    printf("!err! Offset out of range");
-    exit(1);
+    statePtr->decoded[addr].valid = 0;
   }
-  if (!isValidReg(arg0) || !isValidReg(arg1))
+}
+
+void beqInst(stateType *statePtr, const decodedType *inst)
+{
+  if (statePtr->reg[inst->regA] == statePtr->reg[inst->regB])
   {
-    printf("!err! not valid Register");
-    exit(1);
+    statePtr->pc += inst->offset;
   }
-  switch (opcode)
+}
+
+void jalrInst(stateType *statePtr, const decodedType *inst)
+{
+  statePtr->reg[inst->regB] = statePtr->pc;
+  statePtr->pc = statePtr->reg[inst->regA];
+}
+
+void noopInst(stateType *statePtr, const decodedType *inst)
+{
+}
+
+void badRegInst(stateType *statePtr, const decodedType *inst)
+{
+  simError("Register is not valid.");
+}
+
+void badOpcodeInst(stateType *statePtr, const decodedType *inst)
+{
+  simError("Do not support its opcode.");
+}
+
+#ifdef HAVE_JIT_CORE
+/*
+ * Basic-block translator to x86-64.
+ *
+ * A block starts at any pc the program reaches and runs up to and including
+ * the next beq or jalr (or JIT_MAX_BLOCK instructions).  halt, add/nor with a
+ * bad destReg, and the instruction at the last memory word are never
+ * translated: the block stops in front of them and jitStep() interprets them,
+ * so every error is reported exactly as runSwitch would.  lw/sw with an
+ * address outside memory fall back to jitStep() the same way.
+ *
+ * While translated code runs, LC-2K registers live in r8d-r15d, rbp counts
+ * executed instructions (64-bit), rdi points at the memory's page table, rbx
+ * at jitBlock[] and rsi at the jitCtxType.  A sw to a page that is still
+ * shared (copy-on-write) falls back to jitStep, which gives the state its own
+ * copy.  Block exits store the next pc in the context and return to
+ * runJit(), which finds or translates the target and patches the exit's jmp
+ * to go straight there next time.  A sw that hits a translated word leaves
+ * its block right after the store and the whole cache is flushed.
+ */
+#define JIT_CODE_SIZE (1 << 22)
+#define JIT_MAX_BLOCK 128
+#define JIT_BLOCK_ROOM (JIT_MAX_BLOCK * 64 + 256) /* worst-case block size */
+
+enum JitExit
+{
+  JIT_BRANCH,   /* continue at ctx.pc; ctx.site is the jmp to patch, if any */
+  JIT_FALLBACK, /* interpret the instruction at ctx.pc */
+  JIT_SMC       /* a sw overwrote translated code; flush, continue at ctx.pc */
+};
+
+enum HostReg
+{
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8
+};
+
+typedef struct jitCtxStruct
+{
+  int reg[NUMREGS];
+  int pc;
+  int exit;
+  long long count;
+  unsigned char *site;
+  pageType **pages;
+  void **blocks;
+  unsigned char *codeMap;
+} jitCtxType;
+
+typedef struct jitStubStruct
+{
+  unsigned char *jump; /* rel32 that should reach the stub */
+  int pc;
+  int exit;
+  int count; /* instructions of the block executed before the exit */
+} jitStubType;
+
+unsigned char *jitCode, *jitCur, *jitExitCode, *jitFirstBlock;
+void (*jitEnter)(jitCtxType *, void *);
+void *jitBlock[NUMMEMORY];
+unsigned char jitCodeMap[NUMMEMORY]; /* 1 if some block translated this word */
+int jitFlushes;
+
+#define CTX(field) ((int)offsetof(jitCtxType, field))
+
+void emit8(int byte)
+{
+  *jitCur++ = (unsigned char)byte;
+}
+
+void emit32(int value)
+{
+  memcpy(jitCur, &value, 4);
+  jitCur += 4;
+}
+
+void emitRex(int w, int reg, int rm)
+{
+  int rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (rex != 0x40)
+    emit8(rex);
+}
+
+/* op r/m32, r32 (mov 89, add 01, or 09, cmp 39) between two registers */
+void emitRR(int op, int dst, int src)
+{
+  emitRex(0, src, dst);
+  emit8(op);
+  emit8(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+/* op r32, [rsi + disp32] (load 8B) or op [rsi + disp32], r32 (store 89) */
+void emitCtx(int w, int op, int reg, int disp)
+{
+  emitRex(w, reg, RSI);
+  emit8(op);
+  emit8(0x80 | ((reg & 7) << 3) | RSI);
+  emit32(disp);
+}
+
+void emitCtxImm(int w, int disp, int imm)
+{
+  emitRex(w, 0, RSI);
+  emit8(0xC7);
+  emit8(0x80 | RSI);
+  emit32(disp);
+  emit32(imm);
+}
+
+/* add rbp, imm32: the instruction count, which is 64-bit */
+void emitCount(int n)
+{
+  emitRex(1, 0, RBP);
+  emit8(0x81);
+  emit8(0xC0 | (RBP & 7));
+  emit32(n);
+}
+
+/* 81 /ext r32, imm32 (add /0, cmp /7) */
+void emitImm(int ext, int reg, int imm)
+{
+  emitRex(0, 0, reg);
+  emit8(0x81);
+  emit8(0xC0 | (ext << 3) | (reg & 7));
+  emit32(imm);
+}
+
+void emitMovImm(int reg, int imm)
+{
+  emitRex(0, 0, reg);
+  emit8(0xB8 | (reg & 7));
+  emit32(imm);
+}
+
+/*
+ * Split the in-range address in eax into its page, in rcx, and the word in
+ * the page, in eax:  mov ecx, eax; shr ecx, MEM_PAGEBITS;
+ * mov rcx, [rdi + rcx*8]; and eax, MEM_PAGEWORDS - 1
+ */
+void emitPage(void)
+{
+  emitRR(0x89, RCX, RAX);
+  emit8(0xC1);
+  emit8(0xE9);
+  emit8(MEM_PAGEBITS);
+  emit8(0x48);
+  emit8(0x8B);
+  emit8(0x0C);
+  emit8(0xCF);
+  emitImm(4, RAX, MEM_PAGEWORDS - 1);
+}
+
+/* mov r32, [rcx + rax*4 + words] (8B) or mov [rcx + rax*4 + words], r32 (89) */
+void emitMem(int op, int reg)
+{
+  emitRex(0, reg, 0);
+  emit8(op);
+  emit8(0x84 | ((reg & 7) << 3));
+  emit8(0x81);
+  emit32((int)offsetof(pageType, words));
+}
+
+/* jmp rel32 (cc < 0) or jcc rel32; returns the rel32 to patch */
+unsigned char *emitJump(int cc)
+{
+  if (cc < 0)
   {
-  case 2:
-    statePtr->reg[arg1] = statePtr->mem[statePtr->reg[arg0] + offset];
-    break;
-  case 3:
-    statePtr->mem[statePtr->reg[arg0] + offset] = statePtr->reg[arg1];
-    break;
-  case 4:
-    if (statePtr->reg[arg0] == statePtr->reg[arg1])
+    emit8(0xE9);
+  }
+  else
+  {
+    emit8(0x0F);
+    emit8(0x80 | cc);
+  }
+  jitCur += 4;
+  return jitCur - 4;
+}
+
+void patchJump(unsigned char *site, const unsigned char *target)
+{
+  int rel = (int)(target - (site + 4));
+  memcpy(site, &rel, 4);
+}
+
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+
+int hostReg(int lc2kReg)
+{
+  return R8 + lc2kReg;
+}
+
+/* enter: save callee-saved registers, load the context, jump to the block */
+void emitTrampoline(void)
+{
+  int i;
+
+  jitEnter = (void (*)(jitCtxType *, void *))jitCur;
+  emit8(0x53);             /* push rbx */
+  emit8(0x55);             /* push rbp */
+  for (i = 4; i < 8; i++)  /* push r12-r15 */
+  {
+    emit8(0x41);
+    emit8(0x50 | i);
+  }
+  emit8(0x48);             /* mov rax, rsi */
+  emit8(0x89);
+  emit8(0xF0);
+  emit8(0x48);             /* mov rsi, rdi */
+  emit8(0x89);
+  emit8(0xFE);
+  emitCtx(1, 0x8B, RDI, CTX(pages));
+  emitCtx(1, 0x8B, RBX, CTX(blocks));
+  emitCtx(1, 0x8B, RBP, CTX(count));
+  for (i = 0; i < NUMREGS; i++)
+    emitCtx(0, 0x8B, hostReg(i), CTX(reg) + 4 * i);
+  emit8(0xFF);             /* jmp rax */
+  emit8(0xE0);
+
+  /* exit: everything but pc/exit/site, which the stub already stored */
+  jitExitCode = jitCur;
+  for (i = 0; i < NUMREGS; i++)
+    emitCtx(0, 0x89, hostReg(i), CTX(reg) + 4 * i);
+  emitCtx(1, 0x89, RBP, CTX(count));
+  for (i = 7; i >= 4; i--) /* pop r15-r12 */
+  {
+    emit8(0x41);
+    emit8(0x58 | i);
+  }
+  emit8(0x5D);             /* pop rbp */
+  emit8(0x5B);             /* pop rbx */
+  emit8(0xC3);             /* ret */
+}
+
+void emitStub(const jitStubType *stub)
+{
+  patchJump(stub->jump, jitCur);
+  if (stub->count)
+    emitCount(stub->count);
+  emitCtxImm(0, CTX(pc), stub->pc);
+  emitCtxImm(0, CTX(exit), stub->exit);
+  if (stub->exit == JIT_BRANCH)
+  {
+    /* mov rcx, imm64 jump site; mov [rsi + site], rcx */
+    unsigned long long site = (unsigned long long)stub->jump;
+    emit8(0x48);
+    emit8(0xB9);
+    memcpy(jitCur, &site, 8);
+    jitCur += 8;
+    emitCtx(1, 0x89, RCX, CTX(site));
+  }
+  else
+  {
+    emitCtxImm(1, CTX(site), 0);
+  }
+  patchJump(emitJump(-1), jitExitCode);
+}
+
+void jitFlush(void)
+{
+  jitCur = jitFirstBlock;
+  memset(jitBlock, 0, sizeof(jitBlock));
+  memset(jitCodeMap, 0, sizeof(jitCodeMap));
+  jitFlushes++;
+}
+
+int jitInit(void)
+{
+  jitCode = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jitCode == MAP_FAILED)
+  {
+    return 0;
+  }
+  jitCur = jitCode;
+  emitTrampoline();
+  jitFirstBlock = jitCur;
+  return 1;
+}
+
+/* whether the instruction at pc can be part of translated code */
+int jitCanTranslate(stateType *statePtr, int pc)
+{
+  int memValue = memRead(&statePtr->mem, pc);
+  int opcode = instOpcode(memValue);
+
+  if (pc >= NUMMEMORY - 1 || opcode == OP_HALT)
+    return 0;
+  if ((opcode == OP_ADD || opcode == OP_NOR) && !isValidReg(instField2(memValue)))
+    return 0;
+  return 1;
+}
+
+/* translate the block starting at startPc; NULL if its first word can't be */
+void *jitTranslate(stateType *statePtr, int startPc)
+{
+  jitStubType stubs[2 * JIT_MAX_BLOCK + 2];
+  int numStubs = 0, n, pc, i;
+  unsigned char *entry;
+
+  if (startPc < 0 || startPc >= NUMMEMORY || !jitCanTranslate(statePtr, startPc))
+  {
+    return NULL;
+  }
+  if (jitCode + JIT_CODE_SIZE - jitCur < JIT_BLOCK_ROOM)
+  {
+    jitFlush();
+  }
+  entry = jitCur;
+
+  for (pc = startPc, n = 0; ; pc++)
+  {
+    int memValue = memRead(&statePtr->mem, pc);
+    int opcode = instOpcode(memValue);
+    int a = hostReg(instRegA(memValue));
+    int b = hostReg(instRegB(memValue));
+    int offset = signExtend16(instField2(memValue));
+
+    if (n == JIT_MAX_BLOCK || !jitCanTranslate(statePtr, pc))
     {
-      statePtr->pc += offset;
+      /* fall into the next block */
+      emitCount(n);
+      stubs[numStubs++] = (jitStubType){emitJump(-1), pc, JIT_BRANCH, 0};
+      break;
+    }
+    jitCodeMap[pc] = 1;
+    n++;
+
+    switch (opcode)
+    {
+    case OP_ADD:
+    case OP_NOR:
+      emitRR(0x89, RAX, a);
+      emitRR(opcode == OP_ADD ? 0x01 : 0x09, RAX, b);
+      if (opcode == OP_NOR)
+      {
+        emit8(0xF7); /* not eax */
+        emit8(0xD0);
+      }
+      emitRR(0x89, hostReg(instField2(memValue)), RAX);
+      break;
+    case OP_LW:
+    case OP_SW:
+      emitRR(0x89, RAX, a);
+      emitImm(0, RAX, offset);
+      emitImm(7, RAX, NUMMEMORY);
+      stubs[numStubs++] = (jitStubType){emitJump(CC_AE), pc, JIT_FALLBACK, n - 1};
+      if (opcode == OP_LW)
+      {
+        emitPage();
+        emitMem(0x8B, b);
+        break;
+      }
+      emitRR(0x89, RDX, RAX);
+      emitPage();
+      /* cmp dword [rcx + refs], 1: a shared page is copied by jitStep */
+      emit8(0x83);
+      emit8(0xB9);
+      emit32((int)offsetof(pageType, refs));
+      emit8(1);
+      stubs[numStubs++] = (jitStubType){emitJump(CC_NE), pc, JIT_FALLBACK, n - 1};
+      emitMem(0x89, b);
+      /* mov rcx, [rsi + codeMap]; cmp byte [rcx + rdx], 0; jne smc */
+      emitCtx(1, 0x8B, RCX, CTX(codeMap));
+      emit8(0x80);
+      emit8(0x3C);
+      emit8(0x11);
+      emit8(0x00);
+      stubs[numStubs++] = (jitStubType){emitJump(CC_NE), pc + 1, JIT_SMC, n};
+      break;
+    case OP_BEQ:
+      emitCount(n);
+      emitRR(0x39, a, b);
+      {
+        unsigned char *notTaken = emitJump(CC_NE);
+        stubs[numStubs++] = (jitStubType){emitJump(-1), pc + 1 + offset, JIT_BRANCH, 0};
+        patchJump(notTaken, jitCur);
+        stubs[numStubs++] = (jitStubType){emitJump(-1), pc + 1, JIT_BRANCH, 0};
+      }
+      break;
+    case OP_JALR:
+      if (a == b)
+      {
+        emitMovImm(RAX, pc + 1);
+      }
+      else
+      {
+        emitRR(0x89, RAX, a);
+      }
+      emitMovImm(b, pc + 1);
+      emitCount(n);
+      /* jump through jitBlock[eax] when it is in range and translated */
+      emitImm(7, RAX, NUMMEMORY);
+      {
+        unsigned char *outside = emitJump(CC_AE);
+        unsigned char *missing;
+        emit8(0x48); /* mov rcx, [rbx + rax*8] */
+        emit8(0x8B);
+        emit8(0x0C);
+        emit8(0xC3);
+        emit8(0x48); /* test rcx, rcx */
+        emit8(0x85);
+        emit8(0xC9);
+        missing = emitJump(CC_E);
+        emit8(0xFF); /* jmp rcx */
+        emit8(0xE1);
+        patchJump(outside, jitCur);
+        patchJump(missing, jitCur);
+      }
+      emitCtx(0, 0x89, RAX, CTX(pc));
+      emitCtxImm(0, CTX(exit), JIT_BRANCH);
+      emitCtxImm(1, CTX(site), 0);
+      patchJump(emitJump(-1), jitExitCode);
+      break;
+    default: /* OP_NOOP */
+      break;
+    }
+    if (opcode == OP_BEQ || opcode == OP_JALR)
+    {
+      break;
     }
-    break;
-  default:
-    printf("Do not support its opcode");
-    exit(1);
-    break;
   }
+
+  for (i = 0; i < numStubs; i++)
+  {
+    emitStub(&stubs[i]);
+  }
+  jitBlock[startPc] = entry;
+  return entry;
 }
 
-/* JALR */
-void JTypeInst(stateType *statePtr, int opcode, int arg0, int arg1)
+/* one interpreted instruction, exactly like an iteration of runSwitch */
+int jitStep(stateType *statePtr, long long *executionCount)
 {
-  if (!isValidReg(arg0) || !isValidReg(arg1))
+  decodedType inst;
+
+  if (statePtr->pc >= NUMMEMORY || statePtr->pc < 0)
   {
-    printf("Register is not valid.");
-    exit(1);
+    simError("!err! Out of memory");
   }
+  decodeInst(statePtr, &inst);
 
-  switch (opcode)
+  statePtr->pc++;
+  (*executionCount)++;
+
+  if (statePtr->pc >= NUMMEMORY || statePtr->pc < 0 )
   {
-  case 5:
-    statePtr->reg[arg1] = statePtr->pc;
-    statePtr->pc = statePtr->reg[arg0];
-    break;
-  default:
-    printf("Do not support its opcode");
+    simError("!err! Out of memory");
+  }
+
+  if (inst.opcode == OP_HALT)
+  {
+    return 1;
+  }
+  if (inst.opcode == OP_SW)
+  {
+    int addr = statePtr->reg[inst.regA] + inst.offset;
+    if (addr >= 0 && addr < NUMMEMORY && jitCodeMap[addr])
+    {
+      jitFlush();
+    }
+  }
+  inst.handler(statePtr, &inst);
+  return 0;
+}
+
+/*
+ * Translated core, used only when nothing but the final state is printed.
+ * Falls back to the threaded/switch core if executable memory is refused.
+ */
+long long runJit(stateType *statePtr)
+{
+  jitCtxType ctx;
+  void *entry;
+  int flushes;
+
+  if (!jitInit())
+  {
+#ifdef HAVE_THREADED_CORE
+    return runThreaded(statePtr);
+#else
+    return runSwitch(statePtr);
+#endif
+  }
+  memset(&ctx, 0, sizeof(ctx));
+  memcpy(ctx.reg, statePtr->reg, sizeof(ctx.reg));
+  ctx.pc = statePtr->pc;
+  ctx.exit = JIT_BRANCH;
+  ctx.pages = statePtr->mem.pages;
+  ctx.blocks = jitBlock;
+  ctx.codeMap = jitCodeMap;
+
+  while (1)
+  {
+    entry = NULL;
+    if (ctx.exit != JIT_FALLBACK && ctx.pc >= 0 && ctx.pc < NUMMEMORY)
+    {
+      flushes = jitFlushes;
+      if ((entry = jitBlock[ctx.pc]) == NULL)
+      {
+        entry = jitTranslate(statePtr, ctx.pc);
+      }
+      if (entry != NULL && ctx.site != NULL && flushes == jitFlushes)
+      {
+        patchJump(ctx.site, entry);
+      }
+    }
+    if (entry == NULL)
+    {
+      memcpy(statePtr->reg, ctx.reg, sizeof(ctx.reg));
+      statePtr->pc = ctx.pc;
+      if (jitStep(statePtr, &ctx.count))
+      {
+        return ctx.count;
+      }
+      memcpy(ctx.reg, statePtr->reg, sizeof(ctx.reg));
+      ctx.pc = statePtr->pc;
+      ctx.exit = JIT_BRANCH;
+      ctx.site = NULL;
+      continue;
+    }
+    jitEnter(&ctx, entry);
+    if (ctx.exit == JIT_SMC)
+    {
+      jitFlush();
+      ctx.exit = JIT_BRANCH;
+    }
+  }
+}
+#endif
+
+/*
+ * Batch mode: run every job of a manifest (see common/batch.h) on the
+ * work-stealing pool.  Each worker reuses one machine state and decoded
+ * cache; jobs never print, and a simulation error only fails its own job.
+ * The translator keeps process-wide state, so jobs use the threaded core
+ * (the switch core with --core=switch).
+ */
+typedef struct batchRunStruct
+{
+  batchType batch;
+  stateType **states;
+  int stepLimit;
+  int core;
+} batchRunType;
+
+void runBatchJob(void *arg, int worker, int jobNum)
+{
+  batchRunType *run = arg;
+  batchJobType *job = &run->batch.jobs[jobNum];
+  batchImageType *image = &run->batch.images[job->image];
+  stateType *volatile statePtr = run->states[worker]; /* assigned before setjmp, read after */
+  decodedType *decoded;
+  jmp_buf abortJob;
+  int i;
+
+  if (image->error != NULL)
+  {
+    job->error = image->error;
+    return;
+  }
+  if (statePtr == NULL)
+  {
+    statePtr = run->states[worker] = malloc(sizeof(stateType));
+    decoded = calloc(NUMMEMORY, sizeof(decodedType));
+    if (statePtr == NULL || decoded == NULL)
+    {
+      printf("error: out of memory\n");
+      exit(1);
+    }
+    statePtr->decoded = decoded;
+  }
+  decoded = statePtr->decoded;
+  memset(statePtr, 0, offsetof(stateType, decoded));
+  memSnapshot(&statePtr->mem, &image->mem);
+  memset(statePtr->fuseSites, 0, sizeof(statePtr->fuseSites));
+  memset(statePtr->fuseFired, 0, sizeof(statePtr->fuseFired));
+  for (i = 0; i < NUMMEMORY; i++)
+  {
+    decoded[i].valid = 0;
+  }
+  statePtr->numMemory = image->numWords;
+  statePtr->stepLimit = run->stepLimit;
+  for (i = 0; i < job->numOverrides; i++)
+  {
+    if (job->overrides[i].isMem)
+    {
+      memWrite(&statePtr->mem, job->overrides[i].index, job->overrides[i].value);
+    }
+    else
+    {
+      statePtr->reg[job->overrides[i].index] = job->overrides[i].value;
+    }
+  }
+
+  jobAbort = &abortJob;
+  if (setjmp(abortJob) == 0)
+  {
+#ifdef HAVE_THREADED_CORE
+    job->count = run->core == CORE_SWITCH ? runSwitch(statePtr) : runThreaded(statePtr);
+#else
+    job->count = runSwitch(statePtr);
+#endif
+  }
+  else
+  {
+    job->error = jobError;
+  }
+  jobAbort = NULL;
+
+  job->pc = statePtr->pc;
+  memcpy(job->reg, statePtr->reg, sizeof(job->reg));
+  job->memHash = batchHash(&statePtr->mem, statePtr->numMemory);
+  memFree(&statePtr->mem);
+}
+
+int runBatch(const char *manifest, int numThreads, int stepLimit, int core)
+{
+  batchRunType run;
+  int i;
+
+  readManifest(manifest, &run.batch, NUMMEMORY);
+  if (numThreads == 0)
+  {
+    numThreads = poolDefaultWorkers();
+  }
+  run.states = calloc(numThreads, sizeof(stateType *));
+  if (run.states == NULL)
+  {
+    printf("error: out of memory\n");
     exit(1);
-    break;
   }
+  run.stepLimit = stepLimit;
+  run.core = core;
+  runPool(run.batch.numJobs, numThreads, runBatchJob, &run);
+  writeBatchRecords(&run.batch, "instructions");
+
+  for (i = 0; i < numThreads; i++)
+  {
+    if (run.states[i] != NULL)
+    {
+      free(run.states[i]->decoded);
+      free(run.states[i]);
+    }
+  }
+  free(run.states);
+  return 0;
 }
@@ -0,0 +1,14 @@
+	lw	0	1	count	$1 = 100
+	lw	0	2	neg1	$2 = -1
+loop	lw	0	3	step	lw + add
+	add	4	3	4	$4 += 3
+	nor	4	4	5	nor x3
+	nor	5	3	6
+	nor	6	6	7
+	add	1	2	1	add + beq
+	beq	1	0	done
+	beq	0	0	loop
+done	halt
+count	.fill	100
+neg1	.fill	-1
+step	.fill	3
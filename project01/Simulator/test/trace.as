@@ -0,0 +1,24 @@
+	lw	0	1	count	$1 = 30
+	lw	0	2	neg1	$2 = -1
+	lw	0	3	one	$3 = 1
+	lw	0	4	tabAdr	$4 = table, past the image
+loop	sw	4	1	0	table[i] = $1
+	add	4	3	4
+	add	1	2	1
+	beq	1	0	sum
+	beq	0	0	loop
+sum	lw	0	4	tabAdr
+	lw	0	1	count
+sloop	lw	4	6	0	$5 += table[i]
+	add	5	6	5
+	add	4	3	4
+	add	1	2	1
+	beq	1	0	done
+	beq	0	0	sloop
+done	sw	0	5	total	465
+	halt
+count	.fill	30
+neg1	.fill	-1
+one	.fill	1
+tabAdr	.fill	100
+total	.fill	0
@@ -0,0 +1,239 @@
+/* LC-2K trace replay: states and steps from a simulator --trace file */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../../common/lc2k.h"
+#include "../../common/writer.h"
+#include "../../common/trace.h"
+
+enum Mode
+{
+  MODE_SUMMARY,
+  MODE_STATES, /* -n: the simulator's output, from the trace */
+  MODE_STATE,  /* --state: one state */
+  MODE_LIST    /* --list: one line a step */
+};
+
+writerType out;
+
+void printState(const traceReaderType *tr);
+void printStep(const traceReaderType *tr);
+void printSummary(const traceReaderType *tr, const char *fileName);
+void replayError(const traceReaderType *tr);
+
+int main(int argc, char *argv[])
+{
+  static traceReaderType trace;
+  FILE *filePtr;
+  int mode = MODE_SUMMARY, every = 0, i;
+  long long step = 0, count = 0, next;
+
+  for (i = 1; i < argc - 1; i++)
+  {
+    if (!strcmp(argv[i], "-n") && i + 2 < argc && atoi(argv[i + 1]) > 0)
+    {
+      mode = MODE_STATES;
+      every = atoi(argv[++i]);
+    }
+    else if (!strncmp(argv[i], "--state=", 8) && sscanf(argv[i] + 8, "%lld", &step) == 1)
+    {
+      mode = MODE_STATE;
+    }
+    else if (!strncmp(argv[i], "--list=", 7)
+             && sscanf(argv[i] + 7, "%lld:%lld", &step, &count) == 2 && count > 0)
+    {
+      mode = MODE_LIST;
+    }
+    else
+    {
+      break;
+    }
+  }
+  if (i != argc - 1)
+  {
+    printf("error: usage: %s [-n steps | --state=step | --list=from:count] <trace file>\n",
+           argv[0]);
+    printf("       no option summarizes the trace; -n prints what the simulator printed\n");
+    exit(1);
+  }
+
+  filePtr = fopen(argv[i], "rb");
+  if (filePtr == NULL)
+  {
+    printf("error: can't open file %s\n", argv[i]);
+    exit(1);
+  }
+  if (traceOpen(&trace, filePtr) < 0)
+  {
+    printf("error: %s: %s\n", argv[i], trace.error);
+    exit(1);
+  }
+  outputInit();
+  writerInit(&out, stdout);
+
+  switch (mode)
+  {
+  case MODE_SUMMARY:
+    printSummary(&trace, argv[i]);
+    break;
+  case MODE_STATE:
+    if (traceSeek(&trace, step) < 0)
+    {
+      replayError(&trace);
+    }
+    printState(&trace);
+    break;
+  case MODE_LIST:
+    if (traceSeek(&trace, step) < 0)
+    {
+      replayError(&trace);
+    }
+    for (; count > 0 && trace.step < trace.steps; count--)
+    {
+      if (traceNext(&trace) < 0)
+      {
+        replayError(&trace);
+      }
+      printStep(&trace);
+    }
+    writerFlush(&out);
+    break;
+  case MODE_STATES:
+    /* as the simulator's -n: the image, then the states every `every` steps */
+    for (i = 0; i < trace.numMemory; i++)
+    {
+      printf("memory[%d]=%d\n", i, trace.image[i]);
+    }
+    printState(&trace);
+    for (next = every; next < trace.steps || (next == trace.steps && trace.status != TRACE_HALTED);
+         next += every)
+    {
+      if (traceSeek(&trace, next) < 0)
+      {
+        replayError(&trace);
+      }
+      printState(&trace);
+    }
+    if (traceSeek(&trace, trace.steps) < 0)
+    {
+      replayError(&trace);
+    }
+    if (trace.status == TRACE_HALTED)
+    {
+      printf("machine halted\n");
+      printf("total of %lld instructions executed\n", trace.steps);
+      printf("final state of machine:\n");
+      printState(&trace);
+    }
+    else
+    {
+      printf("the run stopped on an error after %lld instructions\n", trace.steps);
+    }
+    break;
+  }
+  traceClose(&trace);
+  fclose(filePtr);
+  exit(0);
+}
+
+void replayError(const traceReaderType *tr)
+{
+  writerFlush(&out);
+  printf("error: %s at step %lld\n", tr->error, tr->step);
+  exit(1);
+}
+
+/* the simulator's printState(), for the replay's state */
+void printState(const traceReaderType *tr)
+{
+  int i;
+
+  writeStr(&out, "\n@@@\nstate:\n");
+  writeStr(&out, "\tpc ");
+  writeInt(&out, tr->context.pc);
+  writeStr(&out, "\n\tmemory:\n");
+  for (i = 0; i < tr->numMemory; i++)
+  {
+    writeStr(&out, "\t\tmem[ ");
+    writeInt(&out, i);
+    writeStr(&out, " ] ");
+    writeInt(&out, tr->context.mem[i]);
+    writeStr(&out, "\n");
+  }
+  writeStr(&out, "\tregisters:\n");
+  for (i = 0; i < TRACE_NUMREGS; i++)
+  {
+    writeStr(&out, "\t\treg[ ");
+    writeInt(&out, i);
+    writeStr(&out, " ] ");
+    writeInt(&out, tr->context.reg[i]);
+    writeStr(&out, "\n");
+  }
+  writeStr(&out, "end state\n");
+  writerFlush(&out);
+}
+
+/* "<step> <pc>: <instruction>[ reg[r]=v][ mem[a]=v][ -> pc]", for the step just replayed */
+void printStep(const traceReaderType *tr)
+{
+  const traceStepType *step = &tr->last;
+  int instr = step->instr;
+
+  writeLongLong(&out, tr->step - 1);
+  writeStr(&out, " ");
+  writeInt(&out, step->pc);
+  writeStr(&out, ": ");
+  writeStr(&out, opTable[instOpcode(instr)].name);
+  writeStr(&out, " ");
+  writeInt(&out, instRegA(instr));
+  writeStr(&out, " ");
+  writeInt(&out, instRegB(instr));
+  writeStr(&out, " ");
+  writeInt(&out, instOpcode(instr) == OP_ADD || instOpcode(instr) == OP_NOR
+                     ? instField2(instr) : signExtend16(instField2(instr)));
+  if (step->reg >= 0)
+  {
+    writeStr(&out, " reg[");
+    writeInt(&out, step->reg);
+    writeStr(&out, "]=");
+    writeInt(&out, step->regValue);
+  }
+  if (step->addr >= 0)
+  {
+    writeStr(&out, " mem[");
+    writeInt(&out, step->addr);
+    writeStr(&out, "]=");
+    writeInt(&out, step->memValue);
+  }
+  if (step->next != step->pc + 1)
+  {
+    writeStr(&out, " -> ");
+    writeInt(&out, step->next);
+  }
+  writeStr(&out, "\n");
+}
+
+void printSummary(const traceReaderType *tr, const char *fileName)
+{
+  long long raw = 0, stored = 0;
+  unsigned char sizes[8];
+  int b;
+
+  for (b = 0; b < tr->numBlocks; b++)
+  {
+    if (fseek(tr->fp, tr->index[b].offset, SEEK_SET) == 0 && fread(sizes, 1, 8, tr->fp) == 8)
+    {
+      raw += traceGet(sizes, 4);
+      stored += traceGet(sizes + 4, 4);
+    }
+  }
+  printf("%s: %lld steps, %s\n", fileName, tr->steps,
+         tr->status == TRACE_HALTED ? "halted" : "stopped on an error");
+  printf("\t%d blocks of %d steps, %s\n", tr->numBlocks, tr->blockSteps,
+         tr->flags & TRACE_COMPRESSED ? "compressed" : "uncompressed");
+  printf("\timage %d words\n", tr->numMemory);
+  printf("\tsteps %lld bytes (%lld before compression), %.2f bytes per step\n", stored, raw,
+         tr->steps ? (double)stored / tr->steps : 0.0);
+  printf("\tfile %lld bytes\n", tr->fileSize);
+}
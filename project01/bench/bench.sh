@@ -0,0 +1,76 @@
+#!/bin/bash
+#
+# Assembler benchmarks on generated sources.
+#
+#   bench/bench.sh [revision]
+#
+# Builds the assembler in this tree and, given a git revision, the one at
+# that revision too, then prints the best of three wall-clock times for
+# each.  The baseline assembler caps labels at MAX_INSTRUCTION, so the cap
+# is raised before it is built; its label lookup is quadratic, so it only
+# runs the sizes up to OLD_LABELS (100000 by default).
+#
+# labels  assembles genlabels sources with 10k, 100k and 1M labels.
+# lexer   assembles a gensource file of SOURCE_LINES lines (2M, about
+#         37 MB) and reports lines per second.  A revision older than the
+#         label hash table spends minutes on its labels instead of lexing;
+#         OLD_SOURCE_LINES=0 skips the old assembler there.
+
+set -e
+cd "$(dirname "$0")/.."
+ROOT=$(git rev-parse --show-toplevel)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+OLD_LABELS=${OLD_LABELS:-100000}
+SOURCE_LINES=${SOURCE_LINES:-2000000}
+OLD_SOURCE_LINES=${OLD_SOURCE_LINES:-$SOURCE_LINES}
+
+gcc -O2 bench/genlabels.c -o "$WORK/genlabels"
+gcc -O2 bench/gensource.c -o "$WORK/gensource"
+gcc -O2 Assembler/assembler.c -o "$WORK/new" -pthread
+if [ -n "$1" ]; then
+  mkdir "$WORK/old-tree"
+  git -C "$ROOT" archive "$1" | tar -x -C "$WORK/old-tree"
+  sed -i 's/^#define MAX_INSTRUCTION .*/#define MAX_INSTRUCTION 1000001/' \
+    "$WORK/old-tree/project01/Assembler/assembler.c"
+  gcc -O2 "$WORK/old-tree/project01/Assembler/assembler.c" -o "$WORK/old" -pthread
+fi
+
+# best of three runs of "$@", in seconds
+best() {
+  local i t min=
+  for i in 1 2 3; do
+    t=$( { TIMEFORMAT=%R; time "$@" > /dev/null 2>&1; } 2>&1 )
+    if [ -z "$min" ] || awk "BEGIN { exit !($t < $min) }"; then
+      min=$t
+    fi
+  done
+  echo "$min"
+}
+
+echo "labels      new        old"
+for n in 10000 100000 1000000; do
+  "$WORK/genlabels" $n > "$WORK/labels.as"
+  new=$(best "$WORK/new" "$WORK/labels.as" "$WORK/out.mc")
+  old=
+  if [ -x "$WORK/old" ] && [ $n -le "$OLD_LABELS" ]; then
+    old=$(best "$WORK/old" "$WORK/labels.as" "$WORK/out.mc")s
+  fi
+  printf "%-11s %-10s %s\n" $n "${new}s" "${old:--}"
+done
+
+# lines per second for a time
+rate() {
+  awk "BEGIN { printf \"%.1fM lines/s\", $SOURCE_LINES / $1 / 1e6 }"
+}
+
+echo
+echo "lexer       new                        old"
+"$WORK/gensource" $SOURCE_LINES > "$WORK/source.as"
+new=$(best "$WORK/new" "$WORK/source.as" "$WORK/out.mc")
+old=
+if [ -x "$WORK/old" ] && [ $SOURCE_LINES -le "$OLD_SOURCE_LINES" ]; then
+  old=$(best "$WORK/old" "$WORK/source.as" "$WORK/out.mc")
+  old="${old}s ($(rate $old))"
+fi
+printf "%-11s %-26s %s\n" $SOURCE_LINES "${new}s ($(rate $new))" "${old:--}"
@@ -0,0 +1,33 @@
+/* Synthetic LC-2K source for the label table benchmark: n lines, one label each */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+int main(int argc, char *argv[])
+{
+  long n, i;
+
+  if (argc != 2 || (n = atol(argv[1])) <= 0)
+  {
+    printf("error: usage: %s <labels>\n", argv[0]);
+    exit(1);
+  }
+
+  /*
+   * Every line defines L<i> and refers to a label spread over the whole
+   * program, so each lookup lands far from the last one and most of them
+   * are forward references.
+   */
+  for (i = 0; i < n; i++)
+  {
+    if (i % 2 == 0)
+    {
+      printf("L%ld\t.fill\tL%ld\n", i, (i * 4649 + 17) % n);
+    }
+    else
+    {
+      printf("L%ld\tlw\t0\t1\tL%ld\n", i, (i * 7919) % n);
+    }
+  }
+  exit(0);
+}
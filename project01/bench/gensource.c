@@ -0,0 +1,39 @@
+/* Synthetic LC-2K source for the lexer benchmark: n lines of every format */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+int main(int argc, char *argv[])
+{
+  long n, i;
+
+  if (argc != 2 || (n = atol(argv[1])) <= 0)
+  {
+    printf("error: usage: %s <lines>\n", argv[0]);
+    exit(1);
+  }
+
+  /* groups of five: a labelled lw with a comment, add, beq, nor, .fill */
+  for (i = 0; i < n; i++)
+  {
+    switch (i % 5)
+    {
+    case 0:
+      printf("L%ld\tlw\t0\t1\tL%ld\tcomment here\n", i, (i * 7) % n / 5 * 5);
+      break;
+    case 1:
+      printf("\tadd\t1\t2\t3\n");
+      break;
+    case 2:
+      printf("\tbeq\t0\t1\t-5\n");
+      break;
+    case 3:
+      printf("\tnor\t4\t5\t6\n");
+      break;
+    default:
+      printf("D%ld\t.fill\t%ld\n", i, i * 3);
+      break;
+    }
+  }
+  exit(0);
+}
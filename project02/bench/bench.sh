@@ -0,0 +1,75 @@
+#!/bin/bash
+#
+# Pipeline simulator cycle throughput on hazard-heavy programs.
+#
+#   bench/bench.sh [revision]
+#
+# Builds the simulator in this tree and, given a git revision, the one at
+# that revision too (it needs -q and --batch), then prints the best of
+# three wall-clock times for each.  Programs are assembled with this
+# tree's assembler.
+#
+# hazard.as    32M cycles of forwarding, load-use stalls and squashes
+# multiply.as  17M cycles of a shift-and-add multiply
+# test04.mc and test05.mc, each run JOBS times (100000) from one --batch
+# manifest, so job setup weighs as much as the cycles.
+
+set -e
+cd "$(dirname "$0")/.."
+ROOT=$(git rev-parse --show-toplevel)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+JOBS=${JOBS:-100000}
+
+gcc -O2 "$ROOT/project01/Assembler/assembler.c" -o "$WORK/assembler" -pthread
+gcc -O2 simulator.c -o "$WORK/new" -pthread -lm
+if [ -n "$1" ]; then
+  mkdir "$WORK/old-tree"
+  git -C "$ROOT" archive "$1" | tar -x -C "$WORK/old-tree"
+  gcc -O2 "$WORK/old-tree/project02/simulator.c" -o "$WORK/old" -pthread -lm
+fi
+"$WORK/assembler" bench/hazard.as "$WORK/hazard.mc"
+"$WORK/assembler" bench/multiply.as "$WORK/multiply.mc"
+for t in test04 test05; do
+  yes "$PWD/$t.mc" | head -n $JOBS > "$WORK/$t.jobs"
+done
+
+# best of three runs of "$@", in seconds
+best() {
+  local i t min=
+  for i in 1 2 3; do
+    t=$( { TIMEFORMAT=%R; time "$@" > /dev/null 2>&1; } 2>&1 )
+    if [ -z "$min" ] || awk "BEGIN { exit !($t < $min) }"; then
+      min=$t
+    fi
+  done
+  echo "$min"
+}
+
+# cycles of one -q run, and millions of them per second for a time
+cycles() {
+  "$WORK/new" -q "$1" | awk '/cycles executed/ { print $3 }'
+}
+rate() {
+  awk "BEGIN { printf \"%.0f Mcycles/s\", $1 / $2 / 1e6 }"
+}
+
+printf "%-20s %-26s %s\n" program new old
+for p in hazard multiply; do
+  n=$(cycles "$WORK/$p.mc")
+  new=$(best "$WORK/new" -q "$WORK/$p.mc")
+  old=
+  if [ -x "$WORK/old" ]; then
+    old=$(best "$WORK/old" -q "$WORK/$p.mc")
+    old="${old}s ($(rate $n $old))"
+  fi
+  printf "%-20s %-26s %s\n" $p.mc "${new}s ($(rate $n $new))" "${old:--}"
+done
+for t in test04 test05; do
+  new=$(best "$WORK/new" --batch "$WORK/$t.jobs")
+  old=
+  if [ -x "$WORK/old" ]; then
+    old=$(best "$WORK/old" --batch "$WORK/$t.jobs")s
+  fi
+  printf "%-20s %-26s %s\n" "$t.mc x $JOBS" "${new}s" "${old:--}"
+done
@@ -0,0 +1,19 @@
+	lw	0	1	cnt
+	lw	0	2	neg1
+	lw	0	3	one
+loop	add	1	2	1	forward from EX
+	add	1	3	4
+	nor	4	1	5	forward from EX and MEM
+	lw	0	6	one
+	add	6	5	7	load-use stall
+	add	7	4	5
+	sw	0	5	tmp
+	lw	0	4	tmp
+	add	4	4	4	load-use stall
+	beq	1	0	done
+	beq	0	0	loop	squashes two
+done	halt
+cnt	.fill	2000000
+neg1	.fill	-1
+one	.fill	1
+tmp	.fill	0
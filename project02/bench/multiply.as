@@ -0,0 +1,21 @@
+	lw	0	2	mcand
+	lw	0	3	mplier
+	lw	0	4	one
+	lw	0	6	count
+loop	nor	3	3	7
+	nor	4	4	5
+	nor	7	5	7	mplier & bit
+	beq	7	0	skip
+	add	1	2	1
+skip	add	2	2	2
+	add	4	4	4
+	lw	0	5	neg1
+	add	6	5	6	load-use stall
+	beq	6	0	done
+	beq	0	0	loop
+done	halt
+mcand	.fill	32766
+mplier	.fill	10383
+one	.fill	1
+neg1	.fill	-1
+count	.fill	1000000
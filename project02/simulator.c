@@ -2,19 +2,24 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
+
+#include "../common/lc2k.h"
+#include "../common/image.h"
+#include "../common/writer.h"
+#include "../common/memory.h"
+#include "../common/predict.h"
+#include "../common/cache.h"
+#include "../common/pool.h"
+#include "../common/batch.h"
+#include "../common/arch.h"
+#include "../common/ring.h"
 
 #define NUMMEMORY 65536 /* maximum number of data words in memory */
 #define NUMREGS 8 /* number of machine registers */
 #define MAX_LINE_LENGTH 1000
 
-#define ADD 0
-#define NOR 1
-#define LW 2
-#define SW 3
-#define BEQ 4
-#define JALR 5 /* JALR will not implemented for this project */
-#define HALT 6
-#define NOOP 7
+/* opcodes come from common/lc2k.h */
 
 #define NOOPINSTRUCTION 0x1c00000
 
@@ -49,9 +54,19 @@ typedef struct WBENDStruct {
 } WBENDType;
 
 typedef struct stateStruct {
+    /* updated in place */
+    memoryType instrMem; /* paged, copy-on-write; see common/memory.h */
+    memoryType dataMem;
+    predictorType *predictor; /* beq direction and target at fetch */
+    cacheType *icache; /* NULL: every fetch takes one cycle */
+    cacheType *dcache; /* NULL: so does every lw and sw */
+    struct countersStruct *counters; /* NULL: nothing counted */
+    int fetchStall; /* cycles the fetch at pc still waits; -1 if not started */
+    int memStall; /* the same for the lw or sw in EXMEM */
+    long long fetchStallCycles;
+    long long memStallCycles;
+    /* double-buffered by run(): pc to the end */
     int pc;
-    int instrMem[NUMMEMORY];
-    int dataMem[NUMMEMORY];
     int reg[NUMREGS];
     int numMemory;
     IFIDType IFID;
@@ -60,9 +75,245 @@ typedef struct stateStruct {
     MEMWBType MEMWB;
     WBENDType WBEND;
     int cycles; /* number of cycles run so far */
+    /*
+     * Decoded once, when an instruction enters IDEX, and carried down the
+     * pipe with it: the register each latch forwards to (-1 if none; reg 0
+     * is never forwarded), and the register a lw in IDEX loads (-1 if IDEX
+     * is not a lw).  decodeLatches() rebuilds them from the latches.
+     */
+    int IDEXdest;
+    int EXMEMdest;
+    int MEMWBdest;
+    int WBENDdest;
+    int IDEXload;
+    int EXMEMstore; /* what a sw in EXMEM stores, forwarded like an operand */
+    /*
+     * The pc fetched after each latch's instruction if fetch predicted a
+     * taken branch, else PREDICT_NOT_TAKEN (MEM flushes when it was wrong),
+     * and the global branch history fetch predicted with.
+     */
+    int IFIDnext;
+    int IDEXnext;
+    int EXMEMnext;
+    int EXMEMpcPlus1;
+    unsigned int IFIDhistory;
+    unsigned int IDEXhistory;
+    unsigned int EXMEMhistory;
+    /* the predictor's rasTop just after each latch's instruction was fetched */
+    int IFIDras;
+    int IDEXras;
+    int EXMEMras;
 } stateType;
 
+#define LATCHOFFSET offsetof(stateType, pc)
+#define LATCHSIZE (sizeof(stateType) - LATCHOFFSET)
+
+/* the caches run() charges for: L1I and L1D over an optional shared L2 */
+typedef struct cacheSetupStruct {
+    cacheConfigType l1i; /* size 0: no such cache */
+    cacheConfigType l1d;
+    cacheConfigType l2;
+    int memLatency; /* cycles for a miss in the last level */
+} cacheSetupType;
+
+typedef struct cachesStruct {
+    cacheType l1i;
+    cacheType l1d;
+    cacheType l2;
+} cachesType;
+
+/*
+ * Performance counters for run() (--counters=json|csv), written at exit
+ * and every `every` cycles.  An instruction retires when it leaves MEM;
+ * bubbles, whose pcPlus1 is 0, do not count.
+ */
+enum CountersFormat { COUNTERS_JSON, COUNTERS_CSV };
+enum ForwardSource { FWD_EXMEM, FWD_MEMWB, FWD_WBEND, NUMFWDS };
+
+typedef struct countersStruct {
+    int format;
+    int every; /* 0: only at exit */
+    FILE *fp;
+    long long retired; /* halt included */
+    long long mix[NUMINSTOPCODES]; /* retired, by opcode */
+    long long loadUseStalls; /* cycles ID held an instruction behind a lw */
+    long long branchStalls; /* with resolveInId, cycles a beq or jalr waited in ID */
+    long long flushes;
+    long long flushCycles; /* fetch slots squashed by them */
+    long long forwards[NUMFWDS]; /* EX operands taken from each latch */
+    long long retireLimit; /* run() stops once this many have retired; 0: never */
+} countersType;
+
+/*
+ * Sampled simulation (--sample=period:warm:measure, in instructions): each
+ * period runs functionally, warming the predictor and caches, up to a
+ * detailed window of warm instructions on the pipeline followed by measure
+ * more whose CPI is one sample.  See runSampled().
+ */
+typedef struct sampleConfigStruct {
+    int period;
+    int warm;
+    int measure;
+} sampleConfigType;
+
+typedef struct sampleStatsStruct {
+    long long instructions; /* all of them, halt included */
+    long long detailed; /* of those, run on the pipeline */
+    int samples;
+    double sum; /* of the samples' CPI */
+    double sumSquares;
+} sampleStatsType;
+
+/*
+ * Decoupled mode (--decoupled): a functional thread runs the program with
+ * archStep() and streams what each instruction did through a ring to the
+ * timing model, runTiming(), which only moves instructions down the pipe
+ * and takes branch outcomes and addresses from the stream.  The latches
+ * carry no values, so each holds the number of its instruction's record
+ * instead.  See runDecoupled().
+ */
+#define RINGSIZE 4096 /* default records in flight between the threads */
+#define STREAMWINDOW 16 /* records kept for instructions still in the pipe */
+
+typedef struct timingLatchStruct {
+    int instr;
+    int pcPlus1; /* 0 for a bubble */
+    long long seq; /* its record, -1 for a bubble or a wrong-path fetch */
+    int next; /* as IFIDnext */
+    unsigned int history;
+    int ras;
+} timingLatchType;
+
+typedef struct timingStateStruct {
+    int pc;
+    int cycles;
+    long long fetchSeq; /* the record the fetch at pc is, -1 on a wrong path */
+    timingLatchType IFID;
+    timingLatchType IDEX;
+    timingLatchType EXMEM;
+    timingLatchType MEMWB;
+} timingStateType;
+
+/* the consumer's end of the ring */
+typedef struct streamStruct {
+    ringType *ring;
+    long long popped;
+    archStepType window[STREAMWINDOW]; /* record seq is window[seq % STREAMWINDOW] */
+} streamType;
+
+/*
+ * Superscalar mode (--width=N): every latch holds a bundle of N slots that
+ * move down the pipe together, and up to N instructions issue in order
+ * each cycle.  See runWide().
+ */
+#define MAXWIDTH 8
+
+typedef struct slotStruct {
+    int instr;
+    int valid; /* 0 for a bubble or a squashed instruction */
+    int pcPlus1;
+    int readRegA;
+    int readRegB;
+    int offset;
+    int aluResult;
+    int branchTarget;
+    int store; /* what a sw stores */
+    int writeData;
+    int dest; /* forwardDest(instr), -1 for a bubble */
+    int next; /* as IFIDnext */
+    unsigned int history;
+    int ras;
+} slotType;
+
+typedef struct wideStateStruct {
+    int pc;
+    int reg[NUMREGS];
+    int cycles;
+    int numIFID; /* IFID is a queue; instructions that did not issue stay */
+    slotType IFID[MAXWIDTH];
+    slotType IDEX[MAXWIDTH];
+    slotType EXMEM[MAXWIDTH];
+    slotType MEMWB[MAXWIDTH];
+    slotType WBEND[MAXWIDTH];
+} wideStateType;
+
+typedef struct issueStatsStruct {
+    int width;
+    long long cycles;
+    long long retired; /* instructions written back, halt included */
+    long long issued[MAXWIDTH + 1]; /* cycles that issued 0, 1, ... N */
+    long long bundleStalls; /* issue stopped at a slot needing an older slot's result */
+    long long loadUseStalls;
+    long long emptyCycles; /* nothing fetched to issue */
+} issueStatsType;
+
+/*
+ * Out-of-order mode (--ooo): Tomasulo's algorithm with a reorder buffer.
+ * See runOoo().
+ */
+#define MAXROB 256
+
+enum FunctionalUnit { FU_ALU, FU_MEM, FU_BRANCH, NUMFUS };
+
+typedef struct oooConfigStruct {
+    int width; /* fetched, dispatched, issued and committed per cycle */
+    int robSize;
+    int rsSize; /* reservation stations */
+    int lsqSize; /* lw and sw in the load/store queue */
+    int latency[NUMFUS]; /* add and nor, lw and sw, beq and jalr */
+} oooConfigType;
+
+enum RobState { ROB_WAITING, ROB_EXECUTING, ROB_DONE };
+
+typedef struct robEntryStruct {
+    int instr;
+    int pc;
+    int state;
+    int doneCycle; /* when an executing entry finishes */
+    int dest; /* register written at commit, -1 if none */
+    int tag[2]; /* ROB entry regA and regB wait for, -1 once in operand */
+    int operand[2];
+    int value; /* result, or what a sw stores */
+    int target; /* branch target, or lw and sw address */
+    int taken;
+    int next; /* as IFIDnext */
+    unsigned int history;
+    int ras;
+} robEntryType;
+
+typedef struct oooStateStruct {
+    int pc; /* fetch pc; the pc after halt once it commits */
+    int reg[NUMREGS]; /* committed */
+    int cycles;
+    int rename[NUMREGS]; /* youngest ROB entry writing each register, -1 for reg */
+    robEntryType rob[MAXROB]; /* circular, oldest at head */
+    int head;
+    int count;
+    int rsUsed;
+    int lsqUsed;
+    int fetchStopped; /* a halt was fetched */
+    int numFetched;
+    slotType fetched[MAXWIDTH]; /* fetched, waiting to dispatch */
+} oooStateType;
+
+typedef struct oooStatsStruct {
+    oooConfigType config;
+    long long cycles;
+    long long committed; /* halt included */
+    long long issued[MAXWIDTH + 1]; /* cycles that issued 0, 1, ... N */
+    long long robOccupancy; /* summed over cycles */
+    long long robFull; /* cycles dispatch stopped for want of a ROB entry */
+    long long rsFull;
+    long long lsqFull;
+    long long fetchEmpty; /* nothing to dispatch */
+    long long loadsForwarded; /* from an older sw still in the queue */
+    long long loadsBlocked; /* cycles a ready lw waited on an older sw */
+    long long mispredicts;
+    long long squashed;
+} oooStatsType;
+
 void printState(stateType*);
+static void printMachine(stateType *);
 int field0(int);
 int field1(int);
 int field2(int);
@@ -70,334 +321,2352 @@ int opcode(int);
 void printInstruction(int);
 int convertNum(int);
 
+/* print the state every printEvery cycles; 0 prints only the final state */
+int printEvery = 1;
+/* resolve beq and jalr in ID (one squashed fetch) instead of MEM (three) */
+int resolveInId = 0;
+writerType out;
+
+void initState(stateType *);
+int writtenReg(int);
+int forwardDest(int);
+void decodeLatches(stateType *);
+void clearPredictions(stateType *);
+void initCaches(stateType *, cachesType *, const cacheSetupType *);
+void freeCaches(cachesType *);
+void printCachesReport(FILE *, const stateType *, const cachesType *);
+void writeCounters(const stateType *, const countersType *);
+void pipelineFromArch(stateType *, const archStateType *);
+void archFromPipeline(const stateType *, archStateType *);
+int runSampled(stateType *, const sampleConfigType *, sampleStatsType *);
+void printSampleEstimate(FILE *, const sampleStatsType *);
+int runTiming(stateType *, streamType *);
+int runDecoupled(stateType *, int);
+int run(stateType *, int);
+void initWideState(wideStateType *, const stateType *);
+int runWide(stateType *, wideStateType *, int, int, issueStatsType *);
+void printWideState(stateType *, const wideStateType *, int);
+void printIssueReport(FILE *, const issueStatsType *);
+void initOooState(oooStateType *, const stateType *);
+int runOoo(stateType *, oooStateType *, const oooConfigType *, int, oooStatsType *);
+void printOooState(stateType *, const oooStateType *, int);
+void printOooReport(FILE *, const oooStatsType *);
+int runBatch(const char *, int, int, const predictorKindType *, int, const cacheSetupType *, int,
+             const oooConfigType *);
 
 int main(int argc, char *argv[])
 {
     char line[MAX_LINE_LENGTH];
-    stateType state, newState;
+    static stateType state;
     FILE *filePtr;
-    int i, aluInput0, aluInput1;
+    char *fileName;
+    int *words;
+    static predictorType predictor;
+    const predictorKindType *predictorKind = findPredictor("not-taken");
+    static cacheSetupType cacheSetup = {.memLatency = 20};
+    static cachesType caches;
+    cacheConfigType *cacheConfig;
+    const char *error, *imageError;
+    int i, word, batch = 0, numThreads = 0, cycleLimit = 0, branchReport = 0;
+    int cacheReport = 0, useRas = 0, width = 1, issueReport = 0;
+    static wideStateType wideState;
+    static issueStatsType issueStats;
+    int ooo = 0;
+    static oooConfigType oooConfig = {
+        .robSize = 32, .rsSize = 16, .lsqSize = 16, .latency = {1, 2, 1}
+    };
+    static oooStateType oooState;
+    static oooStatsType oooStats;
+    static countersType counters;
+    int countersOn = 0;
+    const char *countersFile = NULL;
+    sampleConfigType sampleConfig = {0, 0, 0};
+    static sampleStatsType sampleStats;
+    int decoupled = 0, ringSize = RINGSIZE;
 
-    if (argc != 2) {
-        printf("error: usage: %s <machine-code file>\n", argv[0]);
+    for (i = 1; i < argc - 1; i++) {
+        if (!strcmp(argv[i], "-q")) {
+            printEvery = 0;
+        } else if (!strcmp(argv[i], "-n") && i + 2 < argc) {
+            printEvery = atoi(argv[++i]);
+            if (printEvery < 1) {
+                printf("error: -n needs a positive cycle count\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--batch")) {
+            batch = 1;
+        } else if (!strcmp(argv[i], "-j") && i + 2 < argc && atoi(argv[i + 1]) > 0) {
+            numThreads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--max-cycles") && i + 2 < argc && atoi(argv[i + 1]) > 0) {
+            cycleLimit = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--predict=", 10)) {
+            predictorKind = findPredictor(argv[i] + 10);
+            if (predictorKind == NULL) {
+                printf("error: unknown predictor %s; one of:", argv[i] + 10);
+                for (i = 0; i < NUMPREDICTORS; i++) {
+                    printf(" %s", predictorTable[i].name);
+                }
+                printf("\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--branch-report")) {
+            branchReport = 1;
+        } else if (!strcmp(argv[i], "--ras")) {
+            useRas = 1;
+        } else if (!strcmp(argv[i], "--resolve=id") || !strcmp(argv[i], "--resolve=mem")) {
+            resolveInId = argv[i][10] == 'i';
+        } else if (!strncmp(argv[i], "--l1i=", 6) || !strncmp(argv[i], "--l1d=", 6)
+                || !strncmp(argv[i], "--l2=", 5)) {
+            cacheConfig = argv[i][4] == 'i' ? &cacheSetup.l1i
+                        : argv[i][4] == 'd' ? &cacheSetup.l1d : &cacheSetup.l2;
+            error = parseCacheConfig(strchr(argv[i], '=') + 1, cacheConfig);
+            if (error != NULL) {
+                printf("error: %s: %s\n", argv[i], error);
+                exit(1);
+            }
+        } else if (!strncmp(argv[i], "--mem-latency=", 14) && atoi(argv[i] + 14) > 0) {
+            cacheSetup.memLatency = atoi(argv[i] + 14);
+        } else if (!strcmp(argv[i], "--cache-report")) {
+            cacheReport = 1;
+        } else if (!strncmp(argv[i], "--width=", 8)) {
+            width = atoi(argv[i] + 8);
+            if (width < 1 || width > MAXWIDTH) {
+                printf("error: --width must be 1 to %d\n", MAXWIDTH);
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--issue-report")) {
+            issueReport = 1;
+        } else if (!strcmp(argv[i], "--counters=json") || !strcmp(argv[i], "--counters=csv")) {
+            countersOn = 1;
+            counters.format = argv[i][11] == 'c' ? COUNTERS_CSV : COUNTERS_JSON;
+        } else if (!strncmp(argv[i], "--counters-every=", 17) && atoi(argv[i] + 17) > 0) {
+            counters.every = atoi(argv[i] + 17);
+        } else if (!strncmp(argv[i], "--counters-file=", 16)) {
+            countersFile = argv[i] + 16;
+        } else if (!strncmp(argv[i], "--sample=", 9)) {
+            if (sscanf(argv[i] + 9, "%d:%d:%d", &sampleConfig.period, &sampleConfig.warm,
+                       &sampleConfig.measure) != 3 || sampleConfig.warm < 0
+                    || sampleConfig.measure < 1
+                    || sampleConfig.period < sampleConfig.warm + sampleConfig.measure) {
+                printf("error: --sample needs period:warm:measure instructions,"
+                       " measure at least 1 and period at least warm + measure\n");
+                exit(1);
+            }
+        } else if (!strcmp(argv[i], "--decoupled")) {
+            decoupled = 1;
+        } else if (!strncmp(argv[i], "--ring=", 7) && atoi(argv[i] + 7) > 0) {
+            ringSize = atoi(argv[i] + 7);
+        } else if (!strcmp(argv[i], "--ooo")) {
+            ooo = 1;
+        } else if (!strncmp(argv[i], "--rob=", 6)) {
+            oooConfig.robSize = atoi(argv[i] + 6);
+            if (oooConfig.robSize < 1 || oooConfig.robSize > MAXROB) {
+                printf("error: --rob must be 1 to %d\n", MAXROB);
+                exit(1);
+            }
+        } else if (!strncmp(argv[i], "--rs=", 5) && atoi(argv[i] + 5) > 0) {
+            oooConfig.rsSize = atoi(argv[i] + 5);
+        } else if (!strncmp(argv[i], "--lsq=", 6) && atoi(argv[i] + 6) > 0) {
+            oooConfig.lsqSize = atoi(argv[i] + 6);
+        } else if (!strncmp(argv[i], "--fu-latency=", 13)) {
+            if (sscanf(argv[i] + 13, "%d:%d:%d", &oooConfig.latency[FU_ALU],
+                       &oooConfig.latency[FU_MEM], &oooConfig.latency[FU_BRANCH]) != 3
+                    || oooConfig.latency[FU_ALU] < 1 || oooConfig.latency[FU_MEM] < 1
+                    || oooConfig.latency[FU_BRANCH] < 1) {
+                printf("error: --fu-latency needs alu:mem:branch cycles, each at least 1\n");
+                exit(1);
+            }
+        } else {
+            break;
+        }
+    }
+    if (i != argc - 1) {
+        printf("error: usage: %s [-q | -n cycles] [--predict=name] [--ras] [--resolve=id|mem] [--branch-report]\n", argv[0]);
+        printf("           [--l1i=spec] [--l1d=spec] [--l2=spec] [--mem-latency=cycles] [--cache-report]\n");
+        printf("           [--width=N] [--issue-report]\n");
+        printf("           [--ooo [--rob=N] [--rs=N] [--lsq=N] [--fu-latency=alu:mem:branch]]\n");
+        printf("           [--counters=json|csv [--counters-every=cycles] [--counters-file=path]]\n");
+        printf("           [--sample=period:warm:measure | --decoupled [--ring=records]]\n");
+        printf("           <machine-code file>\n");
+        printf("       %s [-j threads] [--max-cycles cycles] [predictor, cache, width and ooo options] --batch <manifest>\n", argv[0]);
+        printf("cache spec: size:assoc:block[:lru|fifo|random][:wb|wt][:wa|nwa][:latency], in words\n");
         exit(1);
     }
-    filePtr = fopen(argv[1], "r");
+    if (cacheSetup.l2.size && !cacheSetup.l1i.size && !cacheSetup.l1d.size) {
+        printf("error: --l2 needs --l1i or --l1d\n");
+        exit(1);
+    }
+    if (width > 1 && !ooo && (resolveInId || cacheSetup.l1i.size || cacheSetup.l1d.size)) {
+        printf("error: --width resolves branches in MEM and has no caches\n");
+        exit(1);
+    }
+    if (ooo && (resolveInId || cacheSetup.l1i.size || cacheSetup.l1d.size)) {
+        printf("error: --ooo resolves branches when they execute and has no caches\n");
+        exit(1);
+    }
+    if (countersOn && (ooo || width > 1 || batch)) {
+        printf("error: --counters counts the in-order pipeline of a single run\n");
+        exit(1);
+    }
+    if (sampleConfig.period && (ooo || width > 1 || batch || countersOn || branchReport)) {
+        printf("error: --sample runs the in-order pipeline of a single run, and counts itself\n");
+        exit(1);
+    }
+    if (decoupled && (ooo || width > 1 || batch || countersOn || sampleConfig.period)) {
+        printf("error: --decoupled times the in-order pipeline of a single run\n");
+        exit(1);
+    }
+    if (sampleConfig.period || decoupled) {
+        /* neither has latches worth printing each cycle */
+        printEvery = 0;
+    }
+    oooConfig.width = width;
+    fileName = argv[i];
+
+    if (batch) {
+        /* batch jobs print one record each, never states */
+        printEvery = 0;
+        exit(runBatch(fileName, numThreads, cycleLimit, predictorKind, useRas, &cacheSetup,
+                      width, ooo ? &oooConfig : NULL));
+    }
+
+    outputInit();
+    writerInit(&out, stdout);
+
+    filePtr = fopen(fileName, "r");
     if (filePtr == NULL) {
-        printf("error: can't open file %s", argv[1]);
+        printf("error: can't open file %s", fileName);
         perror("fopen");
         exit(1);
     }
     /* read in the entire machine-code file into memory */
-    for (state.numMemory = 0; fgets(line, MAX_LINE_LENGTH, filePtr) != NULL;
-            state.numMemory++) {
-        if (sscanf(line, "%d", state.instrMem+state.numMemory) != 1) {
-            printf("error in reading address %d\n", state.numMemory);
-            exit(1);
+    memInit(&state.instrMem);
+    words = malloc(NUMMEMORY * sizeof(int));
+    if (words == NULL) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    if ((state.numMemory = loadImage(fileName, words, NUMMEMORY, &imageError)) >= 0) {
+        /* binary image */
+        memLoad(&state.instrMem, words, state.numMemory);
+        for (i = 0; printEvery && i < state.numMemory; i++) {
+            printf("memory[%d]=%d\n", i, words[i]);
+        }
+    } else if (imageError != NULL) {
+        printf("error: %s: %s\n", fileName, imageError);
+        exit(1);
+    } else {
+        for (state.numMemory = 0; fgets(line, MAX_LINE_LENGTH, filePtr) != NULL;
+                state.numMemory++) {
+            if (sscanf(line, "%d", &word) != 1) {
+                printf("error in reading address %d\n", state.numMemory);
+                exit(1);
+            }
+            memWrite(&state.instrMem, state.numMemory, word);
+            if (printEvery) {
+                printf("memory[%d]=%d\n", state.numMemory, word);
+            }
         }
-        state.dataMem[state.numMemory] = state.instrMem[state.numMemory];
-        printf("memory[%d]=%d\n", state.numMemory, state.instrMem[state.numMemory]);
     }
+    free(words);
+    /* data memory starts as a copy of the image and shares its pages */
+    memSnapshot(&state.dataMem, &state.instrMem);
 
     /* print instruction memory words */
-    printf("%d memory words\n\tinstruction memory:\n", state.numMemory);
+    if (printEvery) {
+        printf("%d memory words\n\tinstruction memory:\n", state.numMemory);
+
+        for (i = 0; i < state.numMemory; ++i) {
+            writeStr(&out, "\t\tinstrMem[ ");
+            writeInt(&out, i);
+            writeStr(&out, " ] ");
+            printInstruction(memRead(&state.instrMem, i));
+        }
+        writerFlush(&out);
+    }
 
-    for (i = 0; i < state.numMemory; ++i) {
-        printf("\t\tinstrMem[ %d ] ", i);
-        printInstruction(state.instrMem[i]);
+    initState(&state);
+    predictInit(&predictor, predictorKind);
+    predictor.useRas = useRas;
+    state.predictor = &predictor;
+    initCaches(&state, &caches, &cacheSetup);
+    if (countersOn) {
+        counters.fp = countersFile != NULL ? fopen(countersFile, "w") : stderr;
+        if (counters.fp == NULL) {
+            printf("error: can't open %s\n", countersFile);
+            exit(1);
+        }
+        state.counters = &counters;
     }
 
+    if (sampleConfig.period) {
+        runSampled(&state, &sampleConfig, &sampleStats);
+        printState(&state);
+        printf("machine halted\n");
+        printSampleEstimate(stdout, &sampleStats);
+        if (cacheReport) {
+            fflush(stdout);
+            printCachesReport(stderr, &state, &caches);
+        }
+        return(0);
+    } else if (decoupled) {
+        runDecoupled(&state, ringSize);
+        printState(&state);
+    } else if (ooo) {
+        initOooState(&oooState, &state);
+        runOoo(&state, &oooState, &oooConfig, 0, &oooStats);
+        if (!printEvery || state.cycles % printEvery != 0) {
+            printOooState(&state, &oooState, oooConfig.robSize);
+        }
+    } else if (width > 1) {
+        initWideState(&wideState, &state);
+        runWide(&state, &wideState, width, 0, &issueStats);
+        if (!printEvery || state.cycles % printEvery != 0) {
+            printWideState(&state, &wideState, width);
+        }
+    } else {
+        run(&state, 0);
+        /* the final state, unless the output level already printed it */
+        if (!printEvery || state.cycles % printEvery != 0) {
+            printState(&state);
+        }
+    }
+    printf("machine halted\n");
+    printf("total of %d cycles executed\n", state.cycles);
+    if (branchReport) {
+        fflush(stdout);
+        printPredictReport(stderr, &predictor, resolveInId ? 1 : 3);
+    }
+    if (cacheReport) {
+        fflush(stdout);
+        printCachesReport(stderr, &state, &caches);
+    }
+    if (countersOn) {
+        fflush(stdout);
+        /* the final snapshot, unless the last periodic one was it */
+        if (!counters.every || state.cycles % counters.every != 0) {
+            writeCounters(&state, &counters);
+        }
+        if (counters.fp != stderr) {
+            fclose(counters.fp);
+        }
+    }
+    if (issueReport && ooo) {
+        fflush(stdout);
+        printOooReport(stderr, &oooStats);
+    } else if (issueReport && width > 1) {
+        fflush(stdout);
+        printIssueReport(stderr, &issueStats);
+    }
+    return(0);
+}
+
+/* print "\t\t<label> <value>\n" */
+static void writeField(const char *label, int value) {
+    writeStr(&out, "\t\t");
+    writeStr(&out, label);
+    writeStr(&out, " ");
+    writeInt(&out, value);
+    writeStr(&out, "\n");
+}
+
+void initState(stateType *statePtr) {
+    int i;
+
     /* initialize */
-    state.cycles = 0;
-    state.pc = 0;
+    statePtr->cycles = 0;
+    statePtr->pc = 0;
     for (i=0; i<NUMREGS; i++) {
-        state.reg[i] = 0;
+        statePtr->reg[i] = 0;
     }
-    state.IFID.instr = NOOPINSTRUCTION;
-    state.IDEX.instr = NOOPINSTRUCTION;
-    state.EXMEM.instr = NOOPINSTRUCTION;
-    state.MEMWB.instr = NOOPINSTRUCTION;
-    state.WBEND.instr = NOOPINSTRUCTION;
+    statePtr->IFID.instr = NOOPINSTRUCTION;
+    statePtr->IDEX.instr = NOOPINSTRUCTION;
+    statePtr->EXMEM.instr = NOOPINSTRUCTION;
+    statePtr->MEMWB.instr = NOOPINSTRUCTION;
+    statePtr->WBEND.instr = NOOPINSTRUCTION;
+    decodeLatches(statePtr);
+    clearPredictions(statePtr);
+    statePtr->fetchStall = -1;
+    statePtr->memStall = -1;
+    statePtr->fetchStallCycles = 0;
+    statePtr->memStallCycles = 0;
     /* end of initialize */
+}
 
-    while (1) {
-        
-        printState(&state);
-        
-        /* check for halt */
-        if (opcode(state.MEMWB.instr) == HALT) {
-            printf("machine halted\n");
-            printf("total of %d cycles executed\n", state.cycles);
-            exit(0);
+/* register instr writes; -1 if none */
+int writtenReg(int instr) {
+    if (opcode(instr) == OP_ADD || opcode(instr) == OP_NOR) {
+        return field2(instr);
+    } else if (opcode(instr) == OP_LW || opcode(instr) == OP_JALR) {
+        return field1(instr);
+    }
+    return -1;
+}
+
+/* register instr's result is forwarded to; -1 if none, reg 0 or above 7 */
+int forwardDest(int instr) {
+    int dest = writtenReg(instr);
+
+    return dest == 0 || dest >= NUMREGS ? -1 : dest;
+}
+
+/* registers instr reads in ID, -1 if none */
+static void sourceRegs(int instr, int *regA, int *regB) {
+    *regA = -1;
+    *regB = -1;
+    switch (opcode(instr)) {
+    case OP_ADD:
+    case OP_NOR:
+    case OP_BEQ:
+    case OP_SW:
+        *regB = field1(instr);
+        /* fall through */
+    case OP_LW:
+    case OP_JALR:
+        *regA = field0(instr);
+    }
+}
+
+void decodeLatches(stateType *statePtr) {
+    statePtr->IDEXdest = forwardDest(statePtr->IDEX.instr);
+    statePtr->EXMEMdest = forwardDest(statePtr->EXMEM.instr);
+    statePtr->MEMWBdest = forwardDest(statePtr->MEMWB.instr);
+    statePtr->WBENDdest = forwardDest(statePtr->WBEND.instr);
+    statePtr->IDEXload = opcode(statePtr->IDEX.instr) == OP_LW ? field1(statePtr->IDEX.instr) : -1;
+}
+
+/* the latches start empty, so nothing is predicted taken yet */
+void clearPredictions(stateType *statePtr) {
+    statePtr->IFIDnext = PREDICT_NOT_TAKEN;
+    statePtr->IDEXnext = PREDICT_NOT_TAKEN;
+    statePtr->EXMEMnext = PREDICT_NOT_TAKEN;
+    statePtr->EXMEMpcPlus1 = 0;
+    statePtr->IFIDhistory = 0;
+    statePtr->IDEXhistory = 0;
+    statePtr->EXMEMhistory = 0;
+    statePtr->IFIDras = 0;
+    statePtr->IDEXras = 0;
+    statePtr->EXMEMras = 0;
+}
+
+/* build setup's caches and connect *statePtr to them */
+void initCaches(stateType *statePtr, cachesType *caches, const cacheSetupType *setup) {
+    cacheType *l2 = NULL;
+
+    memset(caches, 0, sizeof(*caches));
+    if (setup->l2.size) {
+        cacheInit(&caches->l2, "L2", &setup->l2, NULL, setup->memLatency);
+        l2 = &caches->l2;
+    }
+    statePtr->icache = NULL;
+    statePtr->dcache = NULL;
+    if (setup->l1i.size) {
+        cacheInit(&caches->l1i, "L1I", &setup->l1i, l2, setup->memLatency);
+        statePtr->icache = &caches->l1i;
+    }
+    if (setup->l1d.size) {
+        cacheInit(&caches->l1d, "L1D", &setup->l1d, l2, setup->memLatency);
+        statePtr->dcache = &caches->l1d;
+    }
+}
+
+void freeCaches(cachesType *caches) {
+    cacheFree(&caches->l1i);
+    cacheFree(&caches->l1d);
+    cacheFree(&caches->l2);
+}
+
+void printCachesReport(FILE *fp, const stateType *statePtr, const cachesType *caches) {
+    const cacheType *levels[] = {&caches->l1i, &caches->l1d, &caches->l2};
+    int i;
+
+    fprintf(fp, "cache report:\n");
+    for (i = 0; i < 3; i++) {
+        if (levels[i]->lines != NULL) {
+            printCacheReport(fp, levels[i]);
         }
+    }
+    fprintf(fp, "stall cycles: fetch %lld data %lld\n", statePtr->fetchStallCycles,
+            statePtr->memStallCycles);
+}
 
-        newState = state;
-        newState.cycles++;
+/* one snapshot of the counters: a JSON line, or a CSV row after a header the first time */
+void writeCounters(const stateType *statePtr, const countersType *counters) {
+    static const char *sourceNames[NUMFWDS] = {"EXMEM", "MEMWB", "WBEND"};
+    static int header = 0;
+    FILE *fp = counters->fp;
+    double cpi = counters->retired ? (double)statePtr->cycles / counters->retired : 0.0;
+    int i;
 
-        /* --------------------- IF stage --------------------- */
-        /* increase PC + 1 */
-        newState.IFID.instr = state.instrMem[state.pc];
-        newState.IFID.pcPlus1 = state.pc + 1;
-        newState.pc++;
+    if (counters->format == COUNTERS_CSV) {
+        if (!header) {
+            fprintf(fp, "cycles,retired,cpi,loadUseStalls,branchStalls,fetchStallCycles,"
+                    "memStallCycles,flushes,flushCycles");
+            for (i = 0; i < NUMFWDS; i++) {
+                fprintf(fp, ",forward%s", sourceNames[i]);
+            }
+            for (i = 0; i < NUMINSTOPCODES; i++) {
+                fprintf(fp, ",%s", opTable[i].name);
+            }
+            fprintf(fp, "\n");
+            header = 1;
+        }
+        fprintf(fp, "%d,%lld,%.4f,%lld,%lld,%lld,%lld,%lld,%lld", statePtr->cycles,
+                counters->retired, cpi, counters->loadUseStalls, counters->branchStalls,
+                statePtr->fetchStallCycles, statePtr->memStallCycles, counters->flushes,
+                counters->flushCycles);
+        for (i = 0; i < NUMFWDS; i++) {
+            fprintf(fp, ",%lld", counters->forwards[i]);
+        }
+        for (i = 0; i < NUMINSTOPCODES; i++) {
+            fprintf(fp, ",%lld", counters->mix[i]);
+        }
+        fprintf(fp, "\n");
+        return;
+    }
+
+    fprintf(fp, "{\"cycles\":%d,\"retired\":%lld,\"cpi\":%.4f,", statePtr->cycles,
+            counters->retired, cpi);
+    fprintf(fp, "\"stalls\":{\"loadUse\":%lld,\"branch\":%lld,\"fetch\":%lld,\"mem\":%lld},",
+            counters->loadUseStalls, counters->branchStalls, statePtr->fetchStallCycles,
+            statePtr->memStallCycles);
+    fprintf(fp, "\"flushes\":%lld,\"flushCycles\":%lld,\"forwards\":{", counters->flushes,
+            counters->flushCycles);
+    for (i = 0; i < NUMFWDS; i++) {
+        fprintf(fp, "%s\"%s\":%lld", i ? "," : "", sourceNames[i], counters->forwards[i]);
+    }
+    fprintf(fp, "},\"mix\":{");
+    for (i = 0; i < NUMINSTOPCODES; i++) {
+        fprintf(fp, "%s\"%s\":%lld", i ? "," : "", opTable[i].name, counters->mix[i]);
+    }
+    fprintf(fp, "}}\n");
+}
+
+/*
+ * 1 while the access to addr still misses in cache; charges it the first
+ * time.  *stall counts the cycles left, -1 once the access is done.
+ */
+static inline int cacheStall(cacheType *cache, int *stall, int addr, int isWrite) {
+    if (*stall < 0) {
+        *stall = cacheAccess(cache, addr, isWrite) - 1;
+    }
+    if (*stall > 0) {
+        (*stall)--;
+        return 1;
+    }
+    *stall = -1;
+    return 0;
+}
 
+/* copy the double-buffered part of *fromPtr into *toPtr */
+static void copyLatches(stateType *toPtr, const stateType *fromPtr) {
+    if (toPtr != fromPtr) {
+        memcpy(&toPtr->pc, &fromPtr->pc, LATCHSIZE);
+    }
+}
 
-        /* --------------------- ID stage --------------------- */
+/* register r as EX sees it: the youngest result in EXMEM, MEMWB or WBEND */
+static inline int forward(const stateType *statePtr, int r, int value) {
+    if (statePtr->EXMEMdest == r) {
+        return statePtr->EXMEM.aluResult;
+    }
+    if (statePtr->MEMWBdest == r) {
+        return statePtr->MEMWB.writeData;
+    }
+    if (statePtr->WBENDdest == r) {
+        return statePtr->WBEND.writeData;
+    }
+    return value;
+}
+
+/* the latch forward() takes register r from, -1 for none */
+static int forwardSource(const stateType *statePtr, int r) {
+    if (statePtr->EXMEMdest == r) {
+        return FWD_EXMEM;
+    }
+    if (statePtr->MEMWBdest == r) {
+        return FWD_MEMWB;
+    }
+    if (statePtr->WBENDdest == r) {
+        return FWD_WBEND;
+    }
+    return -1;
+}
+
+/* count the forwards of the instruction in IDEX and, leaving MEM, the one in EXMEM */
+static void countCycle(countersType *counters, const stateType *statePtr) {
+    int regA, regB, source;
+
+    sourceRegs(statePtr->IDEX.instr, &regA, &regB);
+    if (regA >= 0 && (source = forwardSource(statePtr, regA)) >= 0) {
+        counters->forwards[source]++;
+    }
+    if (regB >= 0 && (source = forwardSource(statePtr, regB)) >= 0) {
+        counters->forwards[source]++;
+    }
+    if (statePtr->EXMEMpcPlus1 != 0) {
+        counters->retired++;
+        counters->mix[opcode(statePtr->EXMEM.instr) & 7]++;
+    }
+}
+
+/* register r as ID sees it: results leaving EX and MEM are forwarded */
+static inline int forwardToId(const stateType *statePtr, int r) {
+    if (statePtr->EXMEMdest == r) {
+        return statePtr->EXMEM.aluResult;
+    }
+    if (statePtr->MEMWBdest == r) {
+        return statePtr->MEMWB.writeData;
+    }
+    return statePtr->reg[r];
+}
+
+/* a beq or jalr in ID needs a register EX or a lw in MEM is still computing */
+static inline int branchHazard(const stateType *statePtr) {
+    int instr = statePtr->IFID.instr;
+    int regA = field0(instr), regB = opcode(instr) == OP_BEQ ? field1(instr) : regA;
+
+    if (opcode(instr) != OP_BEQ && opcode(instr) != OP_JALR) {
+        return 0;
+    }
+    if (statePtr->IDEXdest == regA || statePtr->IDEXdest == regB) {
+        return 1;
+    }
+    return opcode(statePtr->EXMEM.instr) == OP_LW
+           && (statePtr->EXMEMdest == regA || statePtr->EXMEMdest == regB);
+}
+
+/*
+ * Fetch went the wrong way after a branch or jump that fetch followed to
+ * next.  Predict-not-taken flushes on every taken beq.  Anything else that
+ * fetch treated as a taken branch (a stale BTB entry) falls through.
+ */
+static inline int mispredicted(int next, int taken, int target) {
+    return taken ? next != target : next != PREDICT_NOT_TAKEN;
+}
+
+/*
+ * Run the pipeline from *machinePtr until halt reaches MEMWB (returns 1) or
+ * maxCycles cycles have run (returns 0; 0 means no limit).
+ *
+ * Only the pc, registers and latches are double-buffered.  The stages read
+ * *statePtr and write *newStatePtr, and the two pointers swap at the end of
+ * the cycle, so they alternate between *machinePtr and the local newState;
+ * the latches are copied back into *machinePtr only to print or return.
+ * Memory lives in *machinePtr alone.  MEM is the only stage that touches
+ * data memory and does one access a cycle, so its store goes in place.
+ *
+ * With caches a fetch that misses sends bubbles down the pipe until it
+ * completes, and a lw or sw that misses freezes every stage: those cycles
+ * only count.  A redirect abandons the fetch in flight.
+ *
+ * beq and jalr resolve in MEM and flush IFID, IDEX and EXMEM, or with
+ * resolveInId in ID, squashing only IFID.  ID then compares registers
+ * forwarded from EXMEM and MEMWB, and stalls while one is still in EX or
+ * being loaded by MEM.
+ */
+int run(stateType *machinePtr, int maxCycles) {
+    stateType newState; /* only the double-buffered part is used */
+    stateType *statePtr = machinePtr, *newStatePtr = &newState, *tmpPtr;
+    predictorType *predictor = machinePtr->predictor;
+    countersType *counters = machinePtr->counters;
+    int aluInput0, aluInput1, taken, target;
+
+    while (1) {
         
-        newState.IDEX.instr = state.IFID.instr;
-        newState.IDEX.pcPlus1 = state.IFID.pcPlus1;
-        newState.IDEX.readRegA = state.reg[field0(state.IFID.instr)];
-        newState.IDEX.readRegB = state.reg[field1(state.IFID.instr)];
-        newState.IDEX.offset = convertNum(field2(state.IFID.instr));
+        if (printEvery && statePtr->cycles % printEvery == 0) {
+            copyLatches(machinePtr, statePtr);
+            printState(machinePtr);
+        }
+        if (counters != NULL && counters->every && statePtr->cycles % counters->every == 0
+                && statePtr->cycles > 0) {
+            machinePtr->cycles = statePtr->cycles;
+            writeCounters(machinePtr, counters);
+        }
 
-                
-        /* Load-Use data hazard detection and stall */
-        if (opcode(state.IDEX.instr) == 2 && 
-                (field1(state.IDEX.instr) == field0(state.IFID.instr) 
-                    || field1(state.IDEX.instr) == field1(state.IFID.instr))) {
-            newState.IDEX.instr = NOOPINSTRUCTION;
-            newState.IDEX.offset = 0;
-            newState.IDEX.pcPlus1 = 0;
-            newState.IDEX.readRegA = 0;
-            newState.IDEX.readRegB = 0;
-            newState.pc = state.pc;
-            newState.IFID = state.IFID;
+        /* check for halt */
+        if (opcode(statePtr->MEMWB.instr) == OP_HALT) {
+            copyLatches(machinePtr, statePtr);
+            return 1;
         }
 
-        /* --------------------- EX stage --------------------- */
+        if (counters != NULL && counters->retireLimit
+                && counters->retired >= counters->retireLimit) {
+            copyLatches(machinePtr, statePtr);
+            return 0;
+        }
 
-        aluInput0 = state.IDEX.readRegA;
-        aluInput1 = state.IDEX.readRegB;
-        if (opcode(state.IDEX.instr) == 2 || opcode(state.IDEX.instr) == 3) {
-            aluInput1 = state.IDEX.offset;
+        if (maxCycles && statePtr->cycles >= maxCycles) {
+            copyLatches(machinePtr, statePtr);
+            return 0;
         }
 
-        /* Data hazard detection & forwarding */
-        /* FOR Rs */
-            /* if EX hazard */
-            if (((opcode(state.EXMEM.instr) == 0 || opcode(state.EXMEM.instr) == 1) 
-                    && field2(state.EXMEM.instr) != 0 && field2(state.EXMEM.instr) == field0(state.IDEX.instr))
-                || (opcode(state.EXMEM.instr) == 2 && field1(state.EXMEM.instr) != 0 
-                    && field1(state.EXMEM.instr) == field0(state.IDEX.instr))) {
-                
-                aluInput0 = state.EXMEM.aluResult;
+        if (machinePtr->dcache != NULL
+                && (opcode(statePtr->EXMEM.instr) == OP_LW || opcode(statePtr->EXMEM.instr) == OP_SW)
+                && cacheStall(machinePtr->dcache, &machinePtr->memStall, statePtr->EXMEM.aluResult,
+                              opcode(statePtr->EXMEM.instr) == OP_SW)) {
+            machinePtr->memStallCycles++;
+            statePtr->cycles++;
+            continue;
+        }
+
+        if (counters != NULL) {
+            countCycle(counters, statePtr);
+        }
+
+        /* the fields the stages below do not always write */
+        newStatePtr->pc = statePtr->pc;
+        memcpy(newStatePtr->reg, statePtr->reg, sizeof(statePtr->reg));
+        newStatePtr->numMemory = statePtr->numMemory;
+        newStatePtr->EXMEM.aluResult = statePtr->EXMEM.aluResult;
+        newStatePtr->MEMWB.writeData = statePtr->MEMWB.writeData;
+        newStatePtr->cycles = statePtr->cycles + 1;
+
+        /* --------------------- IF stage --------------------- */
+        /* increase PC + 1, or follow a predicted-taken branch */
+        if (machinePtr->icache != NULL
+                && cacheStall(machinePtr->icache, &machinePtr->fetchStall, statePtr->pc, 0)) {
+            /* still missing: a bubble, and fetch pc again */
+            machinePtr->fetchStallCycles++;
+            newStatePtr->IFID.instr = NOOPINSTRUCTION;
+            newStatePtr->IFID.pcPlus1 = 0;
+            newStatePtr->IFIDnext = PREDICT_NOT_TAKEN;
+            newStatePtr->IFIDhistory = 0;
+            newStatePtr->IFIDras = predictor->rasTop;
+        } else {
+            newStatePtr->IFID.instr = memRead(&machinePtr->instrMem, statePtr->pc);
+            newStatePtr->IFID.pcPlus1 = statePtr->pc + 1;
+            if (opcode(newStatePtr->IFID.instr) == OP_JALR) {
+                newStatePtr->IFIDnext = predictJump(predictor, statePtr->pc,
+                                                    field0(newStatePtr->IFID.instr),
+                                                    field1(newStatePtr->IFID.instr));
+            } else {
+                newStatePtr->IFIDnext = predictNext(predictor, statePtr->pc);
             }
-            /* if MEM hazard no EX hazard */
-            else if (((opcode(state.MEMWB.instr) == 0 || opcode(state.MEMWB.instr) == 1) 
-                    && field2(state.MEMWB.instr) != 0 && field2(state.MEMWB.instr) == field0(state.IDEX.instr))
-                || (opcode(state.MEMWB.instr) == 2 && field1(state.MEMWB.instr) != 0 
-                    && field1(state.MEMWB.instr) == field0(state.IDEX.instr))) {
-                
-                aluInput0 = state.MEMWB.writeData;
+            newStatePtr->IFIDhistory = predictor->history;
+            newStatePtr->IFIDras = predictor->rasTop;
+            if (newStatePtr->IFIDnext == PREDICT_NOT_TAKEN) {
+                newStatePtr->pc++;
+            } else {
+                newStatePtr->pc = newStatePtr->IFIDnext;
             }
-            /* if WB hazard no EX, MEM hazard */
-            else if (((opcode(state.WBEND.instr) == 0 || opcode(state.WBEND.instr) == 1) 
-                    && field2(state.WBEND.instr) != 0 && field2(state.WBEND.instr) == field0(state.IDEX.instr))
-                || (opcode(state.WBEND.instr) == 2 && field1(state.WBEND.instr) != 0 
-                    && field1(state.WBEND.instr) == field0(state.IDEX.instr))) {
-                
-                aluInput0 = state.WBEND.writeData;
-            }
-            /* FOR Rt (lecture) */
-            /* if EX hazard */
-            if (((opcode(state.EXMEM.instr) == 0 || opcode(state.EXMEM.instr) == 1) 
-                    && field2(state.EXMEM.instr) != 0 && field2(state.EXMEM.instr) == field1(state.IDEX.instr))
-                || (opcode(state.EXMEM.instr) == 2 && field1(state.EXMEM.instr) != 0 
-                    && field1(state.EXMEM.instr) == field1(state.IDEX.instr))) {
+        }
+
+
+        /* --------------------- ID stage --------------------- */
+        
+        newStatePtr->IDEX.instr = statePtr->IFID.instr;
+        newStatePtr->IDEX.pcPlus1 = statePtr->IFID.pcPlus1;
+        newStatePtr->IDEX.readRegA = statePtr->reg[field0(statePtr->IFID.instr)];
+        newStatePtr->IDEX.readRegB = statePtr->reg[field1(statePtr->IFID.instr)];
+        newStatePtr->IDEX.offset = convertNum(field2(statePtr->IFID.instr));
+        newStatePtr->IDEXdest = forwardDest(statePtr->IFID.instr);
+        newStatePtr->IDEXload = opcode(statePtr->IFID.instr) == OP_LW ? field1(statePtr->IFID.instr) : -1;
+        newStatePtr->IDEXnext = statePtr->IFIDnext;
+        newStatePtr->IDEXhistory = statePtr->IFIDhistory;
+        newStatePtr->IDEXras = statePtr->IFIDras;
+
                 
-                aluInput1 = state.EXMEM.aluResult;
+        /* Load-Use data hazard detection and stall, and in ID a branch waiting on EX or a lw */
+        if (statePtr->IDEXload == field0(statePtr->IFID.instr)
+                || statePtr->IDEXload == field1(statePtr->IFID.instr)
+                || (resolveInId && branchHazard(statePtr))) {
+            if (counters != NULL && (statePtr->IDEXload == field0(statePtr->IFID.instr)
+                                     || statePtr->IDEXload == field1(statePtr->IFID.instr))) {
+                counters->loadUseStalls++;
+            } else if (counters != NULL) {
+                counters->branchStalls++;
             }
-            /* if MEM hazard no EX hazard */
-            else if (((opcode(state.MEMWB.instr) == 0 || opcode(state.MEMWB.instr) == 1) 
-                    && field2(state.MEMWB.instr) != 0 && field2(state.MEMWB.instr) == field1(state.IDEX.instr))
-                || (opcode(state.MEMWB.instr) == 2 && field1(state.MEMWB.instr) != 0 
-                    && field1(state.MEMWB.instr) == field1(state.IDEX.instr))) {
-                
-                aluInput1 = state.MEMWB.writeData;
+            newStatePtr->IDEX.instr = NOOPINSTRUCTION;
+            newStatePtr->IDEXdest = -1;
+            newStatePtr->IDEXload = -1;
+            newStatePtr->IDEX.offset = 0;
+            newStatePtr->IDEX.pcPlus1 = 0;
+            newStatePtr->IDEX.readRegA = 0;
+            newStatePtr->IDEX.readRegB = 0;
+            newStatePtr->IDEXnext = PREDICT_NOT_TAKEN;
+            newStatePtr->pc = statePtr->pc;
+            newStatePtr->IFID = statePtr->IFID;
+            newStatePtr->IFIDnext = statePtr->IFIDnext;
+            newStatePtr->IFIDhistory = statePtr->IFIDhistory;
+            newStatePtr->IFIDras = statePtr->IFIDras;
+            predictor->rasTop = statePtr->IFIDras;
+        } else if (resolveInId && (opcode(statePtr->IFID.instr) == OP_BEQ
+                                   || opcode(statePtr->IFID.instr) == OP_JALR)) {
+            /* Branch and jump resolution in ID; squash the fetch behind it */
+            aluInput0 = forwardToId(statePtr, field0(statePtr->IFID.instr));
+            if (opcode(statePtr->IFID.instr) == OP_BEQ) {
+                taken = aluInput0 == forwardToId(statePtr, field1(statePtr->IFID.instr));
+                target = statePtr->IFID.pcPlus1 + newStatePtr->IDEX.offset;
+                predictUpdate(predictor, statePtr->IFID.pcPlus1 - 1, statePtr->IFIDhistory,
+                              taken, target);
+            } else {
+                taken = 1;
+                target = field0(statePtr->IFID.instr) == field1(statePtr->IFID.instr)
+                         ? statePtr->IFID.pcPlus1 : aluInput0;
+                predictJumpUpdate(predictor, statePtr->IFID.pcPlus1 - 1, target);
             }
-            /* if WB hazard no EX, MEM hazard */
-            else if (((opcode(state.WBEND.instr) == 0 || opcode(state.WBEND.instr) == 1) 
-                    && field2(state.WBEND.instr) != 0 && field2(state.WBEND.instr) == field1(state.IDEX.instr))
-                || (opcode(state.WBEND.instr) == 2 && field1(state.WBEND.instr) != 0 
-                    && field1(state.WBEND.instr) == field1(state.IDEX.instr))) {
-                
-                aluInput1 = state.WBEND.writeData;
+            if (mispredicted(statePtr->IFIDnext, taken, target)) {
+                predictor->mispredicts++;
+                if (counters != NULL) {
+                    counters->flushes++;
+                    counters->flushCycles++;
+                }
+                predictor->rasTop = statePtr->IFIDras;
+                machinePtr->fetchStall = -1;
+                newStatePtr->pc = taken ? target : statePtr->IFID.pcPlus1;
+                newStatePtr->IFID.instr = NOOPINSTRUCTION;
+                newStatePtr->IFID.pcPlus1 = 0;
+                newStatePtr->IFIDnext = PREDICT_NOT_TAKEN;
+                newStatePtr->IFIDras = statePtr->IFIDras;
             }
+        }
 
+        /* --------------------- EX stage --------------------- */
+
+        /* Data hazard detection & forwarding (Rs, then Rt as in lecture) */
+        aluInput0 = forward(statePtr, field0(statePtr->IDEX.instr), statePtr->IDEX.readRegA);
+        if (opcode(statePtr->IDEX.instr) == OP_LW || opcode(statePtr->IDEX.instr) == OP_SW) {
+            /* Rt is the register loaded or the value stored, not an ALU input */
+            aluInput1 = statePtr->IDEX.offset;
+            newStatePtr->EXMEMstore = forward(statePtr, field1(statePtr->IDEX.instr),
+                                              statePtr->IDEX.readRegB);
+        } else {
+            aluInput1 = forward(statePtr, field1(statePtr->IDEX.instr), statePtr->IDEX.readRegB);
+        }
 
         /* ALU */
-        switch (opcode(state.IDEX.instr)) {
+        switch (opcode(statePtr->IDEX.instr)) {
         /* add */
-        case 0:
-            newState.EXMEM.aluResult = aluInput0 + aluInput1;
+        case OP_ADD:
+            newStatePtr->EXMEM.aluResult = aluInput0 + aluInput1;
             break;
         /* nor */
-        case 1:
-            newState.EXMEM.aluResult = ~(aluInput0 | aluInput1);
+        case OP_NOR:
+            newStatePtr->EXMEM.aluResult = ~(aluInput0 | aluInput1);
             break;
         /* beq */
-        case 4:
-            newState.EXMEM.aluResult = aluInput0 - aluInput1;
+        case OP_BEQ:
+            newStatePtr->EXMEM.aluResult = aluInput0 - aluInput1;
+            break;
+        /* jalr: the link */
+        case OP_JALR:
+            newStatePtr->EXMEM.aluResult = statePtr->IDEX.pcPlus1;
             break;
         /* lw, sw */
-        case 2:
-        case 3:
-            newState.EXMEM.aluResult = aluInput0 + aluInput1;
+        case OP_LW:
+        case OP_SW:
+            newStatePtr->EXMEM.aluResult = aluInput0 + aluInput1;
         }
 
-        newState.EXMEM.instr = state.IDEX.instr;
-        newState.EXMEM.readRegB = state.IDEX.readRegB;
-        newState.EXMEM.branchTarget = state.IDEX.pcPlus1 + state.IDEX.offset;
+        newStatePtr->EXMEM.instr = statePtr->IDEX.instr;
+        newStatePtr->EXMEMdest = statePtr->IDEXdest;
+        newStatePtr->EXMEMnext = statePtr->IDEXnext;
+        newStatePtr->EXMEMpcPlus1 = statePtr->IDEX.pcPlus1;
+        newStatePtr->EXMEMhistory = statePtr->IDEXhistory;
+        newStatePtr->EXMEMras = statePtr->IDEXras;
+        newStatePtr->EXMEM.readRegB = statePtr->IDEX.readRegB;
+        newStatePtr->EXMEM.branchTarget = statePtr->IDEX.pcPlus1 + statePtr->IDEX.offset;
+        if (opcode(statePtr->IDEX.instr) == OP_JALR) {
+            /* regB is written first, so jalr regA regA lands on pc + 1 */
+            newStatePtr->EXMEM.branchTarget =
+                field0(statePtr->IDEX.instr) == field1(statePtr->IDEX.instr)
+                ? statePtr->IDEX.pcPlus1 : aluInput0;
+        }
         
         /* --------------------- MEM stage --------------------- */
 
-        newState.MEMWB.instr = state.EXMEM.instr;
+        newStatePtr->MEMWB.instr = statePtr->EXMEM.instr;
+        newStatePtr->MEMWBdest = statePtr->EXMEMdest;
 
-        switch (opcode(state.EXMEM.instr)) {
-        /* INT : add, nor */
-        case 0:
-        case 1:
-            newState.MEMWB.writeData = state.EXMEM.aluResult;
+        switch (opcode(statePtr->EXMEM.instr)) {
+        /* INT : add, nor, and the link of jalr */
+        case OP_ADD:
+        case OP_NOR:
+        case OP_JALR:
+            newStatePtr->MEMWB.writeData = statePtr->EXMEM.aluResult;
             break;
         /* Memory access : lw */
-        case 2:
-            newState.MEMWB.writeData = state.dataMem[state.EXMEM.aluResult];
+        case OP_LW:
+            newStatePtr->MEMWB.writeData = memRead(&machinePtr->dataMem, statePtr->EXMEM.aluResult);
             break;
         /* Memory access : sw */
-        case 3:
-            newState.dataMem[state.EXMEM.aluResult] = state.EXMEM.readRegB;
+        case OP_SW:
+            memWrite(&machinePtr->dataMem, statePtr->EXMEM.aluResult, statePtr->EXMEMstore);
             break;
-        /* Branch */
-        case 4:
-            if(state.EXMEM.aluResult == 0) {
-                newState.pc = state.EXMEM.branchTarget;
-                newState.EXMEM.instr = NOOPINSTRUCTION;
-                newState.EXMEM.branchTarget = 0;
-                newState.EXMEM.aluResult = 0;
-                newState.EXMEM.readRegB = 0;
-                newState.IDEX.instr = NOOPINSTRUCTION;
-                newState.IDEX.offset = 0;
-                newState.IDEX.pcPlus1 = 0;
-                newState.IDEX.readRegA = 0;
-                newState.IDEX.readRegB = 0;
-                newState.IFID.instr = NOOPINSTRUCTION;
-                newState.IFID.pcPlus1 = 0;
+        }
+
+        /* Branch and jump: flush IFID, IDEX and EXMEM when fetch went the wrong way */
+        taken = 0;
+        if (resolveInId) {
+            /* already resolved */
+        } else if (opcode(statePtr->EXMEM.instr) == OP_BEQ) {
+            taken = statePtr->EXMEM.aluResult == 0;
+            predictUpdate(predictor, statePtr->EXMEMpcPlus1 - 1, statePtr->EXMEMhistory,
+                          taken, statePtr->EXMEM.branchTarget);
+        } else if (opcode(statePtr->EXMEM.instr) == OP_JALR) {
+            taken = 1;
+            predictJumpUpdate(predictor, statePtr->EXMEMpcPlus1 - 1, statePtr->EXMEM.branchTarget);
+        }
+        if (!resolveInId && mispredicted(statePtr->EXMEMnext, taken, statePtr->EXMEM.branchTarget)) {
+            predictor->mispredicts++;
+            if (counters != NULL) {
+                counters->flushes++;
+                counters->flushCycles += 3;
             }
+            predictor->rasTop = statePtr->EXMEMras;
+            newStatePtr->pc = taken ? statePtr->EXMEM.branchTarget : statePtr->EXMEMpcPlus1;
+            machinePtr->fetchStall = -1;
+            newStatePtr->EXMEM.instr = NOOPINSTRUCTION;
+            newStatePtr->EXMEMnext = PREDICT_NOT_TAKEN;
+            newStatePtr->EXMEMpcPlus1 = 0;
+            newStatePtr->EXMEMdest = -1;
+            newStatePtr->EXMEM.branchTarget = 0;
+            newStatePtr->EXMEM.aluResult = 0;
+            newStatePtr->EXMEM.readRegB = 0;
+            newStatePtr->IDEX.instr = NOOPINSTRUCTION;
+            newStatePtr->IDEXdest = -1;
+            newStatePtr->IDEXload = -1;
+            newStatePtr->IDEXnext = PREDICT_NOT_TAKEN;
+            newStatePtr->IDEX.offset = 0;
+            newStatePtr->IDEX.pcPlus1 = 0;
+            newStatePtr->IDEX.readRegA = 0;
+            newStatePtr->IDEX.readRegB = 0;
+            newStatePtr->IFID.instr = NOOPINSTRUCTION;
+            newStatePtr->IFID.pcPlus1 = 0;
+            newStatePtr->IFIDnext = PREDICT_NOT_TAKEN;
+            newStatePtr->IFIDras = statePtr->EXMEMras;
         }
 
         /* --------------------- WB stage --------------------- */
 
-        /* lw */
-        if (opcode(state.MEMWB.instr) == 2) {
-            newState.reg[field1(state.MEMWB.instr)] = state.MEMWB.writeData;
+        /* lw, jalr */
+        if (opcode(statePtr->MEMWB.instr) == OP_LW || opcode(statePtr->MEMWB.instr) == OP_JALR) {
+            newStatePtr->reg[field1(statePtr->MEMWB.instr)] = statePtr->MEMWB.writeData;
         }
         /* add, nor */
-        else if (opcode(state.MEMWB.instr) == 0 || opcode(state.MEMWB.instr) == 1) {
-            newState.reg[field2(state.MEMWB.instr)] = state.MEMWB.writeData;
+        else if ((opcode(statePtr->MEMWB.instr) == OP_ADD || opcode(statePtr->MEMWB.instr) == OP_NOR)
+                 && field2(statePtr->MEMWB.instr) < NUMREGS) {
+            newStatePtr->reg[field2(statePtr->MEMWB.instr)] = statePtr->MEMWB.writeData;
         }
 
-        newState.WBEND.instr = state.MEMWB.instr;
-        newState.WBEND.writeData = state.MEMWB.writeData;
+        newStatePtr->WBEND.instr = statePtr->MEMWB.instr;
+        newStatePtr->WBENDdest = statePtr->MEMWBdest;
+        newStatePtr->WBEND.writeData = statePtr->MEMWB.writeData;
 
         
 
-        state = newState; /* this is the last statement before end of the loop.
-                            It marks the end of the cycle and updates the
-                            current state with the values calculated in this cycle */
+        /* this is the last statement before end of the loop.
+           It marks the end of the cycle and makes the values
+           calculated in this cycle the current state */
+        tmpPtr = statePtr;
+        statePtr = newStatePtr;
+        newStatePtr = tmpPtr;
     }
-    /* end of run() */
-    return(0);
 }
 
-void printState(stateType *statePtr) {
+/* an empty pipeline about to fetch arch->pc */
+void pipelineFromArch(stateType *statePtr, const archStateType *arch) {
+    statePtr->pc = arch->pc;
+    memcpy(statePtr->reg, arch->reg, sizeof(statePtr->reg));
+    statePtr->IFID = (IFIDType){NOOPINSTRUCTION, 0};
+    statePtr->IDEX = (IDEXType){NOOPINSTRUCTION, 0, 0, 0, 0};
+    statePtr->EXMEM = (EXMEMType){NOOPINSTRUCTION, 0, 0, 0};
+    statePtr->MEMWB = (MEMWBType){NOOPINSTRUCTION, 0};
+    statePtr->WBEND = (WBENDType){NOOPINSTRUCTION, 0};
+    decodeLatches(statePtr);
+    clearPredictions(statePtr);
+    statePtr->fetchStall = -1;
+    statePtr->memStall = -1;
+}
+
+/*
+ * Drain the pipeline into *arch: MEMWB writes back, and everything younger,
+ * which has not touched registers or memory, is dropped to run again from
+ * the pc of the oldest of them.  Anything on a wrong path is younger than
+ * the branch that will squash it, so that pc is always on the right path.
+ */
+void archFromPipeline(const stateType *statePtr, archStateType *arch) {
+    int instr = statePtr->MEMWB.instr;
+
+    memcpy(arch->reg, statePtr->reg, sizeof(arch->reg));
+    if (opcode(instr) == OP_LW || opcode(instr) == OP_JALR) {
+        arch->reg[field1(instr)] = statePtr->MEMWB.writeData;
+    } else if ((opcode(instr) == OP_ADD || opcode(instr) == OP_NOR) && field2(instr) < NUMREGS) {
+        arch->reg[field2(instr)] = statePtr->MEMWB.writeData;
+    }
+    if (statePtr->EXMEMpcPlus1 != 0) {
+        arch->pc = statePtr->EXMEMpcPlus1 - 1;
+    } else if (statePtr->IDEX.pcPlus1 != 0) {
+        arch->pc = statePtr->IDEX.pcPlus1 - 1;
+    } else if (statePtr->IFID.pcPlus1 != 0) {
+        arch->pc = statePtr->IFID.pcPlus1 - 1;
+    } else {
+        arch->pc = statePtr->pc;
+    }
+}
+
+/* run count instructions functionally, training the predictor and caches on them */
+static int fastForward(stateType *statePtr, archStateType *arch, long long count) {
+    predictorType *predictor = statePtr->predictor;
+    archStepType step;
+    int status = ARCH_RUNNING;
+
+    while (count-- > 0 && status == ARCH_RUNNING) {
+        status = archStep(arch, &statePtr->instrMem, &statePtr->dataMem, &step);
+        if (status == ARCH_BAD_REGISTER || status == ARCH_BAD_PC) {
+            return status;
+        }
+        if (statePtr->icache != NULL) {
+            cacheAccess(statePtr->icache, step.pc, 0);
+        }
+        switch (instOpcode(step.instr)) {
+        case OP_BEQ:
+            predictUpdate(predictor, step.pc, predictor->history, step.taken, step.target);
+            break;
+        case OP_JALR:
+            /* for its return-address stack */
+            predictJump(predictor, step.pc, field0(step.instr), field1(step.instr));
+            predictJumpUpdate(predictor, step.pc, step.target);
+            break;
+        case OP_LW:
+        case OP_SW:
+            if (statePtr->dcache != NULL) {
+                cacheAccess(statePtr->dcache, step.addr, instOpcode(step.instr) == OP_SW);
+            }
+            break;
+        }
+    }
+    return status;
+}
+
+/*
+ * SMARTS-style sampling.  Each period of config->period instructions runs
+ * functionally, up to a detailed window at its end: config->warm
+ * instructions to fill the pipeline, then config->measure whose cycles per
+ * instruction are one sample.  The pipeline starts each window empty from
+ * the functional core's state and drains back into it.  Stops with the
+ * state at halt (returns 1) or on an error (prints it and exits).
+ */
+int runSampled(stateType *statePtr, const sampleConfigType *config, sampleStatsType *stats) {
+    static countersType counters;
+    archStateType arch;
+    int status, halted = 0, cycles;
+    double cpi;
+
+    memset(stats, 0, sizeof(*stats));
+    memset(&arch, 0, sizeof(arch));
+    arch.pc = statePtr->pc;
+    memcpy(arch.reg, statePtr->reg, sizeof(arch.reg));
+    statePtr->counters = &counters;
+    while (1) {
+        status = fastForward(statePtr, &arch, config->period - config->warm - config->measure);
+        if (status == ARCH_BAD_REGISTER || status == ARCH_BAD_PC) {
+            printf("error: %s at pc %d\n", status == ARCH_BAD_PC ? "pc out of memory"
+                   : "destination register is not valid", arch.pc);
+            exit(1);
+        }
+        if (status == ARCH_HALTED) {
+            break;
+        }
+
+        pipelineFromArch(statePtr, &arch);
+        memset(&counters, 0, sizeof(counters));
+        counters.retireLimit = config->warm;
+        halted = config->warm ? run(statePtr, 0) : 0;
+        cycles = statePtr->cycles;
+        if (!halted) {
+            counters.retireLimit = config->warm + config->measure;
+            halted = run(statePtr, 0);
+        }
+        if (!halted) {
+            cpi = (double)(statePtr->cycles - cycles) / config->measure;
+            stats->samples++;
+            stats->sum += cpi;
+            stats->sumSquares += cpi * cpi;
+        }
+        stats->detailed += counters.retired;
+        arch.instructions += counters.retired;
+        archFromPipeline(statePtr, &arch);
+        if (halted) {
+            break;
+        }
+    }
+    statePtr->counters = NULL;
+    pipelineFromArch(statePtr, &arch);
+    stats->instructions = arch.instructions;
+    return 1;
+}
+
+/* Newton's method, so the simulator still builds without libm */
+static double squareRoot(double x) {
+    double root = x > 1.0 ? x : 1.0;
     int i;
-    printf("\n@@@\nstate before cycle %d starts\n", statePtr->cycles);
-    printf("\tpc %d\n", statePtr->pc);
 
-    printf("\tdata memory:\n");
+    if (x <= 0.0) {
+        return 0.0;
+    }
+    for (i = 0; i < 64; i++) {
+        root = (root + x / root) / 2;
+    }
+    return root;
+}
+
+/*
+ * Two-sided 95% quantile of Student's t with df degrees of freedom: a table
+ * up to 30, then the Cornish-Fisher expansion around the normal 1.96.
+ */
+static double studentT95(int df) {
+    static const double table[31] = {
+        0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    double z = 1.959964, z3 = z * z * z;
+
+    if (df <= 30) {
+        return table[df];
+    }
+    return z + (z3 + z) / (4.0 * df) + (5 * z3 * z * z + 16 * z3 + 3 * z) / (96.0 * df * df);
+}
+
+/* total cycles from the mean sampled CPI, with a 95% confidence interval */
+void printSampleEstimate(FILE *fp, const sampleStatsType *stats) {
+    double mean = stats->samples ? stats->sum / stats->samples : 0.0;
+    double deviation, half, needed, variation;
+    int i;
+
+    fprintf(fp, "total of %lld instructions executed, %lld in detail\n", stats->instructions,
+            stats->detailed);
+    if (stats->samples == 0) {
+        fprintf(fp, "no complete samples; make the period shorter than the run\n");
+        return;
+    }
+    if (stats->samples == 1) {
+        fprintf(fp, "estimated %.0f cycles, CPI %.4f from 1 sample\n", mean * stats->instructions,
+                mean);
+        fprintf(fp, "no confidence interval from 1 sample; it needs at least 2, so make the period"
+                " shorter\n");
+        return;
+    }
+    deviation = squareRoot((stats->sumSquares - stats->samples * mean * mean) / (stats->samples - 1));
+    half = studentT95(stats->samples - 1) * deviation / squareRoot(stats->samples);
+    fprintf(fp, "estimated %.0f cycles +- %.0f (95%% confidence), CPI %.4f +- %.4f over %d samples\n",
+            mean * stats->instructions, half * stats->instructions, mean, half, stats->samples);
+    variation = deviation / mean;
+    fprintf(fp, "coefficient of variation %.3f", variation);
+    /* samples for +-3%: n = (t * cv / 0.03)^2, where t itself depends on n */
+    needed = (1.96 * variation / 0.03) * (1.96 * variation / 0.03);
+    for (i = 0; i < 4 && needed < 1e6; i++) {
+        double t = studentT95(needed > 2 ? (int)needed : 1);
+        needed = (t * variation / 0.03) * (t * variation / 0.03);
+    }
+    if (needed > stats->samples) {
+        fprintf(fp, "; about %.0f samples would give +-3%%", needed + 0.5);
+    }
+    fprintf(fp, "\n");
+}
+
+static const timingLatchType timingBubble = {
+    .instr = NOOPINSTRUCTION, .seq = -1, .next = PREDICT_NOT_TAKEN
+};
+
+/* record seq, popped from the ring if fetch has not reached it; NULL if the stream ended first */
+static const archStepType *streamRecord(streamType *stream, long long seq) {
+    while (stream->popped <= seq) {
+        if (!ringPopWait(stream->ring, &stream->window[stream->popped % STREAMWINDOW])) {
+            return NULL;
+        }
+        stream->popped++;
+    }
+    return &stream->window[seq % STREAMWINDOW];
+}
+
+/* branchHazard() on the timing model's latches */
+static inline int timingBranchHazard(const timingStateType *statePtr) {
+    int instr = statePtr->IFID.instr;
+    int regA = field0(instr), regB = opcode(instr) == OP_BEQ ? field1(instr) : regA;
+    int idexDest = forwardDest(statePtr->IDEX.instr), exmemDest = forwardDest(statePtr->EXMEM.instr);
+
+    if (opcode(instr) != OP_BEQ && opcode(instr) != OP_JALR) {
+        return 0;
+    }
+    if (idexDest == regA || idexDest == regB) {
+        return 1;
+    }
+    return opcode(statePtr->EXMEM.instr) == OP_LW && (exmemDest == regA || exmemDest == regB);
+}
+
+/*
+ * The timing half of run(): the same stages, stalls, predictor and caches,
+ * cycle for cycle, with every value replaced by the records of the stream.
+ * Fetch reads instruction memory and predicts as run() does; while it
+ * stays on the path the records took it tags each fetch with the next
+ * record, and once it predicts a pc the record did not go to it fetches
+ * untagged until the branch resolves and redirects it.  Returns 1 when halt
+ * reaches MEMWB, with the cycle count in *machinePtr, 0 if the stream ends
+ * first (the functional thread stopped on an error), or -1 if fetch stops
+ * matching it.
+ *
+ * Matches run() for any program the functional core runs the same way,
+ * which is all of them but those that read reg 0 after writing it: the
+ * pipeline never forwards reg 0.  With resolveInId, run() also resolves
+ * the beq or jalr fetched after halt while halt drains; they have no
+ * record, so here they stay out of the branch report.
+ */
+int runTiming(stateType *machinePtr, streamType *stream) {
+    timingStateType states[2];
+    timingStateType *statePtr = &states[0], *newStatePtr = &states[1], *tmpPtr;
+    predictorType *predictor = machinePtr->predictor;
+    const archStepType *record;
+    int load, next, taken, target;
+
+    statePtr->pc = machinePtr->pc;
+    statePtr->cycles = machinePtr->cycles;
+    statePtr->fetchSeq = stream->popped;
+    statePtr->IFID = timingBubble;
+    statePtr->IDEX = timingBubble;
+    statePtr->EXMEM = timingBubble;
+    statePtr->MEMWB = timingBubble;
+
+    while (1) {
+        machinePtr->cycles = statePtr->cycles;
+
+        /* check for halt */
+        if (opcode(statePtr->MEMWB.instr) == OP_HALT) {
+            return 1;
+        }
+
+        if (machinePtr->dcache != NULL
+                && (opcode(statePtr->EXMEM.instr) == OP_LW || opcode(statePtr->EXMEM.instr) == OP_SW)
+                && cacheStall(machinePtr->dcache, &machinePtr->memStall,
+                              streamRecord(stream, statePtr->EXMEM.seq)->addr,
+                              opcode(statePtr->EXMEM.instr) == OP_SW)) {
+            machinePtr->memStallCycles++;
+            statePtr->cycles++;
+            continue;
+        }
+
+        newStatePtr->pc = statePtr->pc;
+        newStatePtr->fetchSeq = statePtr->fetchSeq;
+        newStatePtr->cycles = statePtr->cycles + 1;
+
+        /* --------------------- IF stage --------------------- */
+        if (machinePtr->icache != NULL
+                && cacheStall(machinePtr->icache, &machinePtr->fetchStall, statePtr->pc, 0)) {
+            machinePtr->fetchStallCycles++;
+            newStatePtr->IFID = timingBubble;
+            newStatePtr->IFID.ras = predictor->rasTop;
+        } else {
+            newStatePtr->IFID.instr = memRead(&machinePtr->instrMem, statePtr->pc);
+            newStatePtr->IFID.pcPlus1 = statePtr->pc + 1;
+            newStatePtr->IFID.seq = statePtr->fetchSeq;
+            if (opcode(newStatePtr->IFID.instr) == OP_JALR) {
+                newStatePtr->IFID.next = predictJump(predictor, statePtr->pc,
+                                                     field0(newStatePtr->IFID.instr),
+                                                     field1(newStatePtr->IFID.instr));
+            } else {
+                newStatePtr->IFID.next = predictNext(predictor, statePtr->pc);
+            }
+            newStatePtr->IFID.history = predictor->history;
+            newStatePtr->IFID.ras = predictor->rasTop;
+            if (newStatePtr->IFID.next == PREDICT_NOT_TAKEN) {
+                newStatePtr->pc++;
+            } else {
+                newStatePtr->pc = newStatePtr->IFID.next;
+            }
+            if (statePtr->fetchSeq >= 0) {
+                /* still on the path: does the fetch after this one stay on it? */
+                record = streamRecord(stream, statePtr->fetchSeq);
+                if (record == NULL) {
+                    return 0;
+                }
+                if (record->pc != statePtr->pc) {
+                    machinePtr->pc = statePtr->pc;
+                    return -1;
+                }
+                if (opcode(record->instr) == OP_HALT) {
+                    next = -1;
+                } else if (opcode(record->instr) == OP_BEQ || opcode(record->instr) == OP_JALR) {
+                    next = record->taken ? record->target : record->pc + 1;
+                } else {
+                    next = record->pc + 1;
+                }
+                newStatePtr->fetchSeq = newStatePtr->pc == next ? statePtr->fetchSeq + 1 : -1;
+            }
+        }
+
+        /* --------------------- ID stage --------------------- */
+        newStatePtr->IDEX = statePtr->IFID;
+        load = opcode(statePtr->IDEX.instr) == OP_LW ? field1(statePtr->IDEX.instr) : -1;
+
+        /* Load-Use data hazard detection and stall, and in ID a branch waiting on EX or a lw */
+        if (load == field0(statePtr->IFID.instr) || load == field1(statePtr->IFID.instr)
+                || (resolveInId && timingBranchHazard(statePtr))) {
+            newStatePtr->IDEX = timingBubble;
+            newStatePtr->pc = statePtr->pc;
+            newStatePtr->fetchSeq = statePtr->fetchSeq;
+            newStatePtr->IFID = statePtr->IFID;
+            predictor->rasTop = statePtr->IFID.ras;
+        } else if (resolveInId && statePtr->IFID.seq >= 0
+                   && (opcode(statePtr->IFID.instr) == OP_BEQ
+                       || opcode(statePtr->IFID.instr) == OP_JALR)) {
+            /* Branch and jump resolution in ID; squash the fetch behind it */
+            record = streamRecord(stream, statePtr->IFID.seq);
+            taken = record->taken;
+            target = record->target;
+            if (opcode(statePtr->IFID.instr) == OP_BEQ) {
+                predictUpdate(predictor, record->pc, statePtr->IFID.history, taken, target);
+            } else {
+                predictJumpUpdate(predictor, record->pc, target);
+            }
+            if (mispredicted(statePtr->IFID.next, taken, target)) {
+                predictor->mispredicts++;
+                predictor->rasTop = statePtr->IFID.ras;
+                machinePtr->fetchStall = -1;
+                newStatePtr->pc = taken ? target : statePtr->IFID.pcPlus1;
+                newStatePtr->fetchSeq = statePtr->IFID.seq + 1;
+                newStatePtr->IFID = timingBubble;
+                newStatePtr->IFID.ras = statePtr->IFID.ras;
+            }
+        }
+
+        /* --------------------- EX stage --------------------- */
+        newStatePtr->EXMEM = statePtr->IDEX;
+
+        /* --------------------- MEM stage --------------------- */
+        newStatePtr->MEMWB = statePtr->EXMEM;
+
+        /* Branch and jump: flush IFID, IDEX and EXMEM when fetch went the wrong way */
+        taken = 0;
+        target = 0;
+        if (!resolveInId && (opcode(statePtr->EXMEM.instr) == OP_BEQ
+                             || opcode(statePtr->EXMEM.instr) == OP_JALR)) {
+            record = streamRecord(stream, statePtr->EXMEM.seq);
+            taken = record->taken;
+            target = record->target;
+            if (opcode(statePtr->EXMEM.instr) == OP_BEQ) {
+                predictUpdate(predictor, record->pc, statePtr->EXMEM.history, taken, target);
+            } else {
+                predictJumpUpdate(predictor, record->pc, target);
+            }
+        }
+        if (!resolveInId && mispredicted(statePtr->EXMEM.next, taken, target)) {
+            predictor->mispredicts++;
+            predictor->rasTop = statePtr->EXMEM.ras;
+            newStatePtr->pc = taken ? target : statePtr->EXMEM.pcPlus1;
+            newStatePtr->fetchSeq = statePtr->EXMEM.seq + 1;
+            machinePtr->fetchStall = -1;
+            newStatePtr->EXMEM = timingBubble;
+            newStatePtr->IDEX = timingBubble;
+            newStatePtr->IFID = timingBubble;
+            newStatePtr->IFID.ras = statePtr->EXMEM.ras;
+        }
+
+        tmpPtr = statePtr;
+        statePtr = newStatePtr;
+        newStatePtr = tmpPtr;
+    }
+}
+
+/* the producer's side of runDecoupled() */
+typedef struct producerStruct {
+    archStateType arch;
+    const memoryType *instrMem;
+    memoryType *dataMem;
+    ringType *ring;
+    int status; /* archStep()'s last */
+} producerType;
+
+/* run the program functionally, pushing a record of every instruction */
+static void *produce(void *arg) {
+    producerType *producer = arg;
+    archStepType step;
+
+    do {
+        producer->status = archStep(&producer->arch, producer->instrMem, producer->dataMem, &step);
+        if (producer->status == ARCH_BAD_REGISTER || producer->status == ARCH_BAD_PC) {
+            break;
+        }
+        ringPushWait(producer->ring, &step);
+    } while (producer->status == ARCH_RUNNING);
+    ringClose(producer->ring);
+    return NULL;
+}
+
+/*
+ * Decoupled simulation: a second thread runs the program functionally and
+ * runs ahead of runTiming() on this one by up to ringSize instructions.
+ * Only the functional thread touches data memory and only this one the
+ * predictor and caches.  Stops with the architectural state at halt in
+ * *statePtr (returns 1) or on an error (prints it and exits).
+ */
+int runDecoupled(stateType *statePtr, int ringSize) {
+    static ringType ring;
+    static producerType producer;
+    static streamType stream;
+    pthread_t thread;
+    int halted;
+
+    ringInit(&ring, ringSize, sizeof(archStepType));
+    memset(&producer.arch, 0, sizeof(producer.arch));
+    producer.arch.pc = statePtr->pc;
+    memcpy(producer.arch.reg, statePtr->reg, sizeof(producer.arch.reg));
+    producer.instrMem = &statePtr->instrMem;
+    producer.dataMem = &statePtr->dataMem;
+    producer.ring = &ring;
+    stream.ring = &ring;
+    stream.popped = 0;
+    if (pthread_create(&thread, NULL, produce, &producer) != 0) {
+        printf("error: can't start the functional thread\n");
+        exit(1);
+    }
+    halted = runTiming(statePtr, &stream);
+    if (halted < 0) {
+        /* the functional thread may never stop; exit() ends it */
+        printf("error: fetch at pc %d left the functional path; a data word that"
+               " decodes differently?\n", statePtr->pc);
+        exit(1);
+    }
+    pthread_join(thread, NULL);
+    ringFree(&ring);
+    if (!halted) {
+        printf("error: %s at pc %d\n", producer.status == ARCH_BAD_PC ? "pc out of memory"
+               : "destination register is not valid", producer.arch.pc);
+        exit(1);
+    }
+    pipelineFromArch(statePtr, &producer.arch);
+    return 1;
+}
+
+static const slotType bubbleSlot = {
+    .instr = NOOPINSTRUCTION, .dest = -1, .next = PREDICT_NOT_TAKEN
+};
+
+void initWideState(wideStateType *widePtr, const stateType *statePtr) {
+    int i;
+
+    widePtr->pc = statePtr->pc;
+    memcpy(widePtr->reg, statePtr->reg, sizeof(widePtr->reg));
+    widePtr->cycles = statePtr->cycles;
+    widePtr->numIFID = 0;
+    for (i = 0; i < MAXWIDTH; i++) {
+        widePtr->IFID[i] = bubbleSlot;
+        widePtr->IDEX[i] = bubbleSlot;
+        widePtr->EXMEM[i] = bubbleSlot;
+        widePtr->MEMWB[i] = bubbleSlot;
+        widePtr->WBEND[i] = bubbleSlot;
+    }
+}
+
+/*
+ * The values EX forwards this cycle, by register: WBEND, then MEMWB, then
+ * EXMEM, oldest slot first, so the youngest writer of each register wins.
+ * Returns a mask of the registers that have one.
+ */
+static int forwardTable(const wideStateType *widePtr, int width, int *value) {
+    int i, mask = 0;
+
+    for (i = 0; i < width; i++) {
+        if (widePtr->WBEND[i].dest >= 0) {
+            value[widePtr->WBEND[i].dest] = widePtr->WBEND[i].writeData;
+            mask |= 1 << widePtr->WBEND[i].dest;
+        }
+    }
+    for (i = 0; i < width; i++) {
+        if (widePtr->MEMWB[i].dest >= 0) {
+            value[widePtr->MEMWB[i].dest] = widePtr->MEMWB[i].writeData;
+            mask |= 1 << widePtr->MEMWB[i].dest;
+        }
+    }
+    for (i = 0; i < width; i++) {
+        if (widePtr->EXMEM[i].dest >= 0) {
+            value[widePtr->EXMEM[i].dest] = widePtr->EXMEM[i].aluResult;
+            mask |= 1 << widePtr->EXMEM[i].dest;
+        }
+    }
+    return mask;
+}
+
+#define FORWARD_WIDE(r, value) (forwardMask >> (r) & 1 ? forwardValue[r] : (value))
+
+static void writeBackSlot(int *reg, const slotType *slotPtr) {
+    if (opcode(slotPtr->instr) == OP_LW || opcode(slotPtr->instr) == OP_JALR) {
+        reg[field1(slotPtr->instr)] = slotPtr->writeData;
+    } else if ((opcode(slotPtr->instr) == OP_ADD || opcode(slotPtr->instr) == OP_NOR)
+               && field2(slotPtr->instr) < NUMREGS) {
+        reg[field2(slotPtr->instr)] = slotPtr->writeData;
+    }
+}
+
+/*
+ * Run the N-wide pipeline from *widePtr, with memory and the predictor in
+ * *machinePtr, until halt reaches MEMWB (returns 1) or maxCycles cycles
+ * have run (returns 0).  pc, registers and cycles are copied back into
+ * *machinePtr.
+ *
+ * Fetch fills IFID up to N instructions in a row, ending early after a
+ * predicted-taken branch.  ID issues IFID in order until an instruction
+ * needs a register a lw in EX is loading (load-use) or an older slot of
+ * the same issue group computes (the bundle dependency); the rest wait in
+ * IFID.  EX forwards from every slot of EXMEM, MEMWB and WBEND, youngest
+ * first, through a table built once a cycle.  MEM handles its slots in
+ * order; a mispredicted beq or jalr squashes the slots after it and
+ * everything behind, like the scalar pipeline, and so does halt.  An add or
+ * nor writing a register above 7 is dropped, as in run().
+ */
+int runWide(stateType *machinePtr, wideStateType *widePtr, int width, int maxCycles,
+            issueStatsType *stats) {
+    wideStateType newState;
+    wideStateType *statePtr = widePtr, *newStatePtr = &newState, *tmpPtr;
+    predictorType *predictor = machinePtr->predictor;
+    const slotType *in;
+    slotType *slotPtr;
+    int forwardValue[NUMREGS], forwardMask;
+    int i, j, n, pc, issued, regA, regB, aluInput0, aluInput1, taken, squash, halted = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->width = width;
+    while (1) {
+
+        if (printEvery && statePtr->cycles % printEvery == 0) {
+            printWideState(machinePtr, statePtr, width);
+        }
+
+        /* check for halt; the slots ahead of it still write back */
+        for (i = 0; i < width; i++) {
+            if (statePtr->MEMWB[i].valid && opcode(statePtr->MEMWB[i].instr) == OP_HALT) {
+                for (j = 0; j < i; j++) {
+                    writeBackSlot(statePtr->reg, &statePtr->MEMWB[j]);
+                    stats->retired += statePtr->MEMWB[j].valid;
+                }
+                stats->retired++;
+                halted = 1;
+                break;
+            }
+        }
+        if (halted || (maxCycles && statePtr->cycles >= maxCycles)) {
+            break;
+        }
+
+        newStatePtr->pc = statePtr->pc;
+        memcpy(newStatePtr->reg, statePtr->reg, sizeof(statePtr->reg));
+        newStatePtr->cycles = statePtr->cycles + 1;
+
+        /* --------------------- ID stage --------------------- */
+        for (issued = 0; issued < statePtr->numIFID; issued++) {
+            in = &statePtr->IFID[issued];
+            sourceRegs(in->instr, &regA, &regB);
+            for (j = 0; j < width; j++) {
+                if (opcode(statePtr->IDEX[j].instr) == OP_LW && statePtr->IDEX[j].dest >= 0
+                        && (statePtr->IDEX[j].dest == regA || statePtr->IDEX[j].dest == regB)) {
+                    break;
+                }
+            }
+            if (j < width) {
+                stats->loadUseStalls++;
+                break;
+            }
+            for (j = 0; j < issued; j++) {
+                if (statePtr->IFID[j].dest >= 0
+                        && (statePtr->IFID[j].dest == regA || statePtr->IFID[j].dest == regB)) {
+                    break;
+                }
+            }
+            if (j < issued) {
+                stats->bundleStalls++;
+                break;
+            }
+            slotPtr = &newStatePtr->IDEX[issued];
+            *slotPtr = *in;
+            slotPtr->readRegA = statePtr->reg[field0(in->instr)];
+            slotPtr->readRegB = statePtr->reg[field1(in->instr)];
+            slotPtr->offset = convertNum(field2(in->instr));
+        }
+        for (i = issued; i < width; i++) {
+            newStatePtr->IDEX[i] = bubbleSlot;
+        }
+        stats->issued[issued]++;
+        stats->emptyCycles += statePtr->numIFID == 0;
+
+        /* --------------------- IF stage --------------------- */
+        /* the instructions that did not issue move up; fetch fills in behind */
+        n = 0;
+        for (i = issued; i < statePtr->numIFID; i++) {
+            newStatePtr->IFID[n++] = statePtr->IFID[i];
+        }
+        pc = statePtr->pc;
+        while (n < width) {
+            slotPtr = &newStatePtr->IFID[n++];
+            *slotPtr = bubbleSlot;
+            slotPtr->instr = memRead(&machinePtr->instrMem, pc);
+            slotPtr->valid = 1;
+            slotPtr->pcPlus1 = pc + 1;
+            slotPtr->dest = forwardDest(slotPtr->instr);
+            if (opcode(slotPtr->instr) == OP_JALR) {
+                slotPtr->next = predictJump(predictor, pc, field0(slotPtr->instr),
+                                            field1(slotPtr->instr));
+            } else {
+                slotPtr->next = predictNext(predictor, pc);
+            }
+            slotPtr->history = predictor->history;
+            slotPtr->ras = predictor->rasTop;
+            if (slotPtr->next != PREDICT_NOT_TAKEN) {
+                pc = slotPtr->next;
+                break;
+            }
+            pc++;
+        }
+        newStatePtr->numIFID = n;
+        newStatePtr->pc = pc;
+
+        /* --------------------- EX stage --------------------- */
+        forwardMask = forwardTable(statePtr, width, forwardValue);
+        for (i = 0; i < width; i++) {
+            in = &statePtr->IDEX[i];
+            slotPtr = &newStatePtr->EXMEM[i];
+            *slotPtr = *in;
+            aluInput0 = FORWARD_WIDE(field0(in->instr), in->readRegA);
+            if (opcode(in->instr) == OP_LW || opcode(in->instr) == OP_SW) {
+                aluInput1 = in->offset;
+                slotPtr->store = FORWARD_WIDE(field1(in->instr), in->readRegB);
+            } else {
+                aluInput1 = FORWARD_WIDE(field1(in->instr), in->readRegB);
+            }
+            switch (opcode(in->instr)) {
+            case OP_ADD:
+            case OP_LW:
+            case OP_SW:
+                slotPtr->aluResult = aluInput0 + aluInput1;
+                break;
+            case OP_NOR:
+                slotPtr->aluResult = ~(aluInput0 | aluInput1);
+                break;
+            case OP_BEQ:
+                slotPtr->aluResult = aluInput0 - aluInput1;
+                break;
+            case OP_JALR:
+                slotPtr->aluResult = in->pcPlus1;
+                break;
+            }
+            slotPtr->branchTarget = in->pcPlus1 + in->offset;
+            if (opcode(in->instr) == OP_JALR) {
+                slotPtr->branchTarget = field0(in->instr) == field1(in->instr)
+                                        ? in->pcPlus1 : aluInput0;
+            }
+        }
+
+        /* --------------------- MEM stage --------------------- */
+        squash = 0;
+        for (i = 0; i < width; i++) {
+            in = &statePtr->EXMEM[i];
+            slotPtr = &newStatePtr->MEMWB[i];
+            if (squash) {
+                *slotPtr = bubbleSlot;
+                continue;
+            }
+            *slotPtr = *in;
+            slotPtr->writeData = in->aluResult;
+            taken = 0;
+            switch (opcode(in->instr)) {
+            case OP_LW:
+                slotPtr->writeData = memRead(&machinePtr->dataMem, in->aluResult);
+                break;
+            case OP_SW:
+                memWrite(&machinePtr->dataMem, in->aluResult, in->store);
+                break;
+            case OP_HALT:
+                squash = 1;
+                break;
+            case OP_BEQ:
+                taken = in->aluResult == 0;
+                predictUpdate(predictor, in->pcPlus1 - 1, in->history, taken, in->branchTarget);
+                break;
+            case OP_JALR:
+                taken = 1;
+                predictJumpUpdate(predictor, in->pcPlus1 - 1, in->branchTarget);
+                break;
+            }
+            if (mispredicted(in->next, taken, in->branchTarget)) {
+                predictor->mispredicts++;
+                predictor->rasTop = in->ras;
+                newStatePtr->pc = taken ? in->branchTarget : in->pcPlus1;
+                newStatePtr->numIFID = 0;
+                for (j = 0; j < width; j++) {
+                    newStatePtr->IDEX[j] = bubbleSlot;
+                    newStatePtr->EXMEM[j] = bubbleSlot;
+                }
+                squash = 1;
+            }
+        }
+
+        /* --------------------- WB stage --------------------- */
+        for (i = 0; i < width; i++) {
+            writeBackSlot(newStatePtr->reg, &statePtr->MEMWB[i]);
+            stats->retired += statePtr->MEMWB[i].valid;
+            newStatePtr->WBEND[i] = statePtr->MEMWB[i];
+        }
+
+        tmpPtr = statePtr;
+        statePtr = newStatePtr;
+        newStatePtr = tmpPtr;
+    }
+
+    if (statePtr != widePtr) {
+        *widePtr = *statePtr;
+    }
+    machinePtr->pc = widePtr->pc;
+    memcpy(machinePtr->reg, widePtr->reg, sizeof(machinePtr->reg));
+    machinePtr->cycles = widePtr->cycles;
+    stats->cycles = widePtr->cycles;
+    return halted;
+}
+
+static void printSlots(const char *latch, const slotType *slots, int count) {
+    int i;
+
+    writeStr(&out, "\t");
+    writeStr(&out, latch);
+    writeStr(&out, ":\n");
+    for (i = 0; i < count; i++) {
+        writeStr(&out, "\t\t[ ");
+        writeInt(&out, i);
+        writeStr(&out, " ] ");
+        printInstruction(slots[i].instr);
+    }
+}
+
+/* the wide pipeline's state: the machine as printState() shows it, then one line per slot */
+void printWideState(stateType *machinePtr, const wideStateType *widePtr, int width) {
+    machinePtr->pc = widePtr->pc;
+    memcpy(machinePtr->reg, widePtr->reg, sizeof(machinePtr->reg));
+    machinePtr->cycles = widePtr->cycles;
+    printMachine(machinePtr);
+    printSlots("IFID", widePtr->IFID, widePtr->numIFID);
+    printSlots("IDEX", widePtr->IDEX, width);
+    printSlots("EXMEM", widePtr->EXMEM, width);
+    printSlots("MEMWB", widePtr->MEMWB, width);
+    printSlots("WBEND", widePtr->WBEND, width);
+    writerFlush(&out);
+}
+
+void printIssueReport(FILE *fp, const issueStatsType *stats) {
+    int i;
+
+    fprintf(fp, "issue report (width %d):\n", stats->width);
+    fprintf(fp, "\tcycles %lld instructions %lld CPI %.3f IPC %.3f\n", stats->cycles,
+            stats->retired, stats->retired ? (double)stats->cycles / stats->retired : 0.0,
+            stats->cycles ? (double)stats->retired / stats->cycles : 0.0);
+    fprintf(fp, "\tcycles issuing");
+    for (i = 0; i <= stats->width; i++) {
+        fprintf(fp, " %d: %lld", i, stats->issued[i]);
+    }
+    fprintf(fp, "\n\tissue stopped by bundle dependency %lld, load-use %lld; nothing to issue %lld\n",
+            stats->bundleStalls, stats->loadUseStalls, stats->emptyCycles);
+}
+
+void initOooState(oooStateType *oooPtr, const stateType *statePtr) {
+    int i;
+
+    memset(oooPtr, 0, sizeof(*oooPtr));
+    oooPtr->pc = statePtr->pc;
+    memcpy(oooPtr->reg, statePtr->reg, sizeof(oooPtr->reg));
+    oooPtr->cycles = statePtr->cycles;
+    for (i = 0; i < NUMREGS; i++) {
+        oooPtr->rename[i] = -1;
+    }
+}
+
+static int functionalUnit(int instr) {
+    switch (opcode(instr)) {
+    case OP_LW:
+    case OP_SW:
+        return FU_MEM;
+    case OP_BEQ:
+    case OP_JALR:
+        return FU_BRANCH;
+    }
+    return FU_ALU;
+}
+
+/* register r as dispatch sees it: a value, or the tag of the entry that will write it */
+static void renameSource(const oooStateType *oooPtr, int r, int *tag, int *operand) {
+    int writer = oooPtr->rename[r];
+
+    *tag = -1;
+    if (writer < 0) {
+        *operand = oooPtr->reg[r];
+    } else if (oooPtr->rob[writer].state == ROB_DONE) {
+        *operand = oooPtr->rob[writer].value;
+    } else {
+        *tag = writer;
+    }
+}
+
+/*
+ * Whether the lw i entries from the ROB head, whose address is known, may
+ * read now, and what it reads.  It waits while an older sw has no address
+ * yet, or stores to the same word and has no data yet.  The youngest older
+ * sw to that word is forwarded; with none, memory has the value, since
+ * stores only write memory when they commit.
+ */
+static int loadReady(const oooStateType *oooPtr, int robSize, int i, const memoryType *mem,
+                     int *value, oooStatsType *stats) {
+    const robEntryType *load = &oooPtr->rob[(oooPtr->head + i) % robSize];
+    const robEntryType *older;
+    int addr = load->operand[0] + convertNum(field2(load->instr));
+
+    while (--i >= 0) {
+        older = &oooPtr->rob[(oooPtr->head + i) % robSize];
+        if (opcode(older->instr) != OP_SW) {
+            continue;
+        }
+        if (older->tag[0] >= 0) {
+            return 0;
+        }
+        if (older->operand[0] + convertNum(field2(older->instr)) == addr) {
+            if (older->tag[1] >= 0) {
+                return 0;
+            }
+            *value = older->operand[1];
+            stats->loadsForwarded++;
+            return 1;
+        }
+    }
+    *value = memRead(mem, addr);
+    return 1;
+}
+
+/*
+ * Run the out-of-order core from *oooPtr, with memory and the predictor in
+ * *machinePtr, until halt commits (returns 1) or maxCycles cycles have run
+ * (returns 0).  pc, registers and cycles are copied back into *machinePtr.
+ *
+ * Each cycle, in this order:
+ *
+ *   commit    up to width finished entries leave the ROB head in order,
+ *             writing the register file, memory (sw) and the predictor;
+ *   complete  entries whose functional unit is done broadcast their result
+ *             to the reservation stations waiting on them, oldest first;
+ *             a mispredicted beq or jalr squashes every younger entry,
+ *             rebuilds the rename table from what is left and refetches;
+ *   issue     up to width entries whose operands are all ready start on a
+ *             functional unit, oldest first (a lw also waits on older sw,
+ *             see loadReady());
+ *   dispatch  fetched instructions take a ROB entry, a reservation station
+ *             and, for lw and sw, a load/store queue slot, in order, until
+ *             one is full; sources are renamed to values or ROB tags;
+ *   fetch     up to width instructions, as in the wide pipeline, stopping
+ *             at a halt.
+ *
+ * Only commit changes architectural state, so halt and mispredicts are
+ * precise.  Register 0 is renamed like any other, as the functional
+ * simulator writes it.
+ */
+int runOoo(stateType *machinePtr, oooStateType *oooPtr, const oooConfigType *config,
+           int maxCycles, oooStatsType *stats) {
+    predictorType *predictor = machinePtr->predictor;
+    robEntryType *entry, *waiter;
+    slotType *slotPtr;
+    int i, j, k, n, idx, op, pc, issued, regs[2], halted = 0;
+    int width = config->width, robSize = config->robSize;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->config = *config;
+    while (1) {
+
+        if (printEvery && oooPtr->cycles % printEvery == 0) {
+            printOooState(machinePtr, oooPtr, robSize);
+        }
+        if (halted || (maxCycles && oooPtr->cycles >= maxCycles)) {
+            break;
+        }
+
+        /* --------------------- commit --------------------- */
+        for (n = 0; n < width && oooPtr->count > 0 && !halted; n++) {
+            idx = oooPtr->head;
+            entry = &oooPtr->rob[idx];
+            if (entry->state != ROB_DONE) {
+                break;
+            }
+            op = opcode(entry->instr);
+            if (op == OP_HALT) {
+                oooPtr->pc = entry->pc + 1;
+                halted = 1;
+            } else if (op == OP_SW) {
+                memWrite(&machinePtr->dataMem, entry->target, entry->value);
+            } else if (op == OP_BEQ) {
+                predictUpdate(predictor, entry->pc, entry->history, entry->taken, entry->target);
+            } else if (op == OP_JALR) {
+                predictJumpUpdate(predictor, entry->pc, entry->target);
+            }
+            if (entry->dest >= 0) {
+                oooPtr->reg[entry->dest] = entry->value;
+                if (oooPtr->rename[entry->dest] == idx) {
+                    oooPtr->rename[entry->dest] = -1;
+                }
+            }
+            oooPtr->lsqUsed -= op == OP_LW || op == OP_SW;
+            oooPtr->head = (idx + 1) % robSize;
+            oooPtr->count--;
+            stats->committed++;
+        }
+
+        /* --------------------- complete --------------------- */
+        for (i = 0; i < oooPtr->count && !halted; i++) {
+            idx = (oooPtr->head + i) % robSize;
+            entry = &oooPtr->rob[idx];
+            if (entry->state != ROB_EXECUTING || entry->doneCycle > oooPtr->cycles) {
+                continue;
+            }
+            entry->state = ROB_DONE;
+            for (j = i + 1; j < oooPtr->count && entry->dest >= 0; j++) {
+                waiter = &oooPtr->rob[(oooPtr->head + j) % robSize];
+                for (k = 0; k < 2; k++) {
+                    if (waiter->tag[k] == idx) {
+                        waiter->tag[k] = -1;
+                        waiter->operand[k] = entry->value;
+                    }
+                }
+            }
+            if (!mispredicted(entry->next, entry->taken, entry->target)) {
+                continue;
+            }
+            stats->mispredicts++;
+            predictor->mispredicts++;
+            predictor->rasTop = entry->ras;
+            for (j = i + 1; j < oooPtr->count; j++) {
+                waiter = &oooPtr->rob[(oooPtr->head + j) % robSize];
+                op = opcode(waiter->instr);
+                oooPtr->rsUsed -= waiter->state == ROB_WAITING && op != OP_NOOP && op != OP_HALT;
+                oooPtr->lsqUsed -= op == OP_LW || op == OP_SW;
+                stats->squashed++;
+            }
+            stats->squashed += oooPtr->numFetched;
+            oooPtr->count = i + 1;
+            for (j = 0; j < NUMREGS; j++) {
+                oooPtr->rename[j] = -1;
+            }
+            for (j = 0; j <= i; j++) {
+                k = (oooPtr->head + j) % robSize;
+                if (oooPtr->rob[k].dest >= 0) {
+                    oooPtr->rename[oooPtr->rob[k].dest] = k;
+                }
+            }
+            oooPtr->pc = entry->taken ? entry->target : entry->pc + 1;
+            oooPtr->numFetched = 0;
+            oooPtr->fetchStopped = 0;
+        }
+
+        /* --------------------- issue --------------------- */
+        for (i = 0, issued = 0; i < oooPtr->count && issued < width && !halted; i++) {
+            entry = &oooPtr->rob[(oooPtr->head + i) % robSize];
+            if (entry->state != ROB_WAITING || entry->tag[0] >= 0 || entry->tag[1] >= 0) {
+                continue;
+            }
+            switch (opcode(entry->instr)) {
+            case OP_ADD:
+                entry->value = entry->operand[0] + entry->operand[1];
+                break;
+            case OP_NOR:
+                entry->value = ~(entry->operand[0] | entry->operand[1]);
+                break;
+            case OP_LW:
+                if (!loadReady(oooPtr, robSize, i, &machinePtr->dataMem, &entry->value, stats)) {
+                    stats->loadsBlocked++;
+                    continue;
+                }
+                entry->target = entry->operand[0] + convertNum(field2(entry->instr));
+                break;
+            case OP_SW:
+                entry->target = entry->operand[0] + convertNum(field2(entry->instr));
+                entry->value = entry->operand[1];
+                break;
+            case OP_BEQ:
+                entry->taken = entry->operand[0] == entry->operand[1];
+                entry->target = entry->pc + 1 + convertNum(field2(entry->instr));
+                break;
+            case OP_JALR:
+                entry->value = entry->pc + 1;
+                entry->taken = 1;
+                entry->target = field0(entry->instr) == field1(entry->instr)
+                                ? entry->pc + 1 : entry->operand[0];
+                break;
+            }
+            entry->state = ROB_EXECUTING;
+            entry->doneCycle = oooPtr->cycles + config->latency[functionalUnit(entry->instr)];
+            oooPtr->rsUsed--;
+            issued++;
+        }
+        stats->issued[issued]++;
+
+        /* --------------------- dispatch --------------------- */
+        for (n = 0; n < oooPtr->numFetched && !halted; n++) {
+            slotPtr = &oooPtr->fetched[n];
+            op = opcode(slotPtr->instr);
+            if (oooPtr->count == robSize) {
+                stats->robFull++;
+                break;
+            }
+            if (op != OP_NOOP && op != OP_HALT && oooPtr->rsUsed == config->rsSize) {
+                stats->rsFull++;
+                break;
+            }
+            if ((op == OP_LW || op == OP_SW) && oooPtr->lsqUsed == config->lsqSize) {
+                stats->lsqFull++;
+                break;
+            }
+            idx = (oooPtr->head + oooPtr->count++) % robSize;
+            entry = &oooPtr->rob[idx];
+            entry->instr = slotPtr->instr;
+            entry->pc = slotPtr->pcPlus1 - 1;
+            entry->next = slotPtr->next;
+            entry->history = slotPtr->history;
+            entry->ras = slotPtr->ras;
+            entry->taken = 0;
+            entry->target = 0;
+            entry->value = 0;
+            sourceRegs(slotPtr->instr, &regs[0], &regs[1]);
+            for (k = 0; k < 2; k++) {
+                entry->tag[k] = -1;
+                entry->operand[k] = 0;
+                if (regs[k] >= 0) {
+                    renameSource(oooPtr, regs[k], &entry->tag[k], &entry->operand[k]);
+                }
+            }
+            entry->dest = writtenReg(slotPtr->instr);
+            if (entry->dest >= NUMREGS) {
+                entry->dest = -1; /* the write is dropped */
+            }
+            if (entry->dest >= 0) {
+                oooPtr->rename[entry->dest] = idx;
+            }
+            if (op == OP_NOOP || op == OP_HALT) {
+                entry->state = ROB_DONE;
+            } else {
+                entry->state = ROB_WAITING;
+                oooPtr->rsUsed++;
+            }
+            oooPtr->lsqUsed += op == OP_LW || op == OP_SW;
+        }
+        stats->fetchEmpty += oooPtr->numFetched == 0;
+        for (i = n; i < oooPtr->numFetched; i++) {
+            oooPtr->fetched[i - n] = oooPtr->fetched[i];
+        }
+        oooPtr->numFetched -= n;
+
+        /* --------------------- fetch --------------------- */
+        pc = oooPtr->pc;
+        while (!halted && !oooPtr->fetchStopped && oooPtr->numFetched < width) {
+            slotPtr = &oooPtr->fetched[oooPtr->numFetched++];
+            slotPtr->instr = memRead(&machinePtr->instrMem, pc);
+            slotPtr->pcPlus1 = pc + 1;
+            if (opcode(slotPtr->instr) == OP_JALR) {
+                slotPtr->next = predictJump(predictor, pc, field0(slotPtr->instr),
+                                            field1(slotPtr->instr));
+            } else {
+                slotPtr->next = predictNext(predictor, pc);
+            }
+            slotPtr->history = predictor->history;
+            slotPtr->ras = predictor->rasTop;
+            if (opcode(slotPtr->instr) == OP_HALT) {
+                oooPtr->fetchStopped = 1;
+            }
+            if (slotPtr->next != PREDICT_NOT_TAKEN) {
+                pc = slotPtr->next;
+                break;
+            }
+            pc++;
+        }
+        if (!halted) {
+            oooPtr->pc = pc;
+        }
+
+        stats->robOccupancy += oooPtr->count;
+        oooPtr->cycles++;
+    }
+
+    machinePtr->pc = oooPtr->pc;
+    memcpy(machinePtr->reg, oooPtr->reg, sizeof(machinePtr->reg));
+    machinePtr->cycles = oooPtr->cycles;
+    stats->cycles = oooPtr->cycles;
+    return halted;
+}
+
+/* the out-of-order core's state: the machine as printState() shows it, then the ROB */
+void printOooState(stateType *machinePtr, const oooStateType *oooPtr, int robSize) {
+    static const char *stateNames[] = {"waiting", "executing", "done"};
+    const robEntryType *entry;
+    int i;
+
+    machinePtr->pc = oooPtr->pc;
+    memcpy(machinePtr->reg, oooPtr->reg, sizeof(machinePtr->reg));
+    machinePtr->cycles = oooPtr->cycles;
+    printMachine(machinePtr);
+    writeStr(&out, "\tROB:\n");
+    for (i = 0; i < oooPtr->count; i++) {
+        entry = &oooPtr->rob[(oooPtr->head + i) % robSize];
+        writeStr(&out, "\t\t[ ");
+        writeInt(&out, entry->pc);
+        writeStr(&out, " ] ");
+        writeStr(&out, stateNames[entry->state]);
+        writeStr(&out, " ");
+        printInstruction(entry->instr);
+    }
+    writerFlush(&out);
+}
+
+void printOooReport(FILE *fp, const oooStatsType *stats) {
+    const oooConfigType *config = &stats->config;
+    int i;
+
+    fprintf(fp, "ooo report (width %d, rob %d, rs %d, lsq %d, latency alu %d mem %d branch %d):\n",
+            config->width, config->robSize, config->rsSize, config->lsqSize,
+            config->latency[FU_ALU], config->latency[FU_MEM], config->latency[FU_BRANCH]);
+    fprintf(fp, "\tcycles %lld instructions %lld CPI %.3f IPC %.3f\n", stats->cycles,
+            stats->committed, stats->committed ? (double)stats->cycles / stats->committed : 0.0,
+            stats->cycles ? (double)stats->committed / stats->cycles : 0.0);
+    fprintf(fp, "\taverage rob occupancy %.1f; cycles issuing",
+            stats->cycles ? (double)stats->robOccupancy / stats->cycles : 0.0);
+    for (i = 0; i <= config->width; i++) {
+        fprintf(fp, " %d: %lld", i, stats->issued[i]);
+    }
+    fprintf(fp, "\n\tdispatch stopped by full rob %lld, reservation stations %lld, lsq %lld;"
+            " nothing fetched %lld\n", stats->robFull, stats->rsFull, stats->lsqFull,
+            stats->fetchEmpty);
+    fprintf(fp, "\tloads forwarded from a sw %lld, cycles a load waited on a sw %lld\n",
+            stats->loadsForwarded, stats->loadsBlocked);
+    fprintf(fp, "\tmispredicts %lld, instructions squashed %lld\n", stats->mispredicts,
+            stats->squashed);
+}
+
+/* state header, data memory and registers */
+static void printMachine(stateType *statePtr) {
+    int i;
+    writeStr(&out, "\n@@@\nstate before cycle ");
+    writeInt(&out, statePtr->cycles);
+    writeStr(&out, " starts\n\tpc ");
+    writeInt(&out, statePtr->pc);
+    writeStr(&out, "\n");
+
+    writeStr(&out, "\tdata memory:\n");
         for (i=0; i<statePtr->numMemory; i++) {
-            printf("\t\tdataMem[ %d ] %d\n", i, statePtr->dataMem[i]);
+            writeStr(&out, "\t\tdataMem[ ");
+            writeInt(&out, i);
+            writeStr(&out, " ] ");
+            writeInt(&out, memRead(&statePtr->dataMem, i));
+            writeStr(&out, "\n");
         }
-    printf("\tregisters:\n");
+    writeStr(&out, "\tregisters:\n");
         for (i=0; i<NUMREGS; i++) {
-            printf("\t\treg[ %d ] %d\n", i, statePtr->reg[i]);
+            writeStr(&out, "\t\treg[ ");
+            writeInt(&out, i);
+            writeStr(&out, " ] ");
+            writeInt(&out, statePtr->reg[i]);
+            writeStr(&out, "\n");
         }
-    printf("\tIFID:\n");
-        printf("\t\tinstruction ");
+}
+
+void printState(stateType *statePtr) {
+    printMachine(statePtr);
+    writeStr(&out, "\tIFID:\n");
+        writeStr(&out, "\t\tinstruction ");
         printInstruction(statePtr->IFID.instr);
-        printf("\t\tpcPlus1 %d\n", statePtr->IFID.pcPlus1);
-    printf("\tIDEX:\n");
-        printf("\t\tinstruction ");
+        writeField("pcPlus1", statePtr->IFID.pcPlus1);
+    writeStr(&out, "\tIDEX:\n");
+        writeStr(&out, "\t\tinstruction ");
         printInstruction(statePtr->IDEX.instr);
-        printf("\t\tpcPlus1 %d\n", statePtr->IDEX.pcPlus1);
-        printf("\t\treadRegA %d\n", statePtr->IDEX.readRegA);
-        printf("\t\treadRegB %d\n", statePtr->IDEX.readRegB);
-        printf("\t\toffset %d\n", statePtr->IDEX.offset);
-    printf("\tEXMEM:\n");
-        printf("\t\tinstruction ");
+        writeField("pcPlus1", statePtr->IDEX.pcPlus1);
+        writeField("readRegA", statePtr->IDEX.readRegA);
+        writeField("readRegB", statePtr->IDEX.readRegB);
+        writeField("offset", statePtr->IDEX.offset);
+    writeStr(&out, "\tEXMEM:\n");
+        writeStr(&out, "\t\tinstruction ");
         printInstruction(statePtr->EXMEM.instr);
-        printf("\t\tbranchTarget %d\n", statePtr->EXMEM.branchTarget);
-        printf("\t\taluResult %d\n", statePtr->EXMEM.aluResult);
-        printf("\t\treadRegB %d\n", statePtr->EXMEM.readRegB);
-    printf("\tMEMWB:\n");
-        printf("\t\tinstruction ");
+        writeField("branchTarget", statePtr->EXMEM.branchTarget);
+        writeField("aluResult", statePtr->EXMEM.aluResult);
+        writeField("readRegB", statePtr->EXMEM.readRegB);
+    writeStr(&out, "\tMEMWB:\n");
+        writeStr(&out, "\t\tinstruction ");
         printInstruction(statePtr->MEMWB.instr);
-        printf("\t\twriteData %d\n", statePtr->MEMWB.writeData);
-    printf("\tWBEND:\n");
-        printf("\t\tinstruction ");
+        writeField("writeData", statePtr->MEMWB.writeData);
+    writeStr(&out, "\tWBEND:\n");
+        writeStr(&out, "\t\tinstruction ");
         printInstruction(statePtr->WBEND.instr);
-        printf("\t\twriteData %d\n", statePtr->WBEND.writeData);
+        writeField("writeData", statePtr->WBEND.writeData);
+    writerFlush(&out);
 }
 
 int field0(int instruction)
 {
-    return( (instruction>>19) & 0x7);
+    return(instRegA(instruction));
 }
 
 int field1(int instruction)
 {
-    return( (instruction>>16) & 0x7);
+    return(instRegB(instruction));
 }
 
 int field2(int instruction)
 {
-    return(instruction & 0xFFFF);
+    return(instField2(instruction));
 }
 
+/* unmasked on purpose: data words may decode outside 0-7 and print as data */
 int opcode(int instruction)
 {
     return(instruction>>22);
 }
 
 void printInstruction(int instr) {
-    char opcodeString[10];
-
-    if (opcode(instr) == ADD) {
-        strcpy(opcodeString, "add");
-    } else if (opcode(instr) == NOR) {
-        strcpy(opcodeString, "nor");
-    } else if (opcode(instr) == LW) {
-        strcpy(opcodeString, "lw");
-    } else if (opcode(instr) == SW) {
-        strcpy(opcodeString, "sw");
-    } else if (opcode(instr) == BEQ) {
-        strcpy(opcodeString, "beq");
-    } else if (opcode(instr) == JALR) {
-        strcpy(opcodeString, "jalr");
-    } else if (opcode(instr) == HALT) {
-        strcpy(opcodeString, "halt");
-    } else if (opcode(instr) == NOOP) {
-        strcpy(opcodeString, "noop");
-    } else {
-        strcpy(opcodeString, "data");
+    const char *opcodeString = "data";
+
+    if (opcode(instr) >= 0 && opcode(instr) < NUMINSTOPCODES) {
+        opcodeString = opTable[opcode(instr)].name;
     }
-    printf("%s %d %d %d\n", opcodeString, field0(instr), field1(instr),
-                field2(instr));
+    /* goes to the writer; callers flush */
+    writeStr(&out, opcodeString);
+    writeStr(&out, " ");
+    writeInt(&out, field0(instr));
+    writeStr(&out, " ");
+    writeInt(&out, field1(instr));
+    writeStr(&out, " ");
+    writeInt(&out, field2(instr));
+    writeStr(&out, "\n");
 }
 
 /* convert a 16-bit number into a 32-bit */
 int convertNum(int num) {
-    if (num & (1<<15) ) {
-        num -= (1<<16);
+    return(signExtend16(num));
+}
+
+/*
+ * Batch mode: run every job of a manifest (see common/batch.h) on the
+ * work-stealing pool.  Each worker reuses its own state.
+ */
+typedef struct batchRunStruct {
+    batchType batch;
+    stateType **states; /* one per worker */
+    int cycleLimit;
+    const predictorKindType *predictorKind;
+    int useRas;
+    int width;
+    predictorType **predictors; /* one per worker */
+    const cacheSetupType *cacheSetup;
+    cachesType **caches; /* one per worker */
+    wideStateType **wides; /* one per worker, with width > 1 */
+    const oooConfigType *ooo; /* NULL for the in-order pipeline */
+    oooStateType **ooos; /* one per worker, with ooo */
+} batchRunType;
+
+void runBatchJob(void *arg, int worker, int jobNum) {
+    batchRunType *runPtr = arg;
+    batchJobType *job = &runPtr->batch.jobs[jobNum];
+    batchImageType *image = &runPtr->batch.images[job->image];
+    stateType *statePtr = runPtr->states[worker];
+    predictorType *predictor = runPtr->predictors[worker];
+    cachesType *caches = runPtr->caches[worker];
+    wideStateType *widePtr = runPtr->wides[worker];
+    oooStateType *oooPtr = runPtr->ooos[worker];
+    issueStatsType issueStats;
+    oooStatsType oooStats;
+    int i, halted;
+
+    if (image->error != NULL) {
+        job->error = image->error;
+        return;
+    }
+    if (statePtr == NULL) {
+        statePtr = runPtr->states[worker] = malloc(sizeof(stateType));
+        predictor = runPtr->predictors[worker] = malloc(sizeof(predictorType));
+        caches = runPtr->caches[worker] = malloc(sizeof(cachesType));
+        widePtr = runPtr->wides[worker] = malloc(sizeof(wideStateType));
+        oooPtr = runPtr->ooos[worker] = malloc(sizeof(oooStateType));
+        if (statePtr == NULL || predictor == NULL || caches == NULL || widePtr == NULL
+                || oooPtr == NULL) {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+    }
+    memset(statePtr, 0, sizeof(stateType));
+    memSnapshot(&statePtr->instrMem, &image->mem);
+    memSnapshot(&statePtr->dataMem, &image->mem);
+    statePtr->numMemory = image->numWords;
+    initState(statePtr);
+    predictInit(predictor, runPtr->predictorKind);
+    predictor->useRas = runPtr->useRas;
+    statePtr->predictor = predictor;
+    initCaches(statePtr, caches, runPtr->cacheSetup);
+    for (i = 0; i < job->numOverrides; i++) {
+        if (job->overrides[i].isMem) {
+            memWrite(&statePtr->instrMem, job->overrides[i].index, job->overrides[i].value);
+            memWrite(&statePtr->dataMem, job->overrides[i].index, job->overrides[i].value);
+        } else {
+            statePtr->reg[job->overrides[i].index] = job->overrides[i].value;
+        }
+    }
+
+    if (runPtr->ooo != NULL) {
+        initOooState(oooPtr, statePtr);
+        halted = runOoo(statePtr, oooPtr, runPtr->ooo, runPtr->cycleLimit, &oooStats);
+    } else if (runPtr->width > 1) {
+        initWideState(widePtr, statePtr);
+        halted = runWide(statePtr, widePtr, runPtr->width, runPtr->cycleLimit, &issueStats);
+    } else {
+        halted = run(statePtr, runPtr->cycleLimit);
+    }
+    if (!halted) {
+        job->error = "cycle limit reached";
+    }
+    job->count = statePtr->cycles;
+    job->pc = statePtr->pc;
+    memcpy(job->reg, statePtr->reg, sizeof(job->reg));
+    job->memHash = batchHash(&statePtr->dataMem, statePtr->numMemory);
+    memFree(&statePtr->instrMem);
+    memFree(&statePtr->dataMem);
+    freeCaches(caches);
+}
+
+int runBatch(const char *manifest, int numThreads, int cycleLimit,
+             const predictorKindType *predictorKind, int useRas,
+             const cacheSetupType *cacheSetup, int width, const oooConfigType *ooo) {
+    batchRunType runInfo;
+    int i;
+
+    readManifest(manifest, &runInfo.batch, NUMMEMORY);
+    if (numThreads == 0) {
+        numThreads = poolDefaultWorkers();
+    }
+    runInfo.states = calloc(numThreads, sizeof(stateType *));
+    runInfo.predictors = calloc(numThreads, sizeof(predictorType *));
+    runInfo.caches = calloc(numThreads, sizeof(cachesType *));
+    runInfo.wides = calloc(numThreads, sizeof(wideStateType *));
+    runInfo.ooos = calloc(numThreads, sizeof(oooStateType *));
+    if (runInfo.states == NULL || runInfo.predictors == NULL || runInfo.caches == NULL
+            || runInfo.wides == NULL || runInfo.ooos == NULL) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    runInfo.cycleLimit = cycleLimit;
+    runInfo.predictorKind = predictorKind;
+    runInfo.useRas = useRas;
+    runInfo.width = width;
+    runInfo.ooo = ooo;
+    runInfo.cacheSetup = cacheSetup;
+    runPool(runInfo.batch.numJobs, numThreads, runBatchJob, &runInfo);
+    writeBatchRecords(&runInfo.batch, "cycles");
+
+    for (i = 0; i < numThreads; i++) {
+        free(runInfo.states[i]);
+        free(runInfo.predictors[i]);
+        free(runInfo.caches[i]);
+        free(runInfo.wides[i]);
+        free(runInfo.ooos[i]);
     }
-    return(num); 
+    free(runInfo.states);
+    free(runInfo.predictors);
+    free(runInfo.caches);
+    free(runInfo.wides);
+    free(runInfo.ooos);
+    return 0;
 }
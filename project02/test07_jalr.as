@@ -0,0 +1,25 @@
+        lw      0       1       count   $1 = 3 calls
+        lw      0       2       neg1    $2 = -1
+        lw      0       4       triAdr  load-use hazard into jalr
+loop    jalr    4       7               call triple, return address in $7
+        add     1       2       1       $1 = $1 - 1
+        beq     1       0       done
+        beq     0       0       loop
+done    halt
+triple  sw      0       7       save    $3 = $3 + 3 by way of inc
+        lw      0       5       incAdr
+        jalr    5       7               nested call, link forwarded to sw
+        lw      0       7       save
+        lw      0       6       two
+        add     3       6       3
+        jalr    7       6               return
+inc     lw      0       6       one
+        add     3       6       3       $3 = $3 + 1
+        jalr    7       6               return
+count   .fill   3
+neg1    .fill   -1
+one     .fill   1
+two     .fill   2
+triAdr  .fill   triple
+incAdr  .fill   inc
+save    .fill   0
@@ -0,0 +1,16 @@
+	lw	0	1	ten	$1 = 10
+	lw	0	2	one	$2 = 1
+	add	1	2	3	$3 = 11
+	sw	0	3	out1	data forwarded from EXMEM
+	nor	1	1	4	$4 = -11
+	noop
+	sw	0	4	out2	data forwarded from MEMWB
+	add	3	3	5	$5 = 22
+	lw	0	5	ten	lw right after a write to its regB
+	sw	0	5	out3	load-use stall, stores 10
+	halt
+ten	.fill	10
+one	.fill	1
+out1	.fill	0
+out2	.fill	0
+out3	.fill	0